@@ -0,0 +1,110 @@
+﻿#include "AssetFS.h"
+#include <iostream>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+std::string AssetFS::Normalize(const std::string& name) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (size_t i = 0; i <= name.size(); i++) {
+        char c = i < name.size() ? name[i] : '/';
+        if (c != '/' && c != '\\') {
+            part += (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+            continue;
+        }
+        if (part == "..") {
+            if (!parts.empty() && parts.back() != "..") parts.pop_back();
+            else parts.push_back(part);
+        }
+        else if (!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        part.clear();
+    }
+
+    std::string key;
+    for (const auto& p : parts) {
+        if (!key.empty()) key += '/';
+        key += p;
+    }
+    return key;
+}
+
+bool AssetFS::Mount(const std::string& root) {
+#ifdef _WIN32
+    DWORD attributes = GetFileAttributesA(root.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) return false;
+#else
+    struct stat st;
+    if (stat(root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+#endif
+
+    size_t before = files.size();
+    Scan(root, std::string());
+    std::cout << "Ресурсы: " << root << " (" << files.size() - before << " файлов)" << std::endl;
+    return true;
+}
+
+bool AssetFS::Resolve(const std::string& name, std::string& path) const {
+    auto found = files.find(Normalize(name));
+    if (found == files.end()) return false;
+    path = found->second;
+    return true;
+}
+
+// Файлы каталога root/relative и его подкаталогов
+void AssetFS::Scan(const std::string& root, const std::string& relative) {
+    const std::string dir = relative.empty() ? root : root + "/" + relative;
+
+    std::vector<std::string> subdirs;
+    auto add = [&](const std::string& name, bool isDir) {
+        if (name.empty() || name[0] == '.') return;
+        std::string rel = relative.empty() ? name : relative + "/" + name;
+        if (isDir) {
+            subdirs.push_back(rel);
+        }
+        else {
+            // Путь для открытия без лишнего "./" у текущего каталога
+            std::string path = root == "." ? rel : root + "/" + rel;
+            files.emplace(Normalize(rel), path);
+        }
+    };
+
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((dir + "/*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        const DWORD a = data.dwFileAttributes;
+        if ((a & FILE_ATTRIBUTE_DIRECTORY) && (a & FILE_ATTRIBUTE_REPARSE_POINT)) continue;
+        add(data.cFileName, (a & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    while (dirent* e = readdir(d)) {
+        bool isDir = e->d_type == DT_DIR;
+        if (e->d_type == DT_UNKNOWN || e->d_type == DT_LNK) {
+            struct stat st;
+            if (stat((dir + "/" + e->d_name).c_str(), &st) != 0) continue;
+            isDir = S_ISDIR(st.st_mode);
+            // По ссылкам на каталоги не ходим - они могут образовать цикл
+            if (isDir && e->d_type == DT_LNK) continue;
+        }
+        add(e->d_name, isDir);
+    }
+    closedir(d);
+#endif
+
+    for (const auto& sub : subdirs) {
+        Scan(root, sub);
+    }
+}
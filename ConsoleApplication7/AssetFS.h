@@ -0,0 +1,36 @@
+﻿#pragma once
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+// Индекс файлов ресурсов.
+// Каждый корень (Mount) обходится один раз при запуске, все его файлы
+// попадают в хеш-таблицу по относительному пути без учета регистра.
+// Resolve - один поиск в таблице без обращений к диску, вместо перебора
+// путей-кандидатов, каждый из которых был неудачным fopen.
+//
+// Корни, смонтированные раньше, имеют приоритет: файл с тем же
+// относительным путем из более позднего корня не заменяет уже найденный.
+// Индекс не меняется после монтирования, поэтому Resolve можно вызывать
+// из нескольких потоков одновременно. Файлы, появившиеся после Mount,
+// в нем не видны.
+class AssetFS {
+public:
+    // Обойти каталог root рекурсивно (скрытые файлы и каталоги, а также
+    // ссылки на каталоги пропускаются); false, если каталога нет
+    bool Mount(const std::string& root);
+
+    // Путь к файлу name (относительному, с / или \, в любом регистре);
+    // false, если его нет ни в одном корне
+    bool Resolve(const std::string& name, std::string& path) const;
+
+    size_t FileCount() const { return files.size(); }
+
+    // Ключ индекса: разделители /, без "." и "x/..", в нижнем регистре
+    static std::string Normalize(const std::string& name);
+
+private:
+    void Scan(const std::string& root, const std::string& relative);
+
+    std::unordered_map<std::string, std::string> files; // ключ -> путь для fopen
+};
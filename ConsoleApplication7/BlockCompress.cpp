@@ -0,0 +1,408 @@
+﻿#include "BlockCompress.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BC_SSE2
+#endif
+
+// Меньшие изображения кодируются в одном потоке
+static const int MinParallelBlocks = 64 * 64;
+
+BlockFormat ChooseBlockFormat(int components) {
+    if (components == 1) return BlockFormat::BC4;
+    if (components == 3) return BlockFormat::BC1;
+    return BlockFormat::BC3;
+}
+
+int BlockBytes(BlockFormat format) {
+    return format == BlockFormat::BC3 ? 16 : 8;
+}
+
+int BlockComponents(BlockFormat format) {
+    switch (format) {
+    case BlockFormat::BC1: return 3;
+    case BlockFormat::BC3: return 4;
+    case BlockFormat::BC4: return 1;
+    default: return 0;
+    }
+}
+
+size_t CompressedSize(BlockFormat format, int width, int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+// ---------------------------------------------------------------------------
+// Цвет (BC1 и цветовая часть BC3)
+
+static uint16_t Pack565(const float c[3]) {
+    int r = std::min(31, std::max(0, (int)(c[0] * 31.0f / 255.0f + 0.5f)));
+    int g = std::min(63, std::max(0, (int)(c[1] * 63.0f / 255.0f + 0.5f)));
+    int b = std::min(31, std::max(0, (int)(c[2] * 31.0f / 255.0f + 0.5f)));
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void Unpack565(uint16_t v, float c[3]) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (float)((r << 3) | (r >> 2));
+    c[1] = (float)((g << 2) | (g >> 4));
+    c[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Палитра 4-цветного режима: c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+static void ColorPalette(uint16_t c0, uint16_t c1, float palette[4][3]) {
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    for (int i = 0; i < 3; i++) {
+        palette[2][i] = (2.0f * palette[0][i] + palette[1][i]) / 3.0f;
+        palette[3][i] = (palette[0][i] + 2.0f * palette[1][i]) / 3.0f;
+    }
+}
+
+// Ближайший цвет палитры для каждого пикселя; возвращает суммарную ошибку
+static float MatchColors(const float pixels[16][3], const float palette[4][3], int indices[16]) {
+    float total = 0.0f;
+#if defined(BC_SSE2)
+    const __m128 pr = _mm_setr_ps(palette[0][0], palette[1][0], palette[2][0], palette[3][0]);
+    const __m128 pg = _mm_setr_ps(palette[0][1], palette[1][1], palette[2][1], palette[3][1]);
+    const __m128 pb = _mm_setr_ps(palette[0][2], palette[1][2], palette[2][2], palette[3][2]);
+    for (int i = 0; i < 16; i++) {
+        __m128 dr = _mm_sub_ps(pr, _mm_set1_ps(pixels[i][0]));
+        __m128 dg = _mm_sub_ps(pg, _mm_set1_ps(pixels[i][1]));
+        __m128 db = _mm_sub_ps(pb, _mm_set1_ps(pixels[i][2]));
+        __m128 err = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+        float e[4];
+        _mm_storeu_ps(e, err);
+        int best = 0;
+        for (int k = 1; k < 4; k++) {
+            if (e[k] < e[best]) best = k;
+        }
+        indices[i] = best;
+        total += e[best];
+    }
+#else
+    for (int i = 0; i < 16; i++) {
+        int best = 0;
+        float bestErr = 0.0f;
+        for (int k = 0; k < 4; k++) {
+            float dr = palette[k][0] - pixels[i][0];
+            float dg = palette[k][1] - pixels[i][1];
+            float db = palette[k][2] - pixels[i][2];
+            float e = dr * dr + dg * dg + db * db;
+            if (k == 0 || e < bestErr) {
+                best = k;
+                bestErr = e;
+            }
+        }
+        indices[i] = best;
+        total += bestErr;
+    }
+#endif
+    return total;
+}
+
+// Концы отрезка по главной оси облака цветов (степенной метод)
+static void PrincipalEndpoints(const float pixels[16][3], float lo[3], float hi[3]) {
+    float mean[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) mean[c] += pixels[i][c] / 16.0f;
+    }
+
+    float cov[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        float r = pixels[i][0] - mean[0], g = pixels[i][1] - mean[1], b = pixels[i][2] - mean[2];
+        cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+        cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+    }
+
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iter = 0; iter < 6; iter++) {
+        float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+        float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+        float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+        float len = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+        if (len < 1e-6f) break;
+        axis[0] = x / len;
+        axis[1] = y / len;
+        axis[2] = z / len;
+    }
+
+    float minDot = 1e30f, maxDot = -1e30f;
+    int minIndex = 0, maxIndex = 0;
+    for (int i = 0; i < 16; i++) {
+        float d = pixels[i][0] * axis[0] + pixels[i][1] * axis[1] + pixels[i][2] * axis[2];
+        if (d < minDot) { minDot = d; minIndex = i; }
+        if (d > maxDot) { maxDot = d; maxIndex = i; }
+    }
+    memcpy(lo, pixels[minIndex], sizeof(float) * 3);
+    memcpy(hi, pixels[maxIndex], sizeof(float) * 3);
+}
+
+// Концы по методу наименьших квадратов при известных индексах
+static bool RefineEndpoints(const float pixels[16][3], const int indices[16], float c0[3], float c1[3]) {
+    static const float w0[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0, bb = 0, ab = 0;
+    float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        float a = w0[indices[i]], b = 1.0f - a;
+        aa += a * a; bb += b * b; ab += a * b;
+        for (int c = 0; c < 3; c++) {
+            ax[c] += a * pixels[i][c];
+            bx[c] += b * pixels[i][c];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) return false;
+    for (int c = 0; c < 3; c++) {
+        c0[c] = std::min(255.0f, std::max(0.0f, (ax[c] * bb - bx[c] * ab) / det));
+        c1[c] = std::min(255.0f, std::max(0.0f, (bx[c] * aa - ax[c] * ab) / det));
+    }
+    return true;
+}
+
+static void WriteColorBlock(uint16_t c0, uint16_t c1, int indices[16], unsigned char* out) {
+    // 4-цветный режим требует c0 > c1; при перестановке концов меняются и индексы
+    if (c0 < c1) {
+        std::swap(c0, c1);
+        for (int i = 0; i < 16; i++) indices[i] ^= 1;
+    }
+    else if (c0 == c1) {
+        for (int i = 0; i < 16; i++) indices[i] = 0;
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= (uint32_t)indices[i] << (2 * i);
+    }
+    out[0] = (unsigned char)(c0 & 0xFF);
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xFF);
+    out[3] = (unsigned char)(c1 >> 8);
+    out[4] = (unsigned char)(bits & 0xFF);
+    out[5] = (unsigned char)((bits >> 8) & 0xFF);
+    out[6] = (unsigned char)((bits >> 16) & 0xFF);
+    out[7] = (unsigned char)(bits >> 24);
+}
+
+// rgba - 16 пикселей по 4 байта
+static void EncodeColorBlock(const unsigned char* rgba, unsigned char* out) {
+    float pixels[16][3];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) pixels[i][c] = rgba[i * 4 + c];
+    }
+
+    float lo[3], hi[3];
+    PrincipalEndpoints(pixels, lo, hi);
+    uint16_t c0 = Pack565(hi), c1 = Pack565(lo);
+
+    float palette[4][3];
+    int indices[16];
+    ColorPalette(c0, c1, palette);
+    float error = MatchColors(pixels, palette, indices);
+
+    // Два шага уточнения концов по найденным индексам
+    for (int iter = 0; iter < 2 && error > 0.0f; iter++) {
+        float r0[3], r1[3];
+        if (!RefineEndpoints(pixels, indices, r0, r1)) break;
+        uint16_t n0 = Pack565(r0), n1 = Pack565(r1);
+        if (n0 == c0 && n1 == c1) break;
+
+        int refined[16];
+        ColorPalette(n0, n1, palette);
+        float refinedError = MatchColors(pixels, palette, refined);
+        if (refinedError >= error) break;
+        c0 = n0;
+        c1 = n1;
+        error = refinedError;
+        memcpy(indices, refined, sizeof(indices));
+    }
+
+    WriteColorBlock(c0, c1, indices, out);
+}
+
+// ---------------------------------------------------------------------------
+// Один канал (BC4 и альфа BC3), 8-значный режим: a0 > a1
+
+static void EncodeSingleBlock(const unsigned char* values, int stride, unsigned char* out) {
+    int lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = std::min(lo, (int)values[i * stride]);
+        hi = std::max(hi, (int)values[i * stride]);
+    }
+
+    uint64_t bits = 0;
+    if (hi != lo) {
+        // Позиция на шкале от hi (0) до lo (7) -> индекс BC4: 0 = a0, 1 = a1, 2..7 - промежуточные
+        static const int indexOf[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+        for (int i = 0; i < 16; i++) {
+            int step = ((hi - values[i * stride]) * 14 + (hi - lo)) / (2 * (hi - lo));
+            bits |= (uint64_t)indexOf[step] << (3 * i);
+        }
+    }
+    out[0] = (unsigned char)hi;
+    out[1] = (unsigned char)lo;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = (unsigned char)((bits >> (8 * i)) & 0xFF);
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+// Блок 4x4 в RGBA; пиксели за краем - повтор крайних
+static void FetchBlock(const unsigned char* pixels, int width, int height, int components,
+    int bx, int by, unsigned char rgba[64]) {
+    for (int y = 0; y < 4; y++) {
+        int sy = std::min(by * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            int sx = std::min(bx * 4 + x, width - 1);
+            const unsigned char* p = pixels + ((size_t)sy * width + sx) * components;
+            unsigned char* d = rgba + (y * 4 + x) * 4;
+            switch (components) {
+            case 1: d[0] = d[1] = d[2] = p[0]; d[3] = 255; break;
+            case 2: d[0] = d[1] = d[2] = p[0]; d[3] = p[1]; break;
+            case 3: d[0] = p[0]; d[1] = p[1]; d[2] = p[2]; d[3] = 255; break;
+            default: memcpy(d, p, 4); break;
+            }
+        }
+    }
+}
+
+static void CompressRows(const unsigned char* pixels, int width, int height, int components,
+    BlockFormat format, unsigned char* out, int byStart, int byEnd) {
+    const int blocksX = (width + 3) / 4;
+    const int blockBytes = BlockBytes(format);
+    unsigned char rgba[64];
+
+    for (int by = byStart; by < byEnd; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            unsigned char* block = out + ((size_t)by * blocksX + bx) * blockBytes;
+            FetchBlock(pixels, width, height, components, bx, by, rgba);
+            switch (format) {
+            case BlockFormat::BC1:
+                EncodeColorBlock(rgba, block);
+                break;
+            case BlockFormat::BC3:
+                EncodeSingleBlock(rgba + 3, 4, block);
+                EncodeColorBlock(rgba, block + 8);
+                break;
+            case BlockFormat::BC4:
+                EncodeSingleBlock(rgba, 4, block);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+void CompressImage(const unsigned char* pixels, int width, int height, int components,
+    BlockFormat format, unsigned char* out, int threads) {
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    if (threads < 1 || blocksX * blocksY < MinParallelBlocks) threads = 1;
+    threads = std::min(threads, blocksY);
+
+    if (threads == 1) {
+        CompressRows(pixels, width, height, components, format, out, 0, blocksY);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        int y0 = blocksY * t / threads;
+        int y1 = blocksY * (t + 1) / threads;
+        pool.emplace_back(CompressRows, pixels, width, height, components, format, out, y0, y1);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void DecodeColorBlock(const unsigned char* block, unsigned char rgb[16][3]) {
+    uint16_t c0 = (uint16_t)(block[0] | (block[1] << 8));
+    uint16_t c1 = (uint16_t)(block[2] | (block[3] << 8));
+    float palette[4][3];
+    ColorPalette(c0, c1, palette);
+    if (c0 <= c1) {
+        // 3-цветный режим: середина и черный
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+            palette[3][c] = 0.0f;
+        }
+    }
+    uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+    for (int i = 0; i < 16; i++) {
+        int index = (bits >> (2 * i)) & 3;
+        for (int c = 0; c < 3; c++) rgb[i][c] = (unsigned char)(palette[index][c] + 0.5f);
+    }
+}
+
+static void DecodeSingleBlock(const unsigned char* block, unsigned char values[16]) {
+    int a0 = block[0], a1 = block[1];
+    int ramp[8] = { a0, a1 };
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++) ramp[i + 1] = ((7 - i) * a0 + i * a1 + 3) / 7;
+    }
+    else {
+        for (int i = 1; i < 5; i++) ramp[i + 1] = ((5 - i) * a0 + i * a1 + 2) / 5;
+        ramp[6] = 0;
+        ramp[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++) bits |= (uint64_t)block[2 + i] << (8 * i);
+    for (int i = 0; i < 16; i++) {
+        values[i] = (unsigned char)ramp[(bits >> (3 * i)) & 7];
+    }
+}
+
+void DecompressImage(const unsigned char* blocks, int width, int height,
+    BlockFormat format, unsigned char* out) {
+    const int blocksX = (width + 3) / 4;
+    const int blocksY = (height + 3) / 4;
+    const int blockBytes = BlockBytes(format);
+    const int c = BlockComponents(format);
+
+    for (int by = 0; by < blocksY; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            const unsigned char* block = blocks + ((size_t)by * blocksX + bx) * blockBytes;
+            unsigned char rgb[16][3], alpha[16];
+            if (format == BlockFormat::BC1) DecodeColorBlock(block, rgb);
+            if (format == BlockFormat::BC3) {
+                DecodeSingleBlock(block, alpha);
+                DecodeColorBlock(block + 8, rgb);
+            }
+            if (format == BlockFormat::BC4) DecodeSingleBlock(block, alpha);
+
+            for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+                    int i = y * 4 + x;
+                    unsigned char* p = out + ((size_t)(by * 4 + y) * width + bx * 4 + x) * c;
+                    if (format == BlockFormat::BC4) {
+                        p[0] = alpha[i];
+                        continue;
+                    }
+                    memcpy(p, rgb[i], 3);
+                    if (format == BlockFormat::BC3) p[3] = alpha[i];
+                }
+            }
+        }
+    }
+}
+
+double ComputePSNR(const unsigned char* a, const unsigned char* b, size_t count) {
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        double d = (double)a[i] - b[i];
+        sum += d * d;
+    }
+    if (sum == 0.0 || count == 0) return 99.0;
+    double mse = sum / count;
+    return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
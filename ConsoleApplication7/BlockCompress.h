@@ -0,0 +1,37 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Формат хранения текстуры на GPU
+enum class BlockFormat : uint32_t {
+    None, // без сжатия, 8 бит на компоненту
+    BC1,  // RGB, 8 байт на блок 4x4 (DXT1)
+    BC3,  // RGBA, 16 байт на блок: альфа как BC4 + цвет как BC1 (DXT5)
+    BC4   // один канал, 8 байт на блок (RGTC1) - карты высот и маски
+};
+
+// Формат сжатия для изображения из components компонент
+// (серое с альфой кодируется как RGBA)
+BlockFormat ChooseBlockFormat(int components);
+
+// Байт в блоке 4x4
+int BlockBytes(BlockFormat format);
+
+// Компонент на пиксель, которые format хранит (и выдает DecompressImage)
+int BlockComponents(BlockFormat format);
+
+// Размер сжатого уровня; неполные блоки на краях считаются целыми
+size_t CompressedSize(BlockFormat format, int width, int height);
+
+// Сжатие изображения в блоки (строки блоков сверху вниз).
+// Пиксели за краем берутся повтором крайних. Большие изображения
+// кодируются полосами блоков в нескольких потоках (threads = 0 - по числу ядер).
+void CompressImage(const unsigned char* pixels, int width, int height, int components,
+    BlockFormat format, unsigned char* out, int threads = 0);
+
+// Распаковка (для оценки качества), out - width*height*BlockComponents(format) байт
+void DecompressImage(const unsigned char* blocks, int width, int height,
+    BlockFormat format, unsigned char* out);
+
+// PSNR в дБ между двумя массивами байт одинаковой длины
+double ComputePSNR(const unsigned char* a, const unsigned char* b, size_t count);
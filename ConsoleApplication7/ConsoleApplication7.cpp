@@ -1,28 +1,50 @@
-﻿#include <iostream>
+﻿#include <cassert>
+#include <cfloat>
+#include <cstddef>
+#include <iostream>
 #include <vector>
 #include <map>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
+// Подсчет выделений памяти при загрузке - только если OBJL_ALLOC_TRACKING задан в настройках проекта
+#ifdef OBJL_ALLOC_TRACKING
+#define OBJL_ALLOC_TRACKING_IMPLEMENTATION
+#endif
 #include "OBJ_Loader.h"
+#include "AssetFS.h"
+#include "HotReload.h"
+#include "TextureManager.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// Большие JPEG с маркерами рестарта декодируются из памяти в несколько потоков
+#define STBI_JPEG_THREADS 4
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-std::map<std::string, unsigned int> loadedTextures;
+// Индекс файлов ресурсов: текстуры и материалы ищутся в нем, а не перебором путей
+AssetFS assets;
+
+// Текстуры загружаются лениво - когда меш впервые попал в кадр
+TextureManager textures;
+
+// true - LoadMeshes сразу отдает все текстуры модели пулу (Prefetch):
+// старт дольше и в памяти все текстуры, зато они готовы к первому кадру.
+// false - только то, что попало в кадр
+bool prefetchTextures = false;
 
 // Шейдеры для теней
 const char* shadowVertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
+layout (location = 3) in vec3 aOffset;
 
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
 void main() {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * model * vec4(aPos + aOffset, 1.0);
 }
 )";
 
@@ -37,6 +59,7 @@ const char* vertexShaderSource = R"(
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec3 aOffset; // смещение экземпляра
 
 out vec3 FragPos;
 out vec3 Normal;
@@ -49,11 +72,11 @@ uniform mat4 projection;
 uniform mat4 lightSpaceMatrix;
 
 void main() {
-    FragPos = vec3(model * vec4(aPos, 1.0));
+    FragPos = vec3(model * vec4(aPos + aOffset, 1.0));
     Normal = aNormal;
     TexCoord = aTexCoord;
     FragPosLightSpace = lightSpaceMatrix * vec4(FragPos, 1.0);
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * view * vec4(FragPos, 1.0);
 }
 )";
 
@@ -75,10 +98,65 @@ uniform vec3 lightPos;
 uniform vec3 viewPos;
 uniform vec3 lightColor;
 
-uniform sampler2D diffuseTexture;
+// Текстуры лежат слоями массивов (см. TextureManager): слой и прямоугольник
+// UV внутри слоя задаются на меш, привязка меняется только между страницами
+uniform sampler2DArray diffuseTexture;
+uniform float textureLayer;
+uniform vec4 textureRect;
 uniform sampler2D shadowMap;
 uniform bool useTexture;
 
+// Виртуальная текстура (см. VirtualTexture.h): таблица страниц хранит для
+// каждого тайла каждого уровня ячейку кэша (xy) и уровень тайла, который
+// в ней лежит (z) - у незагруженного тайла это ближайший загруженный предок
+uniform bool useVirtual;
+uniform sampler2D vtPageTable;
+uniform sampler2D vtCache;
+uniform vec2 vtSize;
+uniform float vtMaxLevel;
+uniform float vtCacheSize;
+
+// VirtualTileSize и VirtualTileBorder из TextureCache.h
+const float VtTile = 128.0;
+const float VtBorder = 4.0;
+
+vec3 SampleVirtualLevel(vec2 uv, float level) {
+    ivec2 tiles = textureSize(vtPageTable, int(level));
+    ivec2 tile = min(ivec2(uv * vec2(tiles)), tiles - 1);
+    vec3 entry = floor(texelFetch(vtPageTable, tile, int(level)).xyz * 255.0 + 0.5);
+
+    // Координаты внутри тайла считаются на уровне найденного тайла
+    vec2 texel = uv * max(vtSize / exp2(entry.z), vec2(1.0));
+    vec2 inTile = texel - floor(texel / VtTile) * VtTile;
+    vec2 cacheTexel = entry.xy * (VtTile + 2.0 * VtBorder) + VtBorder + inTile;
+    return textureLod(vtCache, cacheTexel / vtCacheSize, 0.0).rgb;
+}
+
+vec3 SampleVirtual(vec2 uv) {
+    // Уровень - по производным исходных UV, между соседними уровнями смешивание
+    vec2 dx = dFdx(uv * vtSize);
+    vec2 dy = dFdy(uv * vtSize);
+    float lod = clamp(0.5 * log2(max(dot(dx, dx), dot(dy, dy))), 0.0, vtMaxLevel);
+    float level = floor(lod);
+    vec2 wrapped = fract(uv);
+    vec3 fine = SampleVirtualLevel(wrapped, level);
+    vec3 coarse = SampleVirtualLevel(wrapped, min(level + 1.0, vtMaxLevel));
+    return mix(fine, coarse, lod - level);
+}
+
+vec3 SampleDiffuse(vec2 uv) {
+    if (textureRect.z < 1.0 || textureRect.w < 1.0) {
+        // Текстура в атласе: повтор внутри своего прямоугольника. Градиенты
+        // берутся от исходных UV, чтобы скачок fract не сбивал выбор мип-уровня.
+        // Вокруг прямоугольника рамка с повтором краев текстуры - выборка у края
+        // не захватывает соседние ячейки атласа
+        vec2 atlasUV = textureRect.xy + fract(uv) * textureRect.zw;
+        return textureGrad(diffuseTexture, vec3(atlasUV, textureLayer),
+            dFdx(uv) * textureRect.zw, dFdy(uv) * textureRect.zw).rgb;
+    }
+    return texture(diffuseTexture, vec3(uv, textureLayer)).rgb;
+}
+
 float ShadowCalculation(vec4 fragPosLightSpace, vec3 normal, vec3 lightDir) {
     // Перспективное деление
     vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
@@ -107,7 +185,7 @@ void main() {
     // Базовый цвет - из текстуры или из материала
     vec3 baseColor;
     if (useTexture) {
-        baseColor = texture(diffuseTexture, TexCoord).rgb;
+        baseColor = useVirtual ? SampleVirtual(TexCoord) : SampleDiffuse(TexCoord);
     } else {
         baseColor = material_Kd;
     }
@@ -137,6 +215,31 @@ void main() {
 }
 )";
 
+// Проход обратной связи виртуальных текстур: в пиксель пишется номер текстуры,
+// нужный уровень и тайл на нем (разбирает VirtualTextureCache::ProcessFeedback).
+// Буфер меньше экрана, поэтому к уровню прибавляется feedbackBias.
+const char* feedbackFragmentShaderSource = R"(
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+uniform int vtId;
+uniform vec2 vtSize;
+uniform float vtMaxLevel;
+uniform float feedbackBias;
+
+void main() {
+    vec2 dx = dFdx(TexCoord * vtSize);
+    vec2 dy = dFdy(TexCoord * vtSize);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + feedbackBias;
+    float level = floor(clamp(lod, 0.0, vtMaxLevel));
+    vec2 tiles = max(floor(vtSize / exp2(level) / 128.0), vec2(1.0));
+    vec2 tile = min(floor(fract(TexCoord) * tiles), tiles - 1.0);
+    FragColor = vec4(float(vtId + 1), level, tile) / 255.0;
+}
+)";
+
 // Простой шейдер для отладки shadow map
 const char* debugVertexShaderSource = R"(
 #version 330 core
@@ -298,70 +401,6 @@ DebugQuad CreateDebugQuad() {
     return debugQuad;
 }
 
-// Функция загрузки текстуры
-unsigned int LoadTexture(const std::string& filename) {
-    if (loadedTextures.find(filename) != loadedTextures.end()) {
-        return loadedTextures[filename];
-    }
-
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-
-    // Пробуем разные пути к файлу
-    std::vector<std::string> possiblePaths = {
-        filename,
-        "textures/" + filename,
-        "Textures/" + filename,
-        "./" + filename,
-        "../textures/" + filename
-    };
-
-    unsigned char* data = nullptr;
-    std::string foundPath;
-
-    for (const auto& path : possiblePaths) {
-        data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
-        if (data) {
-            foundPath = path;
-            std::cout << "Текстура загружена: " << foundPath << " (" << width << "x" << height << ")" << std::endl;
-            break;
-        }
-    }
-
-    if (data) {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    }
-    else {
-        std::cout << "ОШИБКА: Не удалось загрузить текстуру: " << filename << std::endl;
-        std::cout << "Проверь что файл существует в одной из папок:" << std::endl;
-        for (const auto& path : possiblePaths) {
-            std::cout << "  - " << path << std::endl;
-        }
-        textureID = 0;
-    }
-
-    stbi_image_free(data);
-    loadedTextures[filename] = textureID;
-    return textureID;
-}
-
 unsigned int CompileShader(unsigned int type, const char* source) {
     unsigned int shader = glCreateShader(type);
     glShaderSource(shader, 1, &source, nullptr);
@@ -377,9 +416,9 @@ unsigned int CompileShader(unsigned int type, const char* source) {
     return shader;
 }
 
-unsigned int CreateShaderProgram() {
+unsigned int CreateShaderProgram(const char* fragmentSource = fragmentShaderSource) {
     unsigned int vertexShader = CompileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    unsigned int fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+    unsigned int fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
 
     unsigned int shaderProgram = glCreateProgram();
     glAttachShader(shaderProgram, vertexShader);
@@ -402,76 +441,193 @@ unsigned int CreateShaderProgram() {
 
 struct MeshData {
     unsigned int VAO, VBO, EBO;
-    unsigned int textureID;
+    unsigned int instanceVBO; // смещения экземпляров, атрибут 3
+    TextureHandle texture;    // NoTexture, если у материала нет map_Kd
+    glm::vec3 boundsMin, boundsMax; // AABB всех экземпляров в пространстве модели
     objl::Material material;
     std::string name;
+    std::vector<std::string> instanceNames; // Mesh::InstanceNames, имена частей по экземплярам
     bool hasTexture;
     int indexCount;
+    int instanceCount;
+    uint64_t contentHash; // Mesh::SourceHash, для горячей перезагрузки
+    uint64_t geometryHash; // ключ в sharedGeometry (GeometryKey), 0 - буферы не общие
 };
 
-// Создание буферов для меша с учетом текстур
-MeshData SetupMesh(const objl::Mesh& mesh) {
+// Общие буферы геометрии: одинаковая (с точностью до сдвига) геометрия
+// из разных файлов и групп загружается на GPU один раз
+struct SharedGeometry {
+    unsigned int VBO, EBO;
+    int refs;
+};
+std::map<uint64_t, SharedGeometry> sharedGeometry;
+
+// Ключ общих буферов. Mesh::GeometryHash считается по сетке с шагом допуска
+// DetectInstances и совпадает у почти одинаковой геометрии, а буферы делятся
+// только при побайтно равных вершинах и индексах - поэтому ключ считается
+// по самим загружаемым данным.
+uint64_t GeometryKey(const objl::Mesh& mesh) {
+    if (mesh.GeometryHash == 0) return 0;
+    size_t vertexCount = mesh.Vertices.size();
+    uint64_t key = objl::algorithm::HashBytes(&vertexCount, sizeof(vertexCount));
+    key = objl::algorithm::HashBytes(mesh.Vertices.data(), vertexCount * sizeof(objl::Vertex), key);
+    key = objl::algorithm::HashBytes(mesh.Indices.data(), mesh.Indices.size() * sizeof(unsigned int), key);
+    return key != 0 ? key : 1;
+}
+
+// Создание буферов для меша с учетом текстур.
+// Меш передается по rvalue: вершины уходят в VBO прямо из mesh.Vertices
+// (раскладка objl::Vertex совпадает с атрибутами шейдера), имя и материал
+// переносятся в MeshData без копирования.
+// VBO/EBO берутся из sharedGeometry, если такая геометрия уже загружена;
+// свои у меша только VAO и буфер смещений экземпляров.
+MeshData SetupMesh(objl::Mesh&& mesh) {
     MeshData meshData;
-    meshData.material = mesh.MeshMaterial;
-    meshData.name = mesh.MeshName;
+    meshData.contentHash = mesh.SourceHash;
+    meshData.geometryHash = GeometryKey(mesh);
+    meshData.material = std::move(mesh.MeshMaterial);
+    meshData.name = std::move(mesh.MeshName);
     meshData.indexCount = mesh.Indices.size();
 
-    std::vector<float> vertices;
-
-    // Преобразуем вершины в плоский массив
-    for (const auto& vertex : mesh.Vertices) {
-        vertices.push_back(vertex.Position.X);
-        vertices.push_back(vertex.Position.Y);
-        vertices.push_back(vertex.Position.Z);
-        vertices.push_back(vertex.Normal.X);
-        vertices.push_back(vertex.Normal.Y);
-        vertices.push_back(vertex.Normal.Z);
-        vertices.push_back(vertex.TextureCoordinate.X);
-        vertices.push_back(vertex.TextureCoordinate.Y);
+    // Без обнаружения экземпляров меш рисуется один раз на своем месте
+    if (mesh.InstanceOffsets.empty()) {
+        mesh.InstanceOffsets.push_back(objl::Vector3());
+        mesh.InstanceNames.assign(1, meshData.name);
+    }
+    meshData.instanceNames = std::move(mesh.InstanceNames);
+    meshData.instanceCount = mesh.InstanceOffsets.size();
+
+    // Границы для проверки видимости: AABB геометрии, сдвинутый на каждое смещение
+    objl::Vector3 bmin, bmax;
+    objl::algorithm::MeshBounds(mesh, bmin, bmax);
+    meshData.boundsMin = glm::vec3(FLT_MAX);
+    meshData.boundsMax = glm::vec3(-FLT_MAX);
+    for (const auto& offset : mesh.InstanceOffsets) {
+        glm::vec3 o(offset.X, offset.Y, offset.Z);
+        meshData.boundsMin = glm::min(meshData.boundsMin, glm::vec3(bmin.X, bmin.Y, bmin.Z) + o);
+        meshData.boundsMax = glm::max(meshData.boundsMax, glm::vec3(bmax.X, bmax.Y, bmax.Z) + o);
     }
 
     glGenVertexArrays(1, &meshData.VAO);
-    glGenBuffers(1, &meshData.VBO);
-    glGenBuffers(1, &meshData.EBO);
-
     glBindVertexArray(meshData.VAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, meshData.VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    auto shared = sharedGeometry.find(meshData.geometryHash);
+    if (meshData.geometryHash != 0 && shared != sharedGeometry.end()) {
+        meshData.VBO = shared->second.VBO;
+        meshData.EBO = shared->second.EBO;
+        shared->second.refs++;
+        glBindBuffer(GL_ARRAY_BUFFER, meshData.VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshData.EBO);
+    }
+    else {
+        glGenBuffers(1, &meshData.VBO);
+        glGenBuffers(1, &meshData.EBO);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshData.EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-        mesh.Indices.size() * sizeof(unsigned int),
-        mesh.Indices.data(),
-        GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, meshData.VBO);
+        glBufferData(GL_ARRAY_BUFFER, mesh.Vertices.size() * sizeof(objl::Vertex), mesh.Vertices.data(), GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshData.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+            mesh.Indices.size() * sizeof(unsigned int),
+            mesh.Indices.data(),
+            GL_STATIC_DRAW);
+
+        if (meshData.geometryHash != 0) {
+            sharedGeometry[meshData.geometryHash] = { meshData.VBO, meshData.EBO, 1 };
+        }
+    }
 
     // Атрибуты вершин
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(objl::Vertex), (void*)offsetof(objl::Vertex, Position));
     glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(objl::Vertex), (void*)offsetof(objl::Vertex, Normal));
     glEnableVertexAttribArray(1);
 
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(objl::Vertex), (void*)offsetof(objl::Vertex, TextureCoordinate));
     glEnableVertexAttribArray(2);
 
+    // Смещения экземпляров - по одному на экземпляр
+    glGenBuffers(1, &meshData.instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, meshData.instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh.InstanceOffsets.size() * sizeof(objl::Vector3), mesh.InstanceOffsets.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(objl::Vector3), (void*)0);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+
     glBindVertexArray(0);
 
-    // Загружаем текстуру если есть
-    meshData.hasTexture = !mesh.MeshMaterial.map_Kd.empty();
-    if (meshData.hasTexture) {
-        std::cout << "Пытаемся загрузить текстуру: " << mesh.MeshMaterial.map_Kd << std::endl;
-        meshData.textureID = LoadTexture(mesh.MeshMaterial.map_Kd);
+    // Текстура только регистрируется, файл читается при первой видимости меша
+    // (или раньше, если LoadMeshes запросил ее заранее - prefetchTextures)
+    meshData.hasTexture = !meshData.material.map_Kd.empty();
+    meshData.texture = meshData.hasTexture ? textures.Request(meshData.material.map_Kd, meshData.material.map_max_size) : NoTexture;
+
+    return meshData;
+}
+
+// Освобождение буферов меша (текстуры общие и остаются в TextureManager).
+// Общая геометрия удаляется вместе с последним мешем, который ее использует
+void DeleteMesh(MeshData& meshData) {
+    glDeleteVertexArrays(1, &meshData.VAO);
+    glDeleteBuffers(1, &meshData.instanceVBO);
+
+    auto shared = sharedGeometry.find(meshData.geometryHash);
+    if (meshData.geometryHash != 0 && shared != sharedGeometry.end()) {
+        if (--shared->second.refs > 0) return;
+        sharedGeometry.erase(shared);
     }
-    else {
-        meshData.textureID = 0;
+    glDeleteBuffers(1, &meshData.VBO);
+    glDeleteBuffers(1, &meshData.EBO);
+}
+
+// Отрисовка всех экземпляров меша одним вызовом
+void DrawMesh(const MeshData& meshData) {
+    glBindVertexArray(meshData.VAO);
+    glDrawElementsInstanced(GL_TRIANGLES, meshData.indexCount, GL_UNSIGNED_INT, 0, meshData.instanceCount);
+}
+
+// Применение результата горячей перезагрузки.
+// Если набор мешей тот же, заменяются буферы только тех мешей,
+// у которых изменился хеш содержимого; иначе модель пересоздается целиком.
+void ApplyReload(ReloadResult& result, std::vector<MeshData>& meshes) {
+    bool sameLayout = result.meshes.size() == meshes.size();
+    for (size_t i = 0; sameLayout && i < meshes.size(); i++) {
+        sameLayout = meshes[i].name == result.meshes[i].MeshName;
     }
 
-    return meshData;
+    if (!sameLayout) {
+        for (auto& meshData : meshes) {
+            DeleteMesh(meshData);
+        }
+        meshes.clear();
+        for (auto& mesh : result.meshes) {
+            meshes.push_back(SetupMesh(std::move(mesh)));
+        }
+        std::cout << "Модель пересоздана: " << result.path << " (" << meshes.size() << " мешей)" << std::endl;
+        return;
+    }
+
+    int replaced = 0;
+    for (size_t i = 0; i < meshes.size(); i++) {
+        // Хеш разобранного OBJ, а не загруженных вершин: меши из кэша
+        // квантованы, но их SourceHash совпадает с хешем нового разбора
+        if (meshes[i].contentHash != 0 && meshes[i].contentHash == result.meshes[i].SourceHash) continue;
+
+        // Новые буферы создаются до удаления старых, так что кадр
+        // не ждет, пока драйвер закончит работу со старыми
+        MeshData fresh = SetupMesh(std::move(result.meshes[i]));
+        DeleteMesh(meshes[i]);
+        meshes[i] = fresh;
+        replaced++;
+    }
+    std::cout << "Модель обновлена: " << result.path << " (заменено мешей: "
+        << replaced << " из " << meshes.size() << ")" << std::endl;
 }
 
 // Установка материала и текстуры
-void SetMaterial(unsigned int shaderProgram, const MeshData& meshData) {
+// boundTexture - массив, уже привязанный к GL_TEXTURE0 в этом проходе;
+// виртуальная текстура привязывается к GL_TEXTURE2 (таблица страниц) и GL_TEXTURE3 (кэш)
+void SetMaterial(unsigned int shaderProgram, const MeshData& meshData, unsigned int& boundTexture) {
     const auto& material = meshData.material;
 
     glUniform3f(glGetUniformLocation(shaderProgram, "material_Kd"),
@@ -483,11 +639,31 @@ void SetMaterial(unsigned int shaderProgram, const MeshData& meshData) {
     glUniform1f(glGetUniformLocation(shaderProgram, "material_Ns"),
         material.Ns > 0 ? material.Ns : 32.0f);
 
-    // Устанавливаем текстуру
-    if (meshData.hasTexture && meshData.textureID != 0) {
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, meshData.textureID);
-        glUniform1i(glGetUniformLocation(shaderProgram, "diffuseTexture"), 0);
+    // Устанавливаем текстуру; пока она не загружена - цвет material_Kd
+    TextureSlot slot;
+    VirtualBinding binding;
+    bool loaded = meshData.hasTexture && textures.GetSlot(meshData.texture, slot);
+    if (loaded && slot.virtualId >= 0 && textures.VirtualTextures().GetBinding(slot.virtualId, binding)) {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, binding.pageTable);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, binding.cache);
+        glUniform2f(glGetUniformLocation(shaderProgram, "vtSize"), binding.width, binding.height);
+        glUniform1f(glGetUniformLocation(shaderProgram, "vtMaxLevel"), binding.maxLevel);
+        glUniform1f(glGetUniformLocation(shaderProgram, "vtCacheSize"), binding.cacheSize);
+        glUniform1i(glGetUniformLocation(shaderProgram, "useVirtual"), 1);
+        glUniform1i(glGetUniformLocation(shaderProgram, "useTexture"), 1);
+    }
+    else if (loaded && slot.virtualId < 0) {
+        if (slot.texture != boundTexture) {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, slot.texture);
+            boundTexture = slot.texture;
+        }
+        glUniform1f(glGetUniformLocation(shaderProgram, "textureLayer"), slot.layer);
+        glUniform4f(glGetUniformLocation(shaderProgram, "textureRect"),
+            slot.rect[0], slot.rect[1], slot.rect[2], slot.rect[3]);
+        glUniform1i(glGetUniformLocation(shaderProgram, "useVirtual"), 0);
         glUniform1i(glGetUniformLocation(shaderProgram, "useTexture"), 1);
     }
     else {
@@ -495,6 +671,154 @@ void SetMaterial(unsigned int shaderProgram, const MeshData& meshData) {
     }
 }
 
+// Проверка AABB на пересечение с пирамидой видимости.
+// Плоскости берутся из строк матрицы mvp (метод Gribb/Hartmann),
+// для каждой плоскости проверяется самая дальняя по нормали вершина AABB.
+bool AabbInFrustum(const glm::mat4& mvp, const glm::vec3& bmin, const glm::vec3& bmax) {
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; r++) {
+        rows[r] = glm::vec4(mvp[0][r], mvp[1][r], mvp[2][r], mvp[3][r]);
+    }
+    const glm::vec4 planes[6] = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2]
+    };
+    for (const auto& plane : planes) {
+        glm::vec3 p(plane.x >= 0.0f ? bmax.x : bmin.x,
+            plane.y >= 0.0f ? bmax.y : bmin.y,
+            plane.z >= 0.0f ? bmax.z : bmin.z);
+        if (plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Параметры загрузки моделей (общие для main и горячей перезагрузки)
+objl::LoaderOptions ModelLoadOptions() {
+    objl::LoaderOptions options;
+    // Объединенные списки LoadedVertices/LoadedIndices не используются
+    options.KeepCombinedLists = false;
+    // Вырожденные и повторяющиеся треугольники не попадают в EBO
+    options.CleanMeshes = true;
+    // Треугольники в порядке кривой Мортона - локальность для отсечения и запросов
+    options.SortTrianglesMorton = true;
+    // Повторяющиеся части (колеса, болты...) - одна геометрия и смещения экземпляров
+    options.DetectInstances = true;
+    // Хеши мешей хранятся в кэше - по ним перезагрузка находит изменившиеся
+    options.HashMeshes = true;
+    // Файлы .mtl ищутся в индексе ресурсов
+    options.ResolveFile = [](const std::string& name, std::string& path) {
+        return assets.Resolve(name, path);
+    };
+    return options;
+}
+
+// Отчет о загрузке модели: время по фазам, прочитанные байты,
+// количество строк по типам записей, выделения памяти
+void PrintLoadStats(const std::string& path, const objl::stats::LoadStats& stats) {
+    std::cout << "=== ЗАГРУЗКА МОДЕЛИ: " << path << (stats.FromCache ? " (из кэша)" : "") << " ===" << std::endl;
+    std::cout << "  Время: " << stats.TotalSeconds * 1000.0 << " мс, прочитано: "
+        << stats.BytesRead / 1024 << " КБ" << std::endl;
+
+    if (!stats.FromCache) {
+        for (int i = 0; i < objl::stats::PhaseCount; i++) {
+            std::cout << "  - " << objl::stats::PhaseName(i) << ": " << stats.PhaseSeconds[i] * 1000.0 << " мс" << std::endl;
+        }
+        std::cout << "  Строки:";
+        for (int i = 0; i < objl::stats::RecordCount; i++) {
+            std::cout << " " << objl::stats::RecordName(i) << "=" << stats.Lines[i];
+        }
+        std::cout << std::endl;
+
+        if (stats.RemovedDegenerate + stats.RemovedDuplicates + stats.RemovedVertices > 0) {
+            std::cout << "  Удалено: вырожденных треугольников " << stats.RemovedDegenerate
+                << ", повторяющихся " << stats.RemovedDuplicates
+                << ", неиспользуемых вершин " << stats.RemovedVertices << std::endl;
+        }
+        if (stats.LocalityAfter > 0.0) {
+            std::cout << "  Локальность треугольников: " << stats.LocalityBefore
+                << " -> " << stats.LocalityAfter << std::endl;
+        }
+        if (stats.FoldedInstances > 0) {
+            std::cout << "  Свернуто в экземпляры мешей: " << stats.FoldedInstances << std::endl;
+        }
+        if (stats.MeshCopies > 0) {
+            std::cout << "  ВНИМАНИЕ: копий мешей при загрузке: " << stats.MeshCopies << std::endl;
+        }
+    }
+
+    if (stats.AllocTracking) {
+        std::cout << "  Выделений памяти: " << stats.Allocations << " (" << stats.AllocatedBytes / 1024
+            << " КБ), пик: " << stats.PeakBytes / 1024 << " КБ" << std::endl;
+    }
+}
+
+// Загрузка модели: сначала из сжатого кэша рядом с .obj,
+// если кэша нет или он устарел - разбор OBJ и запись нового кэша
+bool LoadModel(objl::Loader& loader, const std::string& path) {
+    loader.Options = ModelLoadOptions();
+
+    const std::string cachePath = path + ".cache";
+    if (loader.LoadCache(cachePath, path)) {
+        PrintLoadStats(path, loader.Stats);
+        return true;
+    }
+
+    if (!loader.LoadFile(path)) {
+        return false;
+    }
+    PrintLoadStats(path, loader.Stats);
+
+    if (!loader.SaveCache(cachePath, path)) {
+        std::cout << "Не удалось записать кэш модели: " << cachePath << std::endl;
+    }
+    return true;
+}
+
+// Загрузка модели и передача ее мешей на GPU.
+// Меши переносятся из загрузчика без копирования, сам загрузчик
+// уничтожается сразу после этого вместе с остатками данных разбора.
+// prefetch - декодировать все текстуры модели сразу, а не по видимости
+bool LoadMeshes(const std::string& path, std::vector<MeshData>& meshes, std::vector<std::string>& materialFiles,
+    bool prefetch = false) {
+    const uint64_t meshCopies = objl::Mesh::Copies();
+    objl::Loader loader;
+    if (!LoadModel(loader, path)) {
+        return false;
+    }
+
+    // С prefetch текстуры всех материалов сразу уходят рабочим потокам и
+    // декодируются параллельно, пока меши загружаются на GPU, а не по одной
+    // при первом показе. Сначала регистрируются все материалы: у файла, общего
+    // для нескольких материалов, декодируется версия с наибольшим из их
+    // пределов map_max_size
+    if (prefetch) {
+        std::vector<TextureHandle> handles;
+        for (const auto& material : loader.LoadedMaterials) {
+            if (!material.map_Kd.empty()) {
+                handles.push_back(textures.Request(material.map_Kd, material.map_max_size));
+            }
+        }
+        for (TextureHandle handle : handles) {
+            textures.Prefetch(handle);
+        }
+    }
+
+    meshes.reserve(meshes.size() + loader.LoadedMeshes.size());
+    for (auto& mesh : loader.LoadedMeshes) {
+        meshes.push_back(SetupMesh(std::move(mesh)));
+    }
+    materialFiles = std::move(loader.MaterialFiles);
+
+    // От разбора (или кэша) до VBO ни один меш не должен копироваться
+    // (копии считаются в сборке с OBJL_COUNT_MESH_COPIES, иначе Copies() == 0)
+    assert(objl::Mesh::Copies() == meshCopies && "меш скопирован по пути загрузки");
+    (void)meshCopies;
+    return true;
+}
+
 int main() {
     // Инициализация GLFW
     if (!glfwInit()) return -1;
@@ -520,45 +844,60 @@ int main() {
     // Создаем отладочный квадрат
     DebugQuad debugQuad = CreateDebugQuad();
 
-    // ЗАГРУЗКА МОДЕЛИ
-    objl::Loader loader;
-    std::cout << "=== ЗАГРУЗКА МОДЕЛИ ===" << std::endl;
-    if (!loader.LoadFile("obj/GTR.obj")) {
-        std::cout << "Не удалось загрузить модель!" << std::endl;
-        return -1;
-    }
-
-    objl::Loader loader1;
-    std::cout << "=== ЗАГРУЗКА МОДЕЛИ ===" << std::endl;
-    if (!loader1.LoadFile("obj/GTR.obj")) {
-        std::cout << "Не удалось загрузить модель!" << std::endl;
-        return -1;
-    }
-    objl::Loader loader2;
-    std::cout << "=== ЗАГРУЗКА МОДЕЛИ ===" << std::endl;
-    if (!loader2.LoadFile("obj/table.obj")) {
-        std::cout << "Не удалось загрузить модель!" << std::endl;
-        return -1;
-    }
+    // Корни ресурсов в порядке приоритета (раньше текстуры искались
+    // по тем же путям: рядом с программой, в textures/ и ../textures/)
+    assets.Mount(".");
+    assets.Mount("textures");
+    assets.Mount("../textures");
+
+    // Рабочие потоки декодирования текстур; BC1/BC3 требуют S3TC
+    textures.SetFileSystem(&assets);
+    textures.SetCompression(GLEW_EXT_texture_compression_s3tc != 0);
+    textures.SetImmutableStorage(GLEW_ARB_texture_storage != 0);
+    textures.SetMemoryBudget(256 * 1024 * 1024);
+    // Текстуры больше 2048 уменьшаются при загрузке (материал может
+    // задать свой предел через map_max_size)
+    textures.SetMaxTextureSize(2048);
+    textures.Start();
 
     // Создаем шейдерную программу
     unsigned int shaderProgram = CreateShaderProgram();
     unsigned int shaderProgram1 = CreateShaderProgram();
     unsigned int shaderProgram2 = CreateShaderProgram();
+    unsigned int feedbackProgram = CreateShaderProgram(feedbackFragmentShaderSource);
 
-    // Создаем меши с текстурами
+    // ЗАГРУЗКА МОДЕЛЕЙ и создание мешей с текстурами.
+    // Загрузчики живут только до передачи мешей на GPU
     std::vector<MeshData> meshes;
-    for (const auto& mesh : loader.LoadedMeshes) {
-        meshes.push_back(SetupMesh(mesh));
-    }
     std::vector<MeshData> meshes1;
-    for (const auto& mesh : loader1.LoadedMeshes) {
-        meshes1.push_back(SetupMesh(mesh));
-    }
     std::vector<MeshData> meshes2;
-    for (const auto& mesh : loader2.LoadedMeshes) {
-        meshes2.push_back(SetupMesh(mesh));
+    std::vector<std::string> gtrMaterials;
+    std::vector<std::string> tableMaterials;
+    if (!LoadMeshes("obj/GTR.obj", meshes, gtrMaterials, prefetchTextures) ||
+        !LoadMeshes("obj/GTR.obj", meshes1, gtrMaterials, prefetchTextures) ||
+        !LoadMeshes("obj/table.obj", meshes2, tableMaterials, prefetchTextures)) {
+        std::cout << "Не удалось загрузить модель!" << std::endl;
+        return -1;
     }
+    std::cout << "Мешей: " << meshes.size() + meshes1.size() + meshes2.size()
+        << ", общих буферов геометрии: " << sharedGeometry.size() << std::endl;
+
+    // Горячая перезагрузка: следим за OBJ и их материалами
+    struct ModelSlot {
+        std::string path;
+        std::vector<MeshData>* meshes;
+    };
+    ModelSlot modelSlots[] = {
+        { "obj/GTR.obj", &meshes },
+        { "obj/GTR.obj", &meshes1 },
+        { "obj/table.obj", &meshes2 }
+    };
+
+    ModelReloader reloader;
+    reloader.SetLoaderOptions(ModelLoadOptions());
+    reloader.Watch("obj/GTR.obj", gtrMaterials);
+    reloader.Watch("obj/table.obj", tableMaterials);
+    reloader.Start();
 
     glEnable(GL_DEPTH_TEST);
 
@@ -598,6 +937,31 @@ int main() {
 
     // Основной цикл рендеринга
     while (!glfwWindowShouldClose(window)) {
+        // 0. ГОРЯЧАЯ ПЕРЕЗАГРУЗКА - между кадрами, не больше одной модели за кадр
+        ReloadResult reload;
+        if (reloader.TryPop(reload)) {
+            // ApplyReload забирает меши из результата: последняя модель с этим
+            // путем получает сам результат, остальные - его копию
+            std::vector<std::vector<MeshData>*> targets;
+            for (auto& slot : modelSlots) {
+                if (slot.path == reload.path) {
+                    targets.push_back(slot.meshes);
+                }
+            }
+            for (size_t i = 0; i < targets.size(); i++) {
+                if (i + 1 < targets.size()) {
+                    ReloadResult copy = reload;
+                    ApplyReload(copy, *targets[i]);
+                }
+                else {
+                    ApplyReload(reload, *targets[i]);
+                }
+            }
+        }
+
+        // Текстуры, декодированные к этому кадру, загружаются в GL
+        textures.Update();
+
         // 1. РЕНДЕРИНГ В SHADOW MAP
         glViewport(0, 0, shadowMap.width, shadowMap.height);
         glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.FBO);
@@ -638,33 +1002,25 @@ int main() {
         glUniformMatrix4fv(glGetUniformLocation(shadowMap.shaderProgram, "model"),
             1, GL_FALSE, glm::value_ptr(modelMat));
         for (int i = 0; i < meshes.size(); i++) {
-            glBindVertexArray(meshes[i].VAO);
-            glDrawElements(GL_TRIANGLES, meshes[i].indexCount, GL_UNSIGNED_INT, 0);
+            DrawMesh(meshes[i]);
         }
 
         // Второй объект
         glUniformMatrix4fv(glGetUniformLocation(shadowMap.shaderProgram, "model"),
             1, GL_FALSE, glm::value_ptr(modelMat1));
         for (int i = 0; i < meshes1.size(); i++) {
-            glBindVertexArray(meshes1[i].VAO);
-            glDrawElements(GL_TRIANGLES, meshes1[i].indexCount, GL_UNSIGNED_INT, 0);
+            DrawMesh(meshes1[i]);
         }
 
         // Третий объект
         glUniformMatrix4fv(glGetUniformLocation(shadowMap.shaderProgram, "model"),
             1, GL_FALSE, glm::value_ptr(modelMat2));
         for (int i = 0; i < meshes2.size(); i++) {
-            glBindVertexArray(meshes2[i].VAO);
-            glDrawElements(GL_TRIANGLES, meshes2[i].indexCount, GL_UNSIGNED_INT, 0);
+            DrawMesh(meshes2[i]);
         }
 
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-        // 2. ОСНОВНОЙ РЕНДЕРИНГ
-        glViewport(0, 0, 1920, 1080);
-        glClearColor(16.0f / 255.0f, 122.0f / 255.0f, 176.0f / 255.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
         // Матрицы камеры
         glm::mat4 view = glm::lookAt(
             cameraPos,
@@ -673,6 +1029,43 @@ int main() {
         );
         glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1920.0f / 1080.0f, 0.1f, 100.0f);
 
+        // 2. ОБРАТНАЯ СВЯЗЬ ВИРТУАЛЬНЫХ ТЕКСТУР - какие тайлы видны в кадре
+        VirtualTextureCache& virtualTextures = textures.VirtualTextures();
+        if (!showDebugQuad && virtualTextures.Count() > 0) {
+            virtualTextures.BeginFeedback(1920, 1080);
+            glUseProgram(feedbackProgram);
+            glUniformMatrix4fv(glGetUniformLocation(feedbackProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniformMatrix4fv(glGetUniformLocation(feedbackProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniform1f(glGetUniformLocation(feedbackProgram, "feedbackBias"), virtualTextures.FeedbackBias());
+
+            // Рисуются только видимые меши с готовыми виртуальными текстурами
+            auto RenderFeedback = [&](const std::vector<MeshData>& meshes, const glm::mat4& modelMatrix) {
+                glUniformMatrix4fv(glGetUniformLocation(feedbackProgram, "model"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
+                glm::mat4 mvp = projection * view * modelMatrix;
+                for (int i = 0; i < meshes.size(); i++) {
+                    TextureSlot slot;
+                    VirtualBinding binding;
+                    if (!meshes[i].hasTexture || !textures.GetSlot(meshes[i].texture, slot) || slot.virtualId < 0) continue;
+                    if (!virtualTextures.GetBinding(slot.virtualId, binding)) continue;
+                    if (!AabbInFrustum(mvp, meshes[i].boundsMin, meshes[i].boundsMax)) continue;
+
+                    glUniform1i(glGetUniformLocation(feedbackProgram, "vtId"), slot.virtualId);
+                    glUniform2f(glGetUniformLocation(feedbackProgram, "vtSize"), binding.width, binding.height);
+                    glUniform1f(glGetUniformLocation(feedbackProgram, "vtMaxLevel"), binding.maxLevel);
+                    DrawMesh(meshes[i]);
+                }
+            };
+            RenderFeedback(meshes, modelMat);
+            RenderFeedback(meshes1, modelMat1);
+            RenderFeedback(meshes2, modelMat2);
+            virtualTextures.EndFeedback();
+        }
+
+        // 3. ОСНОВНОЙ РЕНДЕРИНГ
+        glViewport(0, 0, 1920, 1080);
+        glClearColor(16.0f / 255.0f, 122.0f / 255.0f, 176.0f / 255.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
         if (!showDebugQuad) {
             // Функция для рендеринга объекта с тенями
             auto RenderObject = [&](unsigned int shaderProgram, const std::vector<MeshData>& meshes,
@@ -693,12 +1086,20 @@ int main() {
                     glActiveTexture(GL_TEXTURE1);
                     glBindTexture(GL_TEXTURE_2D, shadowMap.depthMap);
                     glUniform1i(glGetUniformLocation(shaderProgram, "shadowMap"), 1);
-
-                    // Рендерим меши
+                    glUniform1i(glGetUniformLocation(shaderProgram, "diffuseTexture"), 0);
+                    glUniform1i(glGetUniformLocation(shaderProgram, "vtPageTable"), 2);
+                    glUniform1i(glGetUniformLocation(shaderProgram, "vtCache"), 3);
+                    unsigned int boundTexture = 0;
+
+                    // Рендерим меши. Меши вне пирамиды видимости пропускаются,
+                    // видимые запрашивают свою текстуру
+                    glm::mat4 mvp = projection * view * modelMatrix;
                     for (int i = 0; i < meshes.size(); i++) {
-                        SetMaterial(shaderProgram, meshes[i]);
-                        glBindVertexArray(meshes[i].VAO);
-                        glDrawElements(GL_TRIANGLES, meshes[i].indexCount, GL_UNSIGNED_INT, 0);
+                        if (!AabbInFrustum(mvp, meshes[i].boundsMin, meshes[i].boundsMax)) continue;
+                        textures.MarkVisible(meshes[i].texture);
+
+                        SetMaterial(shaderProgram, meshes[i], boundTexture);
+                        DrawMesh(meshes[i]);
                     }
                 };
 
@@ -806,6 +1207,14 @@ int main() {
     }
 
     // Очистка ресурсов
+    reloader.Stop();
+    textures.Stop();
+    TextureStats stats = textures.GetStats();
+    std::cout << "Текстуры: " << stats.residentCount << " загружено, " << stats.residentBytes / (1024 * 1024)
+        << " МБ (страницы " << stats.allocatedBytes / (1024 * 1024) << " МБ), попаданий " << stats.hits
+        << ", промахов " << stats.misses << ", выгружено " << stats.evictions << ", уменьшено " << stats.drops
+        << ", дубликатов " << stats.duplicates << " (" << stats.sharedBytes / 1024 << " КБ общих)" << std::endl;
+    textures.DeleteTextures();
     glDeleteFramebuffers(1, &shadowMap.FBO);
     glDeleteTextures(1, &shadowMap.depthMap);
     glDeleteProgram(shadowMap.shaderProgram);
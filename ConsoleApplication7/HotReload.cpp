@@ -0,0 +1,260 @@
+﻿#include "HotReload.h"
+#include <exception>
+#include <iostream>
+#include <set>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+#endif
+
+namespace {
+    // Каталог и имя файла из пути
+    void SplitPath(const std::string& path, std::string& dir, std::string& name) {
+        size_t slash = path.find_last_of("/\\");
+        if (slash == std::string::npos) {
+            dir = ".";
+            name = path;
+        }
+        else {
+            dir = path.substr(0, slash);
+            name = path.substr(slash + 1);
+        }
+    }
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        std::cout << "ОШИБКА: inotify недоступен, горячая перезагрузка отключена" << std::endl;
+    }
+}
+
+FileWatcher::~FileWatcher() {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+void FileWatcher::Watch(const std::string& path) {
+    files.push_back(path);
+    if (fd < 0) return;
+
+    std::string dir, name;
+    SplitPath(path, dir, name);
+    for (const auto& d : dirs) {
+        if (d.second == dir) return;
+    }
+
+    int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd >= 0) {
+        dirs[wd] = dir;
+    }
+}
+
+std::vector<std::string> FileWatcher::Wait(int timeoutMs) {
+    std::vector<std::string> changed;
+    if (fd < 0) return changed;
+
+    pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, timeoutMs) <= 0) return changed;
+
+    alignas(inotify_event) char buffer[4096];
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* ptr = buffer; ptr < buffer + len; ) {
+            const inotify_event* event = (const inotify_event*)ptr;
+            ptr += sizeof(inotify_event) + event->len;
+            if (event->len == 0) continue;
+
+            auto dir = dirs.find(event->wd);
+            if (dir == dirs.end()) continue;
+
+            // Сравниваем имя события с отслеживаемыми файлами этого каталога
+            for (const auto& file : files) {
+                std::string fileDir, fileName;
+                SplitPath(file, fileDir, fileName);
+                if (fileDir == dir->second && fileName == event->name) {
+                    changed.push_back(file);
+                }
+            }
+        }
+    }
+    return changed;
+}
+
+#else
+
+namespace {
+    // Размер и время изменения с полным разрешением: 100 нс в Windows,
+    // наносекунды в POSIX. st_mtime в секундах пропускает второе
+    // сохранение в ту же секунду. { -1, -1 } - файла нет
+    FileWatcher::Stamp FileStamp(const std::string& path) {
+        FileWatcher::Stamp stamp = { -1, -1 };
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) return stamp;
+        stamp.size = ((long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        stamp.time = ((long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return stamp;
+        stamp.size = (long long)st.st_size;
+#ifdef __APPLE__
+        stamp.time = (long long)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#else
+        stamp.time = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+#endif
+        return stamp;
+    }
+}
+
+FileWatcher::FileWatcher() {
+}
+
+FileWatcher::~FileWatcher() {
+}
+
+void FileWatcher::Watch(const std::string& path) {
+    files.push_back(path);
+    stamps[path] = FileStamp(path);
+}
+
+// Изменение сообщается, когда отметка файла не менялась целый период
+// опроса: файл, который еще дописывается, не разбирается раньше времени
+// (в Linux то же дает IN_CLOSE_WRITE)
+std::vector<std::string> FileWatcher::Wait(int timeoutMs) {
+    std::vector<std::string> changed;
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+    for (const auto& file : files) {
+        Stamp stamp = FileStamp(file);
+        if (stamp == stamps[file]) {
+            pending.erase(file);
+            continue;
+        }
+        auto last = pending.find(file);
+        if (last != pending.end() && last->second == stamp) {
+            stamps[file] = stamp;
+            pending.erase(last);
+            changed.push_back(file);
+        }
+        else {
+            pending[file] = stamp;
+        }
+    }
+    return changed;
+}
+
+#endif
+
+ModelReloader::ModelReloader() : running(false) {
+}
+
+ModelReloader::~ModelReloader() {
+    Stop();
+}
+
+void ModelReloader::SetLoaderOptions(const objl::LoaderOptions& options) {
+    loaderOptions = options;
+}
+
+void ModelReloader::Watch(const std::string& objPath, const std::vector<std::string>& mtlPaths) {
+    std::vector<std::string> paths = mtlPaths;
+    paths.push_back(objPath);
+    for (const auto& path : paths) {
+        auto& list = owners[path];
+        if (list.empty()) {
+            watcher.Watch(path);
+        }
+        if (std::find(list.begin(), list.end(), objPath) == list.end()) {
+            list.push_back(objPath);
+        }
+    }
+}
+
+void ModelReloader::Start() {
+    if (running) return;
+    running = true;
+    worker = std::thread(&ModelReloader::Run, this);
+}
+
+void ModelReloader::Stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool ModelReloader::TryPop(ReloadResult& result) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    if (ready.empty()) return false;
+    result = std::move(ready.front());
+    ready.erase(ready.begin());
+    return true;
+}
+
+void ModelReloader::Run() {
+    while (running) {
+        std::vector<std::string> changed = watcher.Wait(200);
+        if (changed.empty()) continue;
+
+        // Редакторы пишут файл несколькими операциями - ждем, пока запись утихнет
+        for (;;) {
+            std::vector<std::string> more = watcher.Wait(150);
+            if (more.empty() || !running) break;
+            changed.insert(changed.end(), more.begin(), more.end());
+        }
+
+        std::set<std::string> objs;
+        for (const auto& file : changed) {
+            auto it = owners.find(file);
+            if (it == owners.end()) continue;
+            objs.insert(it->second.begin(), it->second.end());
+        }
+
+        for (const auto& obj : objs) {
+            if (!running) break;
+            Reload(obj);
+        }
+    }
+}
+
+void ModelReloader::Reload(const std::string& objPath) {
+    std::cout << "Перезагрузка модели: " << objPath << std::endl;
+
+    // Файл может быть дописан не до конца (редактор еще сохраняет его) -
+    // тогда разбор бросает исключение. Текущая модель остается на экране,
+    // а повторная попытка будет при следующем изменении файла.
+    objl::Loader loader;
+    loader.Options = loaderOptions;
+    try {
+        if (!loader.LoadFile(objPath)) {
+            std::cout << "ОШИБКА: не удалось перезагрузить модель: " << objPath << std::endl;
+            return;
+        }
+        loader.SaveCache(objPath + ".cache", objPath);
+    }
+    catch (const std::exception& e) {
+        std::cout << "ОШИБКА: модель не перезагружена (" << e.what() << "): " << objPath << std::endl;
+        return;
+    }
+
+    ReloadResult result;
+    result.path = objPath;
+    result.meshes = std::move(loader.LoadedMeshes);
+
+    std::lock_guard<std::mutex> lock(queueMutex);
+    ready.push_back(std::move(result));
+}
@@ -0,0 +1,84 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "OBJ_Loader.h"
+
+// Слежение за изменением файлов на диске.
+// В Linux используется inotify (следим за каталогами, чтобы
+// ловить и перезапись, и замену файла через rename),
+// на остальных платформах - опрос размера и времени изменения файла.
+class FileWatcher {
+public:
+    // Размер и время изменения файла (см. Wait вне Linux)
+    struct Stamp {
+        long long size;
+        long long time;
+        bool operator==(const Stamp& other) const { return size == other.size && time == other.time; }
+    };
+
+    FileWatcher();
+    ~FileWatcher();
+
+    // Добавить файл в список отслеживаемых
+    void Watch(const std::string& path);
+
+    // Ждать изменений не дольше timeoutMs, вернуть изменившиеся файлы
+    std::vector<std::string> Wait(int timeoutMs);
+
+private:
+    std::vector<std::string> files;
+#ifdef __linux__
+    int fd;
+    std::map<int, std::string> dirs; // дескриптор inotify -> каталог
+#else
+    std::map<std::string, Stamp> stamps;  // файл -> отметка последнего сообщенного изменения
+    std::map<std::string, Stamp> pending; // файл -> новая отметка, ждущая следующего опроса
+#endif
+};
+
+// Результат повторной загрузки одного OBJ файла
+struct ReloadResult {
+    std::string path;
+    std::vector<objl::Mesh> meshes; // с Mesh::SourceHash (LoaderOptions::HashMeshes)
+};
+
+// Горячая перезагрузка моделей.
+// Рабочий поток ждет изменения .obj/.mtl, заново разбирает только
+// изменившийся OBJ и отдает результат основному потоку через очередь.
+// Основной поток забирает результаты между кадрами (TryPop).
+class ModelReloader {
+public:
+    ModelReloader();
+    ~ModelReloader();
+
+    // Параметры загрузчика для повторного разбора
+    void SetLoaderOptions(const objl::LoaderOptions& options);
+
+    // Следить за моделью и ее файлами материалов
+    void Watch(const std::string& objPath, const std::vector<std::string>& mtlPaths);
+
+    void Start();
+    void Stop();
+
+    // Неблокирующая выдача готового результата
+    bool TryPop(ReloadResult& result);
+
+private:
+    void Run();
+    void Reload(const std::string& objPath);
+
+    FileWatcher watcher;
+    objl::LoaderOptions loaderOptions;
+    std::map<std::string, std::vector<std::string>> owners; // файл -> OBJ, которые от него зависят
+    std::thread worker;
+    std::atomic<bool> running;
+    std::mutex queueMutex;
+    std::vector<ReloadResult> ready;
+};
@@ -0,0 +1,347 @@
+﻿#include "MipBuilder.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_SSE2
+#endif
+
+// AVX2 ядро собирается вместе с SSE2 с целевой платформой на уровне функции
+// и выбирается во время работы, если его поддерживают процессор и ОС
+// (как в stb_image.h) - сборке не нужны /arch:AVX2 или -mavx2
+#if defined(MIP_SSE2) && ((defined(_MSC_VER) && _MSC_VER >= 1900) || defined(__GNUC__))
+#include <immintrin.h>
+#define MIP_AVX2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MIP_AVX2_TARGET
+static bool Avx2Available() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // OSXSAVE и AVX, ОС сохраняет состояние YMM (биты 1-2 XCR0)
+    if ((info[2] & (3 << 27)) != (3 << 27)) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return ((info[1] >> 5) & 1) != 0;
+}
+#else
+#define MIP_AVX2_TARGET __attribute__((target("avx2")))
+static bool Avx2Available() {
+    return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+#endif
+
+static const float Pi = 3.14159265358979f;
+
+// Шагов линейной шкалы в обратной таблице: у нуля шаг sRGB (1/255)
+// соответствует ~0.0003 линейной яркости, 1/16384 его различает
+static const int LinearSteps = 16384;
+
+// Строк результата в одной полосе: промежуточные строки полосы
+// (после прохода по строкам) помещаются в кэш
+static const int BandRows = 32;
+
+// Меньшие уровни строятся в одном потоке - запуск потоков дороже работы
+static const int MinParallelPixels = 256 * 256;
+
+struct SrgbTables {
+    float toLinear[256];
+    unsigned char toSrgb[LinearSteps + 1];
+
+    SrgbTables() {
+        for (int i = 0; i < 256; i++) {
+            float s = i / 255.0f;
+            toLinear[i] = s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i <= LinearSteps; i++) {
+            float l = (float)i / LinearSteps;
+            float s = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = (unsigned char)std::min(255.0f, s * 255.0f + 0.5f);
+        }
+    }
+};
+
+static const SrgbTables& Tables() {
+    static SrgbTables tables;
+    return tables;
+}
+
+static float Sinc(float x) {
+    if (std::fabs(x) < 1e-5f) return 1.0f;
+    x *= Pi;
+    return std::sin(x) / x;
+}
+
+// Модифицированная функция Бесселя I0 (ряд), для окна Кайзера
+static float BesselI0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    float q = x * x / 4.0f;
+    for (int k = 1; k < 32 && term > sum * 1e-8f; k++) {
+        term *= q / (float)(k * k);
+        sum += term;
+    }
+    return sum;
+}
+
+// Радиус фильтра в пикселях результата
+static float FilterRadius(MipFilter filter) {
+    if (filter == MipFilter::Box) return 0.5f;
+    if (filter == MipFilter::Mitchell) return 2.0f;
+    return 3.0f;
+}
+
+static float FilterWeight(MipFilter filter, float d) {
+    const float radius = FilterRadius(filter);
+    d = std::fabs(d);
+    if (d >= radius) return 0.0f;
+
+    switch (filter) {
+    case MipFilter::Box:
+        return 1.0f;
+    case MipFilter::Kaiser: {
+        const float alpha = 4.0f;
+        float t = d / radius;
+        return Sinc(d) * BesselI0(alpha * std::sqrt(1.0f - t * t)) / BesselI0(alpha);
+    }
+    case MipFilter::Lanczos:
+        return Sinc(d) * Sinc(d / radius);
+    case MipFilter::Mitchell:
+        // B = C = 1/3
+        if (d < 1.0f) return (7.0f * d * d * d - 12.0f * d * d + 16.0f / 3.0f) / 6.0f;
+        return (-7.0f / 3.0f * d * d * d + 12.0f * d * d - 20.0f * d + 32.0f / 3.0f) / 6.0f;
+    }
+    return 0.0f;
+}
+
+// Веса одного прохода: для каждого пикселя результата count отсчетов источника
+struct Taps {
+    int count;
+    std::vector<int> index;
+    std::vector<float> weight;
+};
+
+static Taps MakeTaps(int srcSize, int dstSize, MipFilter filter) {
+    Taps taps;
+    float scale = (float)srcSize / dstSize;
+    float support = FilterRadius(filter) * scale;
+    taps.count = (int)std::ceil(support * 2.0f) + 1;
+    taps.index.resize((size_t)dstSize * taps.count);
+    taps.weight.resize((size_t)dstSize * taps.count);
+
+    for (int i = 0; i < dstSize; i++) {
+        float center = (i + 0.5f) * scale;
+        int first = (int)std::floor(center - support);
+        int* index = &taps.index[(size_t)i * taps.count];
+        float* weight = &taps.weight[(size_t)i * taps.count];
+
+        float sum = 0.0f;
+        for (int k = 0; k < taps.count; k++) {
+            int s = first + k;
+            weight[k] = FilterWeight(filter, (s + 0.5f - center) / scale);
+            index[k] = ((s % srcSize) + srcSize) % srcSize;
+            sum += weight[k];
+        }
+        if (sum != 0.0f) {
+            for (int k = 0; k < taps.count; k++) {
+                weight[k] /= sum;
+            }
+        }
+    }
+    return taps;
+}
+
+// Компонента хранит цвет (а не альфу)
+static bool IsColor(int c, int components) {
+    if (components == 2) return c == 0;
+    if (components == 4) return c < 3;
+    return true;
+}
+
+// out[i] += in[i] * w
+typedef void (*AccumulateFn)(float* out, const float* in, float w, int n);
+
+static void Accumulate(float* out, const float* in, float w, int n) {
+    int i = 0;
+#if defined(MIP_SSE2)
+    __m128 w4 = _mm_set1_ps(w);
+    for (; i + 4 <= n; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), w4));
+        _mm_storeu_ps(out + i, sum);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] += in[i] * w;
+    }
+}
+
+#ifdef MIP_AVX2
+MIP_AVX2_TARGET
+static void AccumulateAvx2(float* out, const float* in, float w, int n) {
+    int i = 0;
+    __m256 w8 = _mm256_set1_ps(w);
+    for (; i + 8 <= n; i += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(_mm256_loadu_ps(in + i), w8));
+        _mm256_storeu_ps(out + i, sum);
+    }
+    for (; i < n; i++) {
+        out[i] += in[i] * w;
+    }
+}
+#endif
+
+static AccumulateFn ChooseAccumulate() {
+#ifdef MIP_AVX2
+    if (Avx2Available()) return AccumulateAvx2;
+#endif
+    return Accumulate;
+}
+
+struct MipJob {
+    const unsigned char* src;
+    int srcW, srcH;
+    unsigned char* dst;
+    int dstW, dstH, components;
+    bool srgb;
+    Taps horizontal, vertical;
+    AccumulateFn accumulate;
+};
+
+// Проход по строке источника: перевод в линейное пространство и уменьшение по x
+static void FilterRow(const MipJob& job, int y, float* linear, float* out) {
+    const SrgbTables& tables = Tables();
+    const int c = job.components;
+    const unsigned char* row = job.src + (size_t)y * job.srcW * c;
+
+    for (int x = 0; x < job.srcW * c; x++) {
+        int ch = x % c;
+        linear[x] = job.srgb && IsColor(ch, c) ? tables.toLinear[row[x]] : row[x] / 255.0f;
+    }
+
+    const Taps& taps = job.horizontal;
+#if defined(MIP_SSE2)
+    // RGB/RGBA: все компоненты пикселя в одном регистре (linear дополнен
+    // до 4 float в конце, лишняя компонента у RGB отбрасывается)
+    if (c >= 3) {
+        float lanes[4];
+        for (int x = 0; x < job.dstW; x++) {
+            const int* index = &taps.index[(size_t)x * taps.count];
+            const float* weight = &taps.weight[(size_t)x * taps.count];
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps.count; k++) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(linear + index[k] * c), _mm_set1_ps(weight[k])));
+            }
+            _mm_storeu_ps(lanes, sum);
+            for (int ch = 0; ch < c; ch++) {
+                out[x * c + ch] = lanes[ch];
+            }
+        }
+        return;
+    }
+#endif
+    for (int x = 0; x < job.dstW; x++) {
+        const int* index = &taps.index[(size_t)x * taps.count];
+        const float* weight = &taps.weight[(size_t)x * taps.count];
+        for (int ch = 0; ch < c; ch++) {
+            float sum = 0.0f;
+            for (int k = 0; k < taps.count; k++) {
+                sum += linear[index[k] * c + ch] * weight[k];
+            }
+            out[x * c + ch] = sum;
+        }
+    }
+}
+
+// Строки результата [y0, y1), полосами по BandRows
+static void BuildRows(const MipJob& job, int y0, int y1) {
+    const SrgbTables& tables = Tables();
+    const int c = job.components;
+    const int rowFloats = job.dstW * c;
+    const Taps& taps = job.vertical;
+
+    std::vector<float> linear((size_t)job.srcW * c + 4);
+    std::vector<float> accum(rowFloats);
+    std::vector<int> slotOf(job.srcH, -1);
+    std::vector<int> cachedRows;
+    std::vector<float> cache;
+
+    for (int band = y0; band < y1; band += BandRows) {
+        int bandEnd = std::min(y1, band + BandRows);
+
+        // Строки источника, нужные полосе, проходятся по x один раз
+        for (int row : cachedRows) slotOf[row] = -1;
+        cachedRows.clear();
+        for (int y = band; y < bandEnd; y++) {
+            for (int k = 0; k < taps.count; k++) {
+                int row = taps.index[(size_t)y * taps.count + k];
+                if (slotOf[row] < 0) {
+                    slotOf[row] = (int)cachedRows.size();
+                    cachedRows.push_back(row);
+                }
+            }
+        }
+        cache.resize(cachedRows.size() * rowFloats);
+        for (size_t i = 0; i < cachedRows.size(); i++) {
+            FilterRow(job, cachedRows[i], linear.data(), &cache[i * rowFloats]);
+        }
+
+        for (int y = band; y < bandEnd; y++) {
+            std::fill(accum.begin(), accum.end(), 0.0f);
+            for (int k = 0; k < taps.count; k++) {
+                float w = taps.weight[(size_t)y * taps.count + k];
+                if (w == 0.0f) continue;
+                int row = taps.index[(size_t)y * taps.count + k];
+                job.accumulate(accum.data(), &cache[(size_t)slotOf[row] * rowFloats], w, rowFloats);
+            }
+
+            // Обратно в 8 бит; отрицательные лепестки Kaiser/Lanczos/Mitchell обрезаются
+            unsigned char* out = job.dst + (size_t)y * rowFloats;
+            for (int i = 0; i < rowFloats; i++) {
+                float v = std::min(1.0f, std::max(0.0f, accum[i]));
+                out[i] = job.srgb && IsColor(i % c, c)
+                    ? tables.toSrgb[(int)(v * LinearSteps + 0.5f)]
+                    : (unsigned char)(v * 255.0f + 0.5f);
+            }
+        }
+    }
+}
+
+void BuildMipLevel(const unsigned char* src, int srcW, int srcH,
+    unsigned char* dst, int dstW, int dstH, int components, const MipSettings& settings) {
+    MipJob job;
+    job.src = src;
+    job.srcW = srcW;
+    job.srcH = srcH;
+    job.dst = dst;
+    job.dstW = dstW;
+    job.dstH = dstH;
+    job.components = components;
+    job.srgb = settings.srgb;
+    job.horizontal = MakeTaps(srcW, dstW, settings.filter);
+    job.vertical = MakeTaps(srcH, dstH, settings.filter);
+    static const AccumulateFn accumulate = ChooseAccumulate();
+    job.accumulate = accumulate;
+
+    int threads = settings.threads > 0 ? settings.threads : (int)std::thread::hardware_concurrency();
+    if (threads < 1 || dstW * dstH < MinParallelPixels) threads = 1;
+    threads = std::min(threads, (dstH + BandRows - 1) / BandRows);
+
+    if (threads <= 1) {
+        BuildRows(job, 0, dstH);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; t++) {
+        int y0 = dstH * t / threads;
+        int y1 = dstH * (t + 1) / threads;
+        pool.emplace_back([&job, y0, y1] { BuildRows(job, y0, y1); });
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+#include <cstdint>
+
+// Фильтр уменьшения при построении мип-уровней
+enum class MipFilter : uint32_t {
+    Box,     // среднее по квадрату, как glGenerateMipmap
+    Kaiser,  // sinc с окном Кайзера, радиус 3 - резче box без заметного звона
+    Lanczos, // Lanczos3 - самый резкий, возможен небольшой звон на контрастных краях
+    Mitchell // кубический Митчелла-Нетравали (B = C = 1/3), радиус 2 - мягче, без звона
+};
+
+struct MipSettings {
+    MipFilter filter = MipFilter::Kaiser;
+    // Цветовые каналы хранятся в sRGB: фильтрация идет в линейном пространстве.
+    // Альфа (4-я компонента) всегда линейная.
+    bool srgb = true;
+    // Потоков на один уровень, 0 - по числу ядер (мелкие уровни всегда в одном потоке).
+    // Из рабочих потоков пула, которые и так заняты каждый своей текстурой,
+    // передается 1 - иначе каждый запускает еще по потоку на ядро
+    int threads = 0;
+};
+
+// Уменьшение изображения src (srcW x srcH) до dst (dstW x dstH) с любым
+// коэффициентом, 8 бит на компоненту. Им же уменьшаются слишком большие
+// исходные изображения при загрузке (CookSettings::maxSize).
+// Фильтр раздельный: проход по строкам (SSE), затем по столбцам (SSE или AVX2,
+// выбирается по процессору во время работы).
+// Края заворачиваются, так как текстуры сэмплируются с GL_REPEAT.
+void BuildMipLevel(const unsigned char* src, int srcW, int srcH,
+    unsigned char* dst, int dstW, int dstH, int components, const MipSettings& settings);
@@ -1,4 +1,4 @@
-// OBJ_Loader.h - A Single Header OBJ Model Loader
+﻿// OBJ_Loader.h - A Single Header OBJ Model Loader
 
 #pragma once
 
@@ -17,9 +17,67 @@
 // Math.h - STD math Library
 #include <math.h>
 
+// Cstdint - Fixed Width Integer Types
+#include <cstdint>
+
+// Cstring - memcpy
+#include <cstring>
+
+// Stdexcept - Errors for malformed records
+#include <stdexcept>
+
+// Chrono - Timing for cache statistics
+#include <chrono>
+
+// Stat - Source file size and modification time
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Algorithm - std::sort for the spatial sort
+#include <algorithm>
+
+// Unordered Map / Set - Instance detection, material and mesh name lookups
+#include <unordered_map>
+#include <unordered_set>
+
+// New - Allocation tracking hooks
+#include <new>
+
+// Cstdlib - malloc / free for the allocation tracking hooks, strtol
+#include <cstdlib>
+
+// Climits - Range check of parsed integers
+#include <climits>
+
+// Functional - LoaderOptions::ResolveFile
+#include <functional>
+
+// Type Traits - Compile time checks of the move-only mesh path
+#include <type_traits>
+
 // Print progress to console while loading (large models)
 #define OBJL_CONSOLE_OUTPUT
 
+// Collect per-phase timing and record counts in Loader::Stats
+#define OBJL_INSTRUMENTATION
+
+// Allocation counts and peak memory are collected when exactly one
+// translation unit defines OBJL_ALLOC_TRACKING_IMPLEMENTATION before
+// including this file (opt in, meant for profiling builds). That
+// replaces the global operator new/delete for the whole program, not
+// just the loader: every allocation of every library linked in goes
+// through malloc/free (the aligned forms too, when the compiler has
+// C++17 aligned new). Only allocations made by the thread running a
+// load, while the load runs, are counted, the rest of the program
+// pays one thread_local check per call.
+
+// Deep copies of Mesh are counted (Mesh::Copies, LoadStats::MeshCopies)
+// when OBJL_COUNT_MESH_COPIES is defined for the whole project (it
+// changes the layout of Mesh, so every translation unit must agree).
+// The Debug configurations define it, so the viewer checks on every
+// model load that the load path only moves meshes; without it Mesh
+// carries no counter and Copies() is always 0.
+
 // Namespace: OBJL
 //
 // Description: The namespace that holds eveyrthing that
@@ -155,6 +213,7 @@ namespace objl
 			Ni = 0.0f;
 			d = 0.0f;
 			illum = 0;
+			map_max_size = 0;
 		}
 
 		// Material Name
@@ -185,7 +244,31 @@ namespace objl
 		std::string map_d;
 		// Bump Map
 		std::string map_bump;
+		// Texture Size Limit in pixels (map_max_size, 0 if not set)
+		int map_max_size;
+	};
+
+#ifdef OBJL_COUNT_MESH_COPIES
+	// Structure: CopyCount
+	//
+	// Description: Counts deep copies of the object that holds it
+	//	made on the current thread; moves are not counted.
+	//	Mesh carries one, see Mesh::Copies
+	struct CopyCount
+	{
+		CopyCount() noexcept {}
+		CopyCount(const CopyCount&) noexcept { Total()++; }
+		CopyCount(CopyCount&&) noexcept {}
+		CopyCount& operator=(const CopyCount&) noexcept { Total()++; return *this; }
+		CopyCount& operator=(CopyCount&&) noexcept { return *this; }
+
+		static uint64_t& Total()
+		{
+			static thread_local uint64_t total = 0;
+			return total;
+		}
 	};
+#endif
 
 	// Structure: Mesh
 	//
@@ -196,13 +279,20 @@ namespace objl
 		// Default Constructor
 		Mesh()
 		{
-
+			GeometryHash = SourceHash = 0;
+			InPool = false;
+			VertexOffset = VertexCount = IndexOffset = IndexCount = 0;
 		}
 		// Variable Set Constructor
-		Mesh(std::vector<Vertex>& _Vertices, std::vector<unsigned int>& _Indices)
+		//
+		// Takes ownership of the arrays, the caller hands
+		// them over with std::move so nothing is copied
+		Mesh(std::vector<Vertex>&& _Vertices, std::vector<unsigned int>&& _Indices)
+			: Vertices(std::move(_Vertices)), Indices(std::move(_Indices))
 		{
-			Vertices = _Vertices;
-			Indices = _Indices;
+			GeometryHash = SourceHash = 0;
+			InPool = false;
+			VertexOffset = VertexCount = IndexOffset = IndexCount = 0;
 		}
 		// Mesh Name
 		std::string MeshName;
@@ -213,6 +303,87 @@ namespace objl
 
 		// Material
 		Material MeshMaterial;
+
+		// Instance Offsets
+		//
+		// Filled by instance detection (LoaderOptions::DetectInstances):
+		//	the vertices are then relative to the geometry centre and the
+		//	mesh is drawn once at each of these model space offsets.
+		//	Empty if detection is off, the vertices are in place.
+		std::vector<Vector3> InstanceOffsets;
+		// Names of the meshes folded into this one, parallel to
+		//	InstanceOffsets; the first is MeshName. Loader::FindMesh
+		//	looks them up.
+		std::vector<std::string> InstanceNames;
+		// Hash of the centred geometry (algorithm::HashGeometry),
+		//	equal for translated copies. 0 if not computed.
+		uint64_t GeometryHash;
+		// Hash of the mesh as parsed from the .obj (algorithm::HashMesh,
+		//	LoaderOptions::HashMeshes). The mesh cache keeps it, so a mesh
+		//	read back from the quantized cache has the same SourceHash as
+		//	when parsed again. 0 if not computed.
+		uint64_t SourceHash;
+
+		// Pool View
+		//
+		// With LoaderOptions::PooledMeshes the vertices and indices live
+		//	in Loader::Pool and Vertices / Indices stay empty. The mesh
+		//	is the range [VertexOffset, +VertexCount) of the vertex pool
+		//	and [IndexOffset, +IndexCount) of the index pool; the indices
+		//	are relative to VertexOffset (a base vertex draw).
+		bool InPool;
+		unsigned int VertexOffset;
+		unsigned int VertexCount;
+		unsigned int IndexOffset;
+		unsigned int IndexCount;
+
+		// Copies of any Mesh made so far on this thread, 0 without
+		//	OBJL_COUNT_MESH_COPIES. The parser, LoadedMeshes and the
+		//	hand-off to the caller only move meshes, so this does not
+		//	change during a load (LoadStats::MeshCopies)
+		static uint64_t Copies()
+		{
+#ifdef OBJL_COUNT_MESH_COPIES
+			return CopyCount::Total();
+#else
+			return 0;
+#endif
+		}
+
+#ifdef OBJL_COUNT_MESH_COPIES
+	private:
+		CopyCount Counter;
+#endif
+	};
+
+	// Meshes go from the parser to LoadedMeshes and on to the caller by
+	//	move. These fail to compile if a change would turn one of those
+	//	steps back into a copy: std::vector only moves its elements on
+	//	growth when the move constructor is noexcept, and the array
+	//	constructor must not accept lvalues. Copies that still happen
+	//	at run time are counted in Mesh::Copies.
+	static_assert(std::is_nothrow_move_constructible<Mesh>::value &&
+		std::is_nothrow_move_assignable<Mesh>::value,
+		"objl::Mesh must be nothrow movable, or std::vector<Mesh> copies on growth");
+	static_assert(!std::is_constructible<Mesh, std::vector<Vertex>&, std::vector<unsigned int>&>::value,
+		"objl::Mesh must take its arrays by rvalue");
+	static_assert(std::is_trivially_copyable<Vertex>::value,
+		"objl::Vertex is uploaded and cached as raw bytes");
+
+	// Structure: MeshPool
+	//
+	// Description: Vertices and indices of all meshes of a model
+	//	in two contiguous arrays, see Mesh::InPool
+	struct MeshPool
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<unsigned int> Indices;
+
+		void Clear()
+		{
+			Vertices.clear();
+			Indices.clear();
+		}
 	};
 
 	// Namespace: Math
@@ -222,7 +393,7 @@ namespace objl
 	namespace math
 	{
 		// Vector3 Cross Product
-		Vector3 CrossV3(const Vector3 a, const Vector3 b)
+		inline Vector3 CrossV3(const Vector3 a, const Vector3 b)
 		{
 			return Vector3(a.Y * b.Z - a.Z * b.Y,
 				a.Z * b.X - a.X * b.Z,
@@ -230,19 +401,19 @@ namespace objl
 		}
 
 		// Vector3 Magnitude Calculation
-		float MagnitudeV3(const Vector3 in)
+		inline float MagnitudeV3(const Vector3 in)
 		{
 			return (sqrtf(powf(in.X, 2) + powf(in.Y, 2) + powf(in.Z, 2)));
 		}
 
 		// Vector3 DotProduct
-		float DotV3(const Vector3 a, const Vector3 b)
+		inline float DotV3(const Vector3 a, const Vector3 b)
 		{
 			return (a.X * b.X) + (a.Y * b.Y) + (a.Z * b.Z);
 		}
 
 		// Angle between 2 Vector3 Objects
-		float AngleBetweenV3(const Vector3 a, const Vector3 b)
+		inline float AngleBetweenV3(const Vector3 a, const Vector3 b)
 		{
 			float angle = DotV3(a, b);
 			angle /= (MagnitudeV3(a) * MagnitudeV3(b));
@@ -250,7 +421,7 @@ namespace objl
 		}
 
 		// Projection Calculation of a onto b
-		Vector3 ProjV3(const Vector3 a, const Vector3 b)
+		inline Vector3 ProjV3(const Vector3 a, const Vector3 b)
 		{
 			Vector3 bn = b / MagnitudeV3(b);
 			return bn * DotV3(a, bn);
@@ -264,13 +435,13 @@ namespace objl
 	namespace algorithm
 	{
 		// Vector3 Multiplication Opertor Overload
-		Vector3 operator*(const float& left, const Vector3& right)
+		inline Vector3 operator*(const float& left, const Vector3& right)
 		{
 			return Vector3(right.X * left, right.Y * left, right.Z * left);
 		}
 
 		// A test to see if P1 is on the same side as P2 of a line segment ab
-		bool SameSide(Vector3 p1, Vector3 p2, Vector3 a, Vector3 b)
+		inline bool SameSide(Vector3 p1, Vector3 p2, Vector3 a, Vector3 b)
 		{
 			Vector3 cp1 = math::CrossV3(b - a, p1 - a);
 			Vector3 cp2 = math::CrossV3(b - a, p2 - a);
@@ -282,7 +453,7 @@ namespace objl
 		}
 
 		// Generate a cross produect normal for a triangle
-		Vector3 GenTriNormal(Vector3 t1, Vector3 t2, Vector3 t3)
+		inline Vector3 GenTriNormal(Vector3 t1, Vector3 t2, Vector3 t3)
 		{
 			Vector3 u = t2 - t1;
 			Vector3 v = t3 - t1;
@@ -293,7 +464,7 @@ namespace objl
 		}
 
 		// Check to see if a Vector3 Point is within a 3 Vector3 Triangle
-		bool inTriangle(Vector3 point, Vector3 tri1, Vector3 tri2, Vector3 tri3)
+		inline bool inTriangle(Vector3 point, Vector3 tri1, Vector3 tri2, Vector3 tri3)
 		{
 			// Test to see if it is within an infinite prism that the triangle outlines.
 			bool within_tri_prisim = SameSide(point, tri1, tri2, tri3) && SameSide(point, tri2, tri1, tri3)
@@ -356,6 +527,15 @@ namespace objl
 			}
 		}
 
+		// Check that a split record has at least count values.
+		//	A short record (e.g. a file cut off mid-write) is reported
+		//	the same way std::stof reports a malformed value
+		inline void requireValues(const std::vector<std::string> &values, size_t count, const char *record)
+		{
+			if (values.size() < count)
+				throw std::invalid_argument(std::string("too few values in ") + record + " record");
+		}
+
 		// Get tail of string after first token and possibly following spaces
 		inline std::string tail(const std::string &in)
 		{
@@ -393,6 +573,36 @@ namespace objl
 			return "";
 		}
 
+		// Class: MeshNamer
+		//
+		// Description: Unique mesh names in file order: the group name
+		//	while it is free, else the first free name_N. A usemtl split
+		//	always takes a suffix; a group name reopened later in the
+		//	file gets one too. LoadFile names its meshes with it and
+		//	BuildIndex its spans, so LoadGroup gives a group the same
+		//	mesh names as LoadFile. The suffix to try next is kept per
+		//	group, so naming stays O(1) per mesh.
+		class MeshNamer
+		{
+		public:
+			std::string Next(const std::string& group, bool split)
+			{
+				if (!split && names.insert(group).second)
+					return group;
+				unsigned int& i = nextSuffix.emplace(group, 2u).first->second;
+				std::string name;
+				do {
+					name = group + "_" + std::to_string(i++);
+				} while (names.count(name));
+				names.insert(name);
+				return name;
+			}
+
+		private:
+			std::unordered_set<std::string> names;
+			std::unordered_map<std::string, unsigned int> nextSuffix;
+		};
+
 		// Get element at given index position
 		template <class T>
 		inline const T & getElement(const std::vector<T> &elements, std::string &index)
@@ -402,326 +612,2907 @@ namespace objl
 				idx = int(elements.size()) + idx;
 			else
 				idx--;
+			if (idx < 0 || idx >= int(elements.size()))
+				throw std::out_of_range("face index out of range: " + index);
 			return elements[idx];
 		}
-	}
 
-	// Class: Loader
-	//
-	// Description: The OBJ Model Loader
-	class Loader
-	{
-	public:
-		// Default Constructor
-		Loader()
+		// FNV-1a hash of a byte range, chained through h
+		inline uint64_t HashBytes(const void* data, size_t size, uint64_t h = 14695981039346656037ull)
 		{
+			const unsigned char* p = (const unsigned char*)data;
+			for (size_t i = 0; i < size; i++)
+			{
+				h ^= p[i];
+				h *= 1099511628211ull;
+			}
+			return h;
+		}
 
+		// Content hash of a mesh: name, material and geometry.
+		//	Two meshes with the same hash can share GPU buffers
+		//	and material state. The vertices and indices are passed
+		//	separately so that a view into a MeshPool can be hashed
+		inline uint64_t HashMesh(const Mesh& mesh, const Vertex* vertices, size_t vertexCount,
+			const unsigned int* indices, size_t indexCount)
+		{
+			uint64_t h = HashBytes(mesh.MeshName.data(), mesh.MeshName.size());
+
+			const Material& m = mesh.MeshMaterial;
+			h = HashBytes(m.name.data(), m.name.size(), h);
+			h = HashBytes(&m.Ka, sizeof(m.Ka), h);
+			h = HashBytes(&m.Kd, sizeof(m.Kd), h);
+			h = HashBytes(&m.Ks, sizeof(m.Ks), h);
+			h = HashBytes(&m.Ns, sizeof(m.Ns), h);
+			h = HashBytes(m.map_Kd.data(), m.map_Kd.size(), h);
+			h = HashBytes(m.map_bump.data(), m.map_bump.size(), h);
+			h = HashBytes(&m.map_max_size, sizeof(m.map_max_size), h);
+
+			h = HashBytes(vertices, vertexCount * sizeof(Vertex), h);
+			h = HashBytes(indices, indexCount * sizeof(unsigned int), h);
+			h = HashBytes(mesh.InstanceOffsets.data(), mesh.InstanceOffsets.size() * sizeof(Vector3), h);
+			for (const std::string& name : mesh.InstanceNames)
+				h = HashBytes(name.data(), name.size() + 1, h);
+			return h;
 		}
-		~Loader()
+
+		inline uint64_t HashMesh(const Mesh& mesh)
 		{
-			LoadedMeshes.clear();
+			return HashMesh(mesh, mesh.Vertices.data(), mesh.Vertices.size(),
+				mesh.Indices.data(), mesh.Indices.size());
 		}
 
-		// Load a file into the loader
-		//
-		// If file is loaded return true
+		// Axis aligned bounding box of the vertex positions of a mesh
+		inline void MeshBounds(const Mesh& mesh, Vector3& bmin, Vector3& bmax)
+		{
+			bmin = bmax = Vector3();
+			if (mesh.Vertices.empty())
+				return;
+			bmin = bmax = mesh.Vertices[0].Position;
+			for (const Vertex& v : mesh.Vertices)
+			{
+				bmin = Vector3(fminf(bmin.X, v.Position.X), fminf(bmin.Y, v.Position.Y), fminf(bmin.Z, v.Position.Z));
+				bmax = Vector3(fmaxf(bmax.X, v.Position.X), fmaxf(bmax.Y, v.Position.Y), fmaxf(bmax.Z, v.Position.Z));
+			}
+		}
+
+		// Structure: CleanupResult
 		//
-		// If the file is unable to be found
-		// or unable to be loaded return false
-		bool LoadFile(std::string Path)
+		// Description: What algorithm::CleanMesh removed
+		struct CleanupResult
 		{
-			// If the file is not an .obj file return false
-			if (Path.substr(Path.size() - 4, 4) != ".obj")
-				return false;
+			CleanupResult()
+			{
+				DegenerateTriangles = 0;
+				DuplicateTriangles = 0;
+				UnusedVertices = 0;
+			}
 
+			size_t DegenerateTriangles;
+			size_t DuplicateTriangles;
+			size_t UnusedVertices;
+		};
+
+		// Remove zero-area and duplicate triangles from a mesh, then drop
+		//	the vertices no index refers to. A triangle is degenerate when
+		//	two corners are the same vertex or its area is at most
+		//	areaEpsilon times the squared diagonal of the mesh bounds.
+		//	Duplicates are compared by vertex contents, since the loader
+		//	gives every face corner its own vertex; a rotated corner order
+		//	counts as the same triangle, the reversed winding does not.
+		//	The order of the remaining triangles and vertices is kept.
+		inline CleanupResult CleanMesh(Mesh& mesh, float areaEpsilon)
+		{
+			CleanupResult result;
+			const size_t tris = mesh.Indices.size() / 3;
 
-			std::ifstream file(Path);
+			Vector3 bmin, bmax;
+			MeshBounds(mesh, bmin, bmax);
+			Vector3 diagonal = bmax - bmin;
+			const float minArea2 = 2.0f * areaEpsilon * math::DotV3(diagonal, diagonal);
 
-			if (!file.is_open())
-				return false;
+			// Canonical id of every vertex: the first vertex with the same bytes
+			std::vector<unsigned int> canon(mesh.Vertices.size());
+			{
+				std::unordered_map<uint64_t, std::vector<unsigned int>> byHash;
+				byHash.reserve(mesh.Vertices.size());
+				for (unsigned int v = 0; v < (unsigned int)mesh.Vertices.size(); v++)
+				{
+					const Vertex& vert = mesh.Vertices[v];
+					std::vector<unsigned int>& same = byHash[HashBytes(&vert, sizeof(Vertex))];
+					canon[v] = v;
+					for (unsigned int o : same)
+					{
+						if (memcmp(&mesh.Vertices[o], &vert, sizeof(Vertex)) == 0)
+						{
+							canon[v] = o;
+							break;
+						}
+					}
+					if (canon[v] == v)
+						same.push_back(v);
+				}
+			}
 
-			LoadedMeshes.clear();
-			LoadedVertices.clear();
-			LoadedIndices.clear();
+			std::unordered_map<uint64_t, std::vector<size_t>> seen;
+			seen.reserve(tris);
+			std::vector<unsigned int> indices;
+			indices.reserve(mesh.Indices.size());
+			for (size_t t = 0; t < tris; t++)
+			{
+				const unsigned int* tri = &mesh.Indices[t * 3];
+				unsigned int c[3] = { canon[tri[0]], canon[tri[1]], canon[tri[2]] };
+				if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+				{
+					result.DegenerateTriangles++;
+					continue;
+				}
 
-			std::vector<Vector3> Positions;
-			std::vector<Vector2> TCoords;
-			std::vector<Vector3> Normals;
+				const Vector3& a = mesh.Vertices[tri[0]].Position;
+				Vector3 n = math::CrossV3(mesh.Vertices[tri[1]].Position - a, mesh.Vertices[tri[2]].Position - a);
+				if (math::MagnitudeV3(n) <= minArea2)
+				{
+					result.DegenerateTriangles++;
+					continue;
+				}
 
-			std::vector<Vertex> Vertices;
-			std::vector<unsigned int> Indices;
+				// Rotate so the smallest id comes first, keeping the winding
+				int r = (c[1] < c[0] && c[1] < c[2]) ? 1 : (c[2] < c[0] && c[2] < c[1]) ? 2 : 0;
+				unsigned int key[3] = { c[r], c[(r + 1) % 3], c[(r + 2) % 3] };
 
-			std::vector<std::string> MeshMatNames;
+				bool duplicate = false;
+				std::vector<size_t>& same = seen[HashBytes(key, sizeof(key))];
+				for (size_t o : same)
+				{
+					const unsigned int* other = &indices[o];
+					unsigned int oc[3] = { canon[other[0]], canon[other[1]], canon[other[2]] };
+					int orot = (oc[1] < oc[0] && oc[1] < oc[2]) ? 1 : (oc[2] < oc[0] && oc[2] < oc[1]) ? 2 : 0;
+					if (oc[orot] == key[0] && oc[(orot + 1) % 3] == key[1] && oc[(orot + 2) % 3] == key[2])
+					{
+						duplicate = true;
+						break;
+					}
+				}
+				if (duplicate)
+				{
+					result.DuplicateTriangles++;
+					continue;
+				}
 
-			bool listening = false;
-			std::string meshname;
+				same.push_back(indices.size());
+				indices.insert(indices.end(), tri, tri + 3);
+			}
 
-			Mesh tempMesh;
+			// Compact the vertices that are still referenced
+			const unsigned int unused = 0xFFFFFFFFu;
+			std::vector<unsigned int> remap(mesh.Vertices.size(), unused);
+			for (unsigned int i : indices)
+				remap[i] = 0;
+			std::vector<Vertex> vertices;
+			vertices.reserve(mesh.Vertices.size());
+			for (size_t v = 0; v < mesh.Vertices.size(); v++)
+			{
+				if (remap[v] == unused)
+					continue;
+				remap[v] = (unsigned int)vertices.size();
+				vertices.push_back(mesh.Vertices[v]);
+			}
+			for (unsigned int& i : indices)
+				i = remap[i];
 
-			#ifdef OBJL_CONSOLE_OUTPUT
-			const unsigned int outputEveryNth = 1000;
-			unsigned int outputIndicator = outputEveryNth;
-			#endif
+			result.UnusedVertices = mesh.Vertices.size() - vertices.size();
+			mesh.Vertices.swap(vertices);
+			mesh.Indices.swap(indices);
+			return result;
+		}
 
-			std::string curline;
-			while (std::getline(file, curline))
+		// Spread the low 10 bits of v so that there are two zero bits between each
+		inline uint32_t ExpandBits10(uint32_t v)
+		{
+			v &= 0x3FF;
+			v = (v | (v << 16)) & 0x030000FF;
+			v = (v | (v << 8)) & 0x0300F00F;
+			v = (v | (v << 4)) & 0x030C30C3;
+			v = (v | (v << 2)) & 0x09249249;
+			return v;
+		}
+
+		// 30 bit Morton code of a point quantized to 10 bits per axis
+		inline uint32_t Morton3D(uint32_t x, uint32_t y, uint32_t z)
+		{
+			return (ExpandBits10(x) << 2) | (ExpandBits10(y) << 1) | ExpandBits10(z);
+		}
+
+		// Centroid of triangle number tri
+		inline Vector3 TriangleCentroid(const Mesh& mesh, size_t tri)
+		{
+			const Vector3& a = mesh.Vertices[mesh.Indices[tri * 3 + 0]].Position;
+			const Vector3& b = mesh.Vertices[mesh.Indices[tri * 3 + 1]].Position;
+			const Vector3& c = mesh.Vertices[mesh.Indices[tri * 3 + 2]].Position;
+			return (a + b + c) / 3.0f;
+		}
+
+		// Spatial locality of the triangle order: mean distance between
+		//	the centroids of consecutive triangles divided by the diagonal
+		//	of the mesh bounds. Lower is better, a random order of a
+		//	uniformly filled box is around 0.38.
+		inline double TriangleLocality(const Mesh& mesh)
+		{
+			const size_t tris = mesh.Indices.size() / 3;
+			if (tris < 2)
+				return 0.0;
+
+			Vector3 bmin, bmax;
+			MeshBounds(mesh, bmin, bmax);
+			double diagonal = math::MagnitudeV3(bmax - bmin);
+			if (diagonal <= 0.0)
+				return 0.0;
+
+			double sum = 0.0;
+			Vector3 prev = TriangleCentroid(mesh, 0);
+			for (size_t t = 1; t < tris; t++)
 			{
-				#ifdef OBJL_CONSOLE_OUTPUT
-				if ((outputIndicator = ((outputIndicator + 1) % outputEveryNth)) == 1)
+				Vector3 cur = TriangleCentroid(mesh, t);
+				sum += math::MagnitudeV3(cur - prev);
+				prev = cur;
+			}
+			return sum / double(tris - 1) / diagonal;
+		}
+
+		// Reorder the triangles of a mesh along a Z-order curve through
+		//	their centroids, quantized within the mesh bounds. Vertices are
+		//	then renumbered in order of first use so that the vertex buffer
+		//	follows the same curve; unreferenced vertices go to the end.
+		inline void MortonSortTriangles(Mesh& mesh)
+		{
+			const size_t tris = mesh.Indices.size() / 3;
+			if (tris < 2)
+				return;
+
+			Vector3 bmin, bmax;
+			MeshBounds(mesh, bmin, bmax);
+			Vector3 extent = bmax - bmin;
+			const float scale = 1023.0f;
+			Vector3 inv(extent.X > 0.0f ? scale / extent.X : 0.0f,
+				extent.Y > 0.0f ? scale / extent.Y : 0.0f,
+				extent.Z > 0.0f ? scale / extent.Z : 0.0f);
+
+			// (code << 32 | triangle) sorts by code, ties keep the file order
+			std::vector<uint64_t> keys(tris);
+			for (size_t t = 0; t < tris; t++)
+			{
+				Vector3 c = TriangleCentroid(mesh, t) - bmin;
+				uint32_t code = Morton3D(uint32_t(c.X * inv.X + 0.5f), uint32_t(c.Y * inv.Y + 0.5f), uint32_t(c.Z * inv.Z + 0.5f));
+				keys[t] = (uint64_t(code) << 32) | uint64_t(t);
+			}
+			std::sort(keys.begin(), keys.end());
+
+			// New index list, vertices renumbered by first use
+			const unsigned int unassigned = 0xFFFFFFFFu;
+			std::vector<unsigned int> remap(mesh.Vertices.size(), unassigned);
+			std::vector<unsigned int> indices(tris * 3);
+			unsigned int next = 0;
+			for (size_t t = 0; t < tris; t++)
+			{
+				size_t src = size_t(keys[t] & 0xFFFFFFFFu);
+				for (int k = 0; k < 3; k++)
 				{
-					if (!meshname.empty())
+					unsigned int v = mesh.Indices[src * 3 + k];
+					if (remap[v] == unassigned)
+						remap[v] = next++;
+					indices[t * 3 + k] = remap[v];
+				}
+			}
+			for (unsigned int& r : remap)
+				if (r == unassigned)
+					r = next++;
+
+			std::vector<Vertex> vertices(mesh.Vertices.size());
+			for (size_t v = 0; v < mesh.Vertices.size(); v++)
+				vertices[remap[v]] = mesh.Vertices[v];
+
+			mesh.Vertices.swap(vertices);
+			mesh.Indices.swap(indices);
+		}
+
+		// Centre of the bounding box of a mesh, the origin of its
+		//	canonical (translation free) form
+		inline Vector3 MeshCenter(const Mesh& mesh)
+		{
+			Vector3 bmin, bmax;
+			MeshBounds(mesh, bmin, bmax);
+			return (bmin + bmax) / 2.0f;
+		}
+
+		// Hash of the geometry of a mesh relative to origin: positions,
+		//	normals and texture coordinates snapped to a grid of the given
+		//	step, and the index list. Translated copies hash the same,
+		//	unless a coordinate lands on a different side of a grid line,
+		//	which only costs a missed instance.
+		inline uint64_t HashGeometry(const Mesh& mesh, const Vector3& origin, float step)
+		{
+			const float inv = 1.0f / step;
+			uint64_t h = HashBytes(mesh.Indices.data(), mesh.Indices.size() * sizeof(unsigned int));
+			for (const Vertex& v : mesh.Vertices)
+			{
+				int64_t q[8] = {
+					llroundf((v.Position.X - origin.X) * inv),
+					llroundf((v.Position.Y - origin.Y) * inv),
+					llroundf((v.Position.Z - origin.Z) * inv),
+					llroundf(v.Normal.X * inv),
+					llroundf(v.Normal.Y * inv),
+					llroundf(v.Normal.Z * inv),
+					llroundf(v.TextureCoordinate.X * inv),
+					llroundf(v.TextureCoordinate.Y * inv)
+				};
+				h = HashBytes(q, sizeof(q), h);
+			}
+			return h;
+		}
+
+		// Exact check behind a hash match: same indices and every
+		//	attribute within tolerance after moving a to b's origin
+		inline bool SameGeometry(const Mesh& a, const Vector3& originA, const Mesh& b, const Vector3& originB, float tolerance)
+		{
+			if (a.Vertices.size() != b.Vertices.size() || a.Indices != b.Indices)
+				return false;
+			for (size_t i = 0; i < a.Vertices.size(); i++)
+			{
+				const Vertex& va = a.Vertices[i];
+				const Vertex& vb = b.Vertices[i];
+				Vector3 dp = (va.Position - originA) - (vb.Position - originB);
+				Vector3 dn = va.Normal - vb.Normal;
+				if (fabsf(dp.X) > tolerance || fabsf(dp.Y) > tolerance || fabsf(dp.Z) > tolerance ||
+					fabsf(dn.X) > tolerance || fabsf(dn.Y) > tolerance || fabsf(dn.Z) > tolerance ||
+					fabsf(va.TextureCoordinate.X - vb.TextureCoordinate.X) > tolerance ||
+					fabsf(va.TextureCoordinate.Y - vb.TextureCoordinate.Y) > tolerance)
+					return false;
+			}
+			return true;
+		}
+
+		// Fold translated copies of the same geometry and material into
+		//	one mesh with several instance offsets. Every remaining mesh
+		//	is centred on its bounding box and gets its own position as
+		//	the first offset, so all meshes can be drawn the same way.
+		//	Only translations are detected, rotated or scaled copies stay
+		//	separate meshes. Returns the number of meshes folded away.
+		inline size_t DetectInstances(std::vector<Mesh>& meshes, float tolerance)
+		{
+			// Prototypes by geometry and material hash
+			std::unordered_map<uint64_t, std::vector<size_t>> prototypes;
+			std::vector<Mesh> result;
+			result.reserve(meshes.size());
+
+			for (Mesh& mesh : meshes)
+			{
+				Vector3 center = MeshCenter(mesh);
+				uint64_t geometry = HashGeometry(mesh, center, tolerance);
+
+				const Material& m = mesh.MeshMaterial;
+				uint64_t key = HashBytes(m.name.data(), m.name.size(), geometry);
+				key = HashBytes(m.map_Kd.data(), m.map_Kd.size(), key);
+
+				bool folded = false;
+				std::vector<size_t>& candidates = prototypes[key];
+				for (size_t p : candidates)
+				{
+					Mesh& proto = result[p];
+					if (proto.MeshMaterial.name == m.name &&
+						SameGeometry(proto, Vector3(), mesh, center, tolerance))
 					{
-						std::cout
-							<< "\r- " << meshname
-							<< "\t| vertices > " << Positions.size()
-							<< "\t| texcoords > " << TCoords.size()
-							<< "\t| normals > " << Normals.size()
-							<< "\t| triangles > " << (Vertices.size() / 3)
-							<< (!MeshMatNames.empty() ? "\t| material: " + MeshMatNames.back() : "");
+						proto.InstanceOffsets.push_back(center);
+						proto.InstanceNames.push_back(std::move(mesh.MeshName));
+						folded = true;
+						break;
 					}
 				}
-				#endif
+				if (folded)
+					continue;
+
+				for (Vertex& v : mesh.Vertices)
+					v.Position = v.Position - center;
+				mesh.InstanceOffsets.assign(1, center);
+				mesh.InstanceNames.assign(1, mesh.MeshName);
+				mesh.GeometryHash = geometry;
+
+				candidates.push_back(result.size());
+				result.push_back(std::move(mesh));
+			}
+
+			size_t folded = meshes.size() - result.size();
+			meshes.swap(result);
+			return folded;
+		}
+	}
+
+	// Namespace: Stats
+	//
+	// Description: The namespace that holds the loader
+	//	instrumentation: per-phase timing, record counts
+	//	and allocation counters
+	namespace stats
+	{
+		// Phases of LoadFile that are timed separately
+		enum Phase
+		{
+			PhaseTokenize,		// line reading, firstToken/tail/split
+			PhaseParseFloat,	// stof on v/vt/vn records
+			PhaseFaceAssembly,	// face vertices from the raw OBJ indices
+			PhaseTriangulation,	// polygon triangulation
+			PhaseMaterials,		// .mtl loading and material assignment
+			PhaseMeshCopy,		// building and storing Mesh objects
+			PhasePostProcess,	// optional passes after parsing (spatial sort ...)
+			PhaseCount
+		};
+
+		// Record types counted by line
+		enum Record
+		{
+			RecordVertex,		// v
+			RecordTexCoord,		// vt
+			RecordNormal,		// vn
+			RecordFace,			// f
+			RecordGroup,		// o / g
+			RecordUseMtl,		// usemtl
+			RecordMtlLib,		// mtllib
+			RecordComment,		// # and empty lines
+			RecordOther,		// everything else (s, l, ...)
+			RecordCount
+		};
+
+		inline const char* PhaseName(int phase)
+		{
+			static const char* names[PhaseCount] = {
+				"tokenize", "parse float", "face assembly",
+				"triangulation", "materials", "mesh copies", "post process" };
+			return names[phase];
+		}
+
+		inline const char* RecordName(int record)
+		{
+			static const char* names[RecordCount] = {
+				"v", "vt", "vn", "f", "o/g", "usemtl", "mtllib", "comment", "other" };
+			return names[record];
+		}
+
+		// Structure: AllocCounters
+		//
+		// Description: Allocation counters of one load scope, updated by
+		//	the operator new/delete replacement (OBJL_ALLOC_TRACKING_IMPLEMENTATION)
+		//	on the thread that runs the load. Current is relative to the
+		//	start of the scope and goes negative when older blocks are freed.
+		struct AllocCounters
+		{
+			uint64_t Count;
+			uint64_t Bytes;
+			int64_t Current;
+			int64_t Peak;
+		};
+
+		// Counters of the load running on this thread, nullptr outside a load
+		inline AllocCounters*& ActiveAllocs()
+		{
+			static thread_local AllocCounters* active = nullptr;
+			return active;
+		}
+
+		// requested - bytes asked for, block - usable size of the block
+		inline void TrackAlloc(size_t requested, size_t block)
+		{
+			AllocCounters* c = ActiveAllocs();
+			if (!c)
+				return;
+			c->Count++;
+			c->Bytes += requested;
+			c->Current += int64_t(block);
+			if (c->Current > c->Peak)
+				c->Peak = c->Current;
+		}
+
+		inline void TrackFree(size_t block)
+		{
+			AllocCounters* c = ActiveAllocs();
+			if (c)
+				c->Current -= int64_t(block);
+		}
+
+		// True when the replacement is compiled into the program.
+		//	Probed once with a tracked allocation instead of being set
+		//	by a static initializer, so it is right even when asked
+		//	during static initialization of another translation unit.
+		inline bool AllocTrackingEnabled()
+		{
+			static const bool enabled = []
+			{
+				AllocCounters probe = {};
+				AllocCounters* previous = ActiveAllocs();
+				ActiveAllocs() = &probe;
+				void* volatile block = ::operator new(1);
+				::operator delete(block);
+				ActiveAllocs() = previous;
+				return probe.Count != 0;
+			}();
+			return enabled;
+		}
+
+		// Structure: LoadStats
+		//
+		// Description: Instrumentation results of the last LoadFile
+		struct LoadStats
+		{
+			LoadStats()
+			{
+				Reset();
+			}
+
+			void Reset()
+			{
+				for (int i = 0; i < PhaseCount; i++)
+					PhaseSeconds[i] = 0.0;
+				for (int i = 0; i < RecordCount; i++)
+					Lines[i] = 0;
+				TotalSeconds = 0.0;
+				BytesRead = 0;
+				Allocations = 0;
+				AllocatedBytes = 0;
+				PeakBytes = 0;
+				AllocTracking = false;
+				FromCache = false;
+				LocalityBefore = 0.0;
+				LocalityAfter = 0.0;
+				FoldedInstances = 0;
+				RemovedDegenerate = 0;
+				RemovedDuplicates = 0;
+				RemovedVertices = 0;
+				MeshCopies = 0;
+			}
+
+			// Wall time per phase, seconds
+			double PhaseSeconds[PhaseCount];
+			// Wall time of the whole load, seconds
+			double TotalSeconds;
+			// Bytes read from the .obj file
+			uint64_t BytesRead;
+			// Line counts per record type
+			uint64_t Lines[RecordCount];
+			// Number of heap allocations during the load
+			uint64_t Allocations;
+			// Bytes requested by those allocations
+			uint64_t AllocatedBytes;
+			// Peak heap usage above the level at the start of the load
+			uint64_t PeakBytes;
+			// False if allocation tracking is not compiled in
+			bool AllocTracking;
+			// True if the meshes came from LoadCache
+			bool FromCache;
+			// Triangle locality (algorithm::TriangleLocality) before and after
+			//	the spatial sort, weighted by triangle count. 0 if not sorted.
+			double LocalityBefore;
+			double LocalityAfter;
+			// Meshes folded into instances of another mesh
+			uint64_t FoldedInstances;
+			// Removed by the cleanup pass (algorithm::CleanMesh)
+			uint64_t RemovedDegenerate;
+			uint64_t RemovedDuplicates;
+			uint64_t RemovedVertices;
+			// Deep copies of Mesh objects during the load (Mesh::Copies),
+			//	0 unless a change broke the move-only path
+			uint64_t MeshCopies;
+		};
+
+		// Class: ScopedPhase
+		//
+		// Description: Adds the lifetime of the object to a phase timer
+		class ScopedPhase
+		{
+		public:
+			ScopedPhase(double& accumulator) : Acc(accumulator), Start(std::chrono::steady_clock::now())
+			{
+
+			}
+			~ScopedPhase()
+			{
+				Acc += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+			}
+
+		private:
+			double& Acc;
+			std::chrono::steady_clock::time_point Start;
+		};
+
+		// Class: ScopedLoad
+		//
+		// Description: Captures total time and allocation counters of a load.
+		//	The counters are this scope's own; a nested scope adds its
+		//	counts to the enclosing one when it ends.
+		class ScopedLoad
+		{
+		public:
+			ScopedLoad(LoadStats& stats) : Stats(stats), Start(std::chrono::steady_clock::now())
+			{
+				Stats.Reset();
+				Stats.AllocTracking = AllocTrackingEnabled();
+				CopiesAtStart = Mesh::Copies();
+				Counters = AllocCounters();
+				Outer = ActiveAllocs();
+				ActiveAllocs() = &Counters;
+			}
+			~ScopedLoad()
+			{
+				ActiveAllocs() = Outer;
+				if (Outer)
+				{
+					Outer->Count += Counters.Count;
+					Outer->Bytes += Counters.Bytes;
+					if (Outer->Current + Counters.Peak > Outer->Peak)
+						Outer->Peak = Outer->Current + Counters.Peak;
+					Outer->Current += Counters.Current;
+				}
+				Stats.Allocations = Counters.Count;
+				Stats.AllocatedBytes = Counters.Bytes;
+				Stats.PeakBytes = uint64_t(Counters.Peak);
+				Stats.MeshCopies = Mesh::Copies() - CopiesAtStart;
+				Stats.TotalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+			}
+
+		private:
+			LoadStats& Stats;
+			std::chrono::steady_clock::time_point Start;
+			AllocCounters Counters;
+			AllocCounters* Outer;
+			uint64_t CopiesAtStart;
+		};
+	}
+
+	#define OBJL_CONCAT_(a, b) a##b
+	#define OBJL_CONCAT(a, b) OBJL_CONCAT_(a, b)
+
+	#ifdef OBJL_INSTRUMENTATION
+	#define OBJL_PHASE(target, phase) ::objl::stats::ScopedPhase OBJL_CONCAT(objl_phase_, __LINE__)(target.PhaseSeconds[::objl::stats::phase])
+	#define OBJL_COUNT(target, record) (target.Lines[::objl::stats::record]++)
+	#else
+	#define OBJL_PHASE(target, phase)
+	#define OBJL_COUNT(target, record)
+	#endif
+
+	// Namespace: Codec
+	//
+	// Description: The namespace that holds the compact binary
+	//	encoding used by the mesh cache. Index streams are delta
+	//	and zigzag encoded into byte-oriented varints, vertex
+	//	attributes are quantized and bit-packed.
+	namespace codec
+	{
+		// Cache file identification ("OBJC" little endian)
+		const uint32_t Magic = 0x434A424F;
+		const uint32_t Version = 7;
+
+		// Smallest encoded sizes (empty strings, no vertices), used
+		//	to bound element counts read from a file
+		const size_t MinMaterialBytes = 63;
+		// Name 1, material 63, counts 2, bit widths 3, position
+		//	bounds 24, UV bounds 16, vertex block 9 (length + Flush
+		//	padding), index block 1, hashes 16, instances 1
+		const size_t MinMeshBytes = 136;
+		const size_t MinSpanBytes = 22;
+		const size_t MinCheckpointBytes = 11;
+
+		// Group index sidecar, "OBJI" (see Loader::SaveIndex)
+		const uint32_t IndexMagic = 0x494A424F;
+		const uint32_t IndexVersion = 2;
+
+		// Structure: Settings
+		//
+		// Description: Quantization precision for vertex attributes
+		struct Settings
+		{
+			Settings()
+			{
+				PositionBits = 16;
+				NormalBits = 12;
+				TexCoordBits = 16;
+			}
+
+			// Bits per position component (within the mesh bounds)
+			unsigned int PositionBits;
+			// Bits per octahedral normal component
+			unsigned int NormalBits;
+			// Bits per texture coordinate component (within the UV bounds)
+			unsigned int TexCoordBits;
+		};
+
+		// Structure: Stats
+		//
+		// Description: Size and timing of the last cache save or load
+		struct Stats
+		{
+			Stats()
+			{
+				RawBytes = 0;
+				EncodedBytes = 0;
+				Seconds = 0.0;
+			}
+
+			// Compression ratio (raw / encoded)
+			double Ratio() const
+			{
+				return EncodedBytes ? double(RawBytes) / double(EncodedBytes) : 0.0;
+			}
+			// Throughput in raw megabytes per second
+			double Throughput() const
+			{
+				return Seconds > 0.0 ? double(RawBytes) / (1024.0 * 1024.0) / Seconds : 0.0;
+			}
+
+			// Size of the vertex and index arrays in memory
+			uint64_t RawBytes;
+			// Size of the encoded cache
+			uint64_t EncodedBytes;
+			// Wall time of the encode or decode
+			double Seconds;
+		};
+
+		// Map a signed value onto an unsigned one (0, -1, 1, -2 ... -> 0, 1, 2, 3 ...)
+		inline uint32_t ZigZag(int32_t v)
+		{
+			return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+		}
+
+		// Inverse of ZigZag
+		inline int32_t UnZigZag(uint32_t v)
+		{
+			return int32_t(v >> 1) ^ -int32_t(v & 1);
+		}
+
+		// Class: ByteWriter
+		//
+		// Description: Appends little endian values to a byte buffer
+		class ByteWriter
+		{
+		public:
+			ByteWriter(std::vector<uint8_t>& out) : Out(out)
+			{
+
+			}
+
+			void PutU8(uint8_t v)
+			{
+				Out.push_back(v);
+			}
+			void PutU32(uint32_t v)
+			{
+				for (int i = 0; i < 4; i++)
+					Out.push_back(uint8_t(v >> (8 * i)));
+			}
+			void PutU64(uint64_t v)
+			{
+				for (int i = 0; i < 8; i++)
+					Out.push_back(uint8_t(v >> (8 * i)));
+			}
+			void PutF32(float v)
+			{
+				uint32_t u;
+				std::memcpy(&u, &v, sizeof(u));
+				PutU32(u);
+			}
+			void PutVector3(const Vector3& v)
+			{
+				PutF32(v.X);
+				PutF32(v.Y);
+				PutF32(v.Z);
+			}
+			// LEB128 variable length integer, 7 bits per byte
+			void PutVarint(uint32_t v)
+			{
+				while (v >= 0x80)
+				{
+					Out.push_back(uint8_t(v | 0x80));
+					v >>= 7;
+				}
+				Out.push_back(uint8_t(v));
+			}
+			void PutString(const std::string& s)
+			{
+				PutVarint(uint32_t(s.size()));
+				Out.insert(Out.end(), s.begin(), s.end());
+			}
+			void PutBytes(const std::vector<uint8_t>& bytes)
+			{
+				PutVarint(uint32_t(bytes.size()));
+				Out.insert(Out.end(), bytes.begin(), bytes.end());
+			}
+
+		private:
+			std::vector<uint8_t>& Out;
+		};
+
+		// Class: ByteReader
+		//
+		// Description: Reads values written by ByteWriter. Reading past
+		//	the end clears Ok instead of touching memory outside the buffer.
+		class ByteReader
+		{
+		public:
+			ByteReader(const uint8_t* begin, const uint8_t* end)
+			{
+				Cur = begin;
+				End = end;
+				Ok = true;
+			}
+
+			bool Has(size_t n)
+			{
+				if (size_t(End - Cur) < n)
+					Ok = false;
+				return Ok;
+			}
+			uint8_t GetU8()
+			{
+				if (!Has(1))
+					return 0;
+				return *Cur++;
+			}
+			uint32_t GetU32()
+			{
+				if (!Has(4))
+					return 0;
+				uint32_t v = uint32_t(Cur[0]) | (uint32_t(Cur[1]) << 8) | (uint32_t(Cur[2]) << 16) | (uint32_t(Cur[3]) << 24);
+				Cur += 4;
+				return v;
+			}
+			uint64_t GetU64()
+			{
+				uint64_t lo = GetU32();
+				uint64_t hi = GetU32();
+				return lo | (hi << 32);
+			}
+			float GetF32()
+			{
+				uint32_t u = GetU32();
+				float v;
+				std::memcpy(&v, &u, sizeof(v));
+				return v;
+			}
+			Vector3 GetVector3()
+			{
+				Vector3 v;
+				v.X = GetF32();
+				v.Y = GetF32();
+				v.Z = GetF32();
+				return v;
+			}
+			uint32_t GetVarint()
+			{
+				uint32_t v = 0;
+				for (int shift = 0; shift < 35; shift += 7)
+				{
+					if (!Has(1))
+						return 0;
+					uint8_t b = *Cur++;
+					v |= uint32_t(b & 0x7F) << shift;
+					if (b < 0x80)
+						return v;
+				}
+				Ok = false;
+				return 0;
+			}
+			// Element count of a following array whose elements
+			//	take at least minBytes each, so larger counts are
+			//	corrupt and are rejected before anything is allocated
+			uint32_t GetCount(size_t minBytes = 1)
+			{
+				uint32_t n = GetVarint();
+				if (!Ok || size_t(End - Cur) / minBytes < n)
+				{
+					Ok = false;
+					return 0;
+				}
+				return n;
+			}
+			std::string GetString()
+			{
+				uint32_t n = GetVarint();
+				if (!Has(n))
+					return "";
+				std::string s((const char*)Cur, n);
+				Cur += n;
+				return s;
+			}
+			// Returns a view of the next length-prefixed block and skips it
+			const uint8_t* GetBlock(uint32_t& n)
+			{
+				n = GetVarint();
+				if (!Has(n))
+					return nullptr;
+				const uint8_t* p = Cur;
+				Cur += n;
+				return p;
+			}
+
+			const uint8_t* Cur;
+			const uint8_t* End;
+			bool Ok;
+		};
+
+		// Class: BitWriter
+		//
+		// Description: Packs fields of arbitrary width (up to 32 bits)
+		//	LSB first into a byte buffer
+		class BitWriter
+		{
+		public:
+			BitWriter(std::vector<uint8_t>& out) : Out(out)
+			{
+				Acc = 0;
+				Count = 0;
+			}
+
+			void Put(uint32_t v, unsigned int bits)
+			{
+				Acc |= uint64_t(v) << Count;
+				Count += bits;
+				while (Count >= 8)
+				{
+					Out.push_back(uint8_t(Acc));
+					Acc >>= 8;
+					Count -= 8;
+				}
+			}
+			// Write out the partial last byte and pad for the reader
+			void Flush()
+			{
+				if (Count > 0)
+					Out.push_back(uint8_t(Acc));
+				Acc = 0;
+				Count = 0;
+				for (int i = 0; i < 8; i++)
+					Out.push_back(0);
+			}
+
+		private:
+			std::vector<uint8_t>& Out;
+			uint64_t Acc;
+			unsigned int Count;
+		};
+
+		// Class: BitReader
+		//
+		// Description: Reads fields written by BitWriter. The writer pads
+		//	the stream with 8 bytes so refills can always load a full word.
+		class BitReader
+		{
+		public:
+			BitReader(const uint8_t* data)
+			{
+				Data = data;
+				Pos = 0;
+			}
+
+			uint32_t Get(unsigned int bits)
+			{
+				uint64_t word;
+				std::memcpy(&word, Data + (Pos >> 3), sizeof(word));
+				word = FromLittleEndian(word);
+				uint32_t v = uint32_t((word >> (Pos & 7)) & ((uint64_t(1) << bits) - 1));
+				Pos += bits;
+				return v;
+			}
+
+		private:
+			static uint64_t FromLittleEndian(uint64_t v)
+			{
+				const uint16_t probe = 1;
+				if (*(const uint8_t*)&probe == 1)
+					return v;
+				uint64_t r = 0;
+				for (int i = 0; i < 8; i++)
+					r |= ((v >> (8 * i)) & 0xFF) << (8 * (7 - i));
+				return r;
+			}
+
+			const uint8_t* Data;
+			size_t Pos;
+		};
+
+		// Quantize a value within [lo, lo + extent] to the given number of bits
+		inline uint32_t Quantize(float v, float lo, float extent, unsigned int bits)
+		{
+			if (extent <= 0.0f)
+				return 0;
+			const float maxq = float((uint64_t(1) << bits) - 1);
+			float t = (v - lo) / extent;
+			if (t < 0.0f) t = 0.0f;
+			if (t > 1.0f) t = 1.0f;
+			return uint32_t(t * maxq + 0.5f);
+		}
+
+		// Octahedral mapping of a direction onto [-1, 1]^2
+		inline Vector2 OctEncode(Vector3 n)
+		{
+			float len = fabsf(n.X) + fabsf(n.Y) + fabsf(n.Z);
+			if (len == 0.0f)
+				return Vector2(0.0f, 0.0f);
+			n = n / len;
+			if (n.Z < 0.0f)
+			{
+				float x = (1.0f - fabsf(n.Y)) * (n.X >= 0.0f ? 1.0f : -1.0f);
+				float y = (1.0f - fabsf(n.X)) * (n.Y >= 0.0f ? 1.0f : -1.0f);
+				return Vector2(x, y);
+			}
+			return Vector2(n.X, n.Y);
+		}
+
+		// Inverse of OctEncode, returns a unit direction
+		inline Vector3 OctDecode(float x, float y)
+		{
+			Vector3 n(x, y, 1.0f - fabsf(x) - fabsf(y));
+			if (n.Z < 0.0f)
+			{
+				float ox = n.X;
+				n.X = (1.0f - fabsf(n.Y)) * (ox >= 0.0f ? 1.0f : -1.0f);
+				n.Y = (1.0f - fabsf(ox)) * (n.Y >= 0.0f ? 1.0f : -1.0f);
+			}
+			float len = sqrtf(n.X * n.X + n.Y * n.Y + n.Z * n.Z);
+			return n / len;
+		}
+
+		inline void EncodeMaterial(ByteWriter& w, const Material& m)
+		{
+			w.PutString(m.name);
+			w.PutVector3(m.Ka);
+			w.PutVector3(m.Kd);
+			w.PutVector3(m.Ks);
+			w.PutF32(m.Ns);
+			w.PutF32(m.Ni);
+			w.PutF32(m.d);
+			w.PutU32(uint32_t(m.illum));
+			w.PutString(m.map_Ka);
+			w.PutString(m.map_Kd);
+			w.PutString(m.map_Ks);
+			w.PutString(m.map_Ns);
+			w.PutString(m.map_d);
+			w.PutString(m.map_bump);
+			w.PutU32(uint32_t(m.map_max_size));
+		}
+
+		inline Material DecodeMaterial(ByteReader& r)
+		{
+			Material m;
+			m.name = r.GetString();
+			m.Ka = r.GetVector3();
+			m.Kd = r.GetVector3();
+			m.Ks = r.GetVector3();
+			m.Ns = r.GetF32();
+			m.Ni = r.GetF32();
+			m.d = r.GetF32();
+			m.illum = int(r.GetU32());
+			m.map_Ka = r.GetString();
+			m.map_Kd = r.GetString();
+			m.map_Ks = r.GetString();
+			m.map_Ns = r.GetString();
+			m.map_d = r.GetString();
+			m.map_bump = r.GetString();
+			m.map_max_size = int(r.GetU32());
+			return m;
+		}
+
+		// Encode a mesh (name, material, vertices and indices), the
+		//	vertices and indices are passed separately so that a view
+		//	into a MeshPool can be encoded as well
+		inline void EncodeMesh(ByteWriter& w, const Mesh& mesh,
+			const Vertex* vertices, size_t vertexCount,
+			const unsigned int* indices, size_t indexCount, const Settings& settings)
+		{
+			w.PutString(mesh.MeshName);
+			EncodeMaterial(w, mesh.MeshMaterial);
+
+			w.PutVarint(uint32_t(vertexCount));
+			w.PutVarint(uint32_t(indexCount));
+			w.PutU8(uint8_t(settings.PositionBits));
+			w.PutU8(uint8_t(settings.NormalBits));
+			w.PutU8(uint8_t(settings.TexCoordBits));
+
+			// Quantization frames: position AABB and UV bounds
+			Vector3 pmin, pmax;
+			Vector2 tmin, tmax;
+			if (vertexCount > 0)
+			{
+				pmin = pmax = vertices[0].Position;
+				tmin = tmax = vertices[0].TextureCoordinate;
+			}
+			for (size_t k = 0; k < vertexCount; k++)
+			{
+				const Vertex& v = vertices[k];
+				pmin = Vector3(fminf(pmin.X, v.Position.X), fminf(pmin.Y, v.Position.Y), fminf(pmin.Z, v.Position.Z));
+				pmax = Vector3(fmaxf(pmax.X, v.Position.X), fmaxf(pmax.Y, v.Position.Y), fmaxf(pmax.Z, v.Position.Z));
+				tmin = Vector2(fminf(tmin.X, v.TextureCoordinate.X), fminf(tmin.Y, v.TextureCoordinate.Y));
+				tmax = Vector2(fmaxf(tmax.X, v.TextureCoordinate.X), fmaxf(tmax.Y, v.TextureCoordinate.Y));
+			}
+			Vector3 pext = pmax - pmin;
+			Vector2 text = tmax - tmin;
+			w.PutVector3(pmin);
+			w.PutVector3(pext);
+			w.PutF32(tmin.X);
+			w.PutF32(tmin.Y);
+			w.PutF32(text.X);
+			w.PutF32(text.Y);
+
+			// Bit-packed vertex stream
+			std::vector<uint8_t> bits;
+			bits.reserve(vertexCount * (3 * settings.PositionBits + 2 * settings.NormalBits + 2 * settings.TexCoordBits) / 8 + 16);
+			BitWriter bw(bits);
+			for (size_t k = 0; k < vertexCount; k++)
+			{
+				const Vertex& v = vertices[k];
+				bw.Put(Quantize(v.Position.X, pmin.X, pext.X, settings.PositionBits), settings.PositionBits);
+				bw.Put(Quantize(v.Position.Y, pmin.Y, pext.Y, settings.PositionBits), settings.PositionBits);
+				bw.Put(Quantize(v.Position.Z, pmin.Z, pext.Z, settings.PositionBits), settings.PositionBits);
+
+				Vector2 oct = OctEncode(v.Normal);
+				bw.Put(Quantize(oct.X, -1.0f, 2.0f, settings.NormalBits), settings.NormalBits);
+				bw.Put(Quantize(oct.Y, -1.0f, 2.0f, settings.NormalBits), settings.NormalBits);
+
+				bw.Put(Quantize(v.TextureCoordinate.X, tmin.X, text.X, settings.TexCoordBits), settings.TexCoordBits);
+				bw.Put(Quantize(v.TextureCoordinate.Y, tmin.Y, text.Y, settings.TexCoordBits), settings.TexCoordBits);
+			}
+			bw.Flush();
+			w.PutBytes(bits);
+
+			// Index stream: zigzag deltas as varints
+			std::vector<uint8_t> idx;
+			idx.reserve(indexCount + 16);
+			ByteWriter iw(idx);
+			uint32_t prev = 0;
+			for (size_t k = 0; k < indexCount; k++)
+			{
+				unsigned int i = indices[k];
+				iw.PutVarint(ZigZag(int32_t(i - prev)));
+				prev = i;
+			}
+			w.PutBytes(idx);
+
+			// Instances, stored at full precision
+			w.PutU64(mesh.GeometryHash);
+			w.PutU64(mesh.SourceHash);
+			w.PutVarint(uint32_t(mesh.InstanceOffsets.size()));
+			for (size_t i = 0; i < mesh.InstanceOffsets.size(); i++)
+			{
+				w.PutVector3(mesh.InstanceOffsets[i]);
+				w.PutString(i < mesh.InstanceNames.size() ? mesh.InstanceNames[i] : std::string());
+			}
+		}
+
+		inline void EncodeMesh(ByteWriter& w, const Mesh& mesh, const Settings& settings)
+		{
+			EncodeMesh(w, mesh, mesh.Vertices.data(), mesh.Vertices.size(),
+				mesh.Indices.data(), mesh.Indices.size(), settings);
+		}
+
+		// Decode a mesh written by EncodeMesh, returns false on a corrupt stream
+		inline bool DecodeMesh(ByteReader& r, Mesh& mesh)
+		{
+			mesh.MeshName = r.GetString();
+			mesh.MeshMaterial = DecodeMaterial(r);
+
+			uint32_t vcount = r.GetVarint();
+			uint32_t icount = r.GetVarint();
+			unsigned int pbits = r.GetU8();
+			unsigned int nbits = r.GetU8();
+			unsigned int tbits = r.GetU8();
+			if (!r.Ok || pbits == 0 || pbits > 24 || nbits == 0 || nbits > 24 || tbits == 0 || tbits > 24)
+				return false;
+
+			Vector3 pmin = r.GetVector3();
+			Vector3 pext = r.GetVector3();
+			Vector2 tmin, text;
+			tmin.X = r.GetF32();
+			tmin.Y = r.GetF32();
+			text.X = r.GetF32();
+			text.Y = r.GetF32();
+
+			// Dequantization scales
+			const Vector3 ps(pext.X / float((1u << pbits) - 1), pext.Y / float((1u << pbits) - 1), pext.Z / float((1u << pbits) - 1));
+			const float ns = 2.0f / float((1u << nbits) - 1);
+			const Vector2 ts(text.X / float((1u << tbits) - 1), text.Y / float((1u << tbits) - 1));
+
+			uint32_t nbytes;
+			const uint8_t* vbits = r.GetBlock(nbytes);
+			const uint64_t needBits = uint64_t(vcount) * (3 * pbits + 2 * nbits + 2 * tbits);
+			if (!r.Ok || uint64_t(nbytes) * 8 < needBits + 64)
+				return false;
+
+			mesh.Vertices.resize(vcount);
+			BitReader br(vbits);
+			for (uint32_t i = 0; i < vcount; i++)
+			{
+				Vertex& v = mesh.Vertices[i];
+				v.Position.X = pmin.X + float(br.Get(pbits)) * ps.X;
+				v.Position.Y = pmin.Y + float(br.Get(pbits)) * ps.Y;
+				v.Position.Z = pmin.Z + float(br.Get(pbits)) * ps.Z;
+
+				float ox = float(br.Get(nbits)) * ns - 1.0f;
+				float oy = float(br.Get(nbits)) * ns - 1.0f;
+				v.Normal = OctDecode(ox, oy);
+
+				v.TextureCoordinate.X = tmin.X + float(br.Get(tbits)) * ts.X;
+				v.TextureCoordinate.Y = tmin.Y + float(br.Get(tbits)) * ts.Y;
+			}
+
+			// Every index takes at least one byte of the block
+			const uint8_t* ibytes = r.GetBlock(nbytes);
+			if (!r.Ok || icount > nbytes)
+				return false;
+
+			mesh.Indices.resize(icount);
+			const uint8_t* p = ibytes;
+			const uint8_t* end = ibytes + nbytes;
+			uint32_t prev = 0;
+			for (uint32_t i = 0; i < icount; i++)
+			{
+				// Fast path: single byte varint (small deltas)
+				uint32_t z;
+				if (p < end && *p < 0x80)
+				{
+					z = *p++;
+				}
+				else
+				{
+					ByteReader ir(p, end);
+					z = ir.GetVarint();
+					if (!ir.Ok)
+						return false;
+					p = ir.Cur;
+				}
+				prev += uint32_t(UnZigZag(z));
+				if (prev >= vcount)
+					return false;
+				mesh.Indices[i] = prev;
+			}
+
+			mesh.GeometryHash = r.GetU64();
+			mesh.SourceHash = r.GetU64();
+			size_t instances = r.GetCount(3 * sizeof(float) + 1);
+			mesh.InstanceOffsets.resize(instances);
+			mesh.InstanceNames.resize(instances);
+			for (size_t i = 0; i < instances; i++)
+			{
+				mesh.InstanceOffsets[i] = r.GetVector3();
+				mesh.InstanceNames[i] = r.GetString();
+			}
+			return r.Ok;
+		}
+
+		// Size and modification time of a file, used to detect a stale cache
+		inline bool FileStamp(const std::string& path, uint64_t& size, uint64_t& mtime)
+		{
+			struct stat st;
+			if (stat(path.c_str(), &st) != 0)
+				return false;
+			size = uint64_t(st.st_size);
+			mtime = uint64_t(st.st_mtime);
+			return true;
+		}
+	}
+
+	// Structure: GroupSpan
+	//
+	// Description: One mesh worth of an OBJ file: the lines between
+	//	two o/g/usemtl lines, same boundaries as LoadFile uses.
+	//	The v/vt/vn counts before the span turn its face indices
+	//	into positions in the file. A group split by usemtl, or
+	//	reopened later in the file, has one span per part.
+	struct GroupSpan
+	{
+		GroupSpan()
+		{
+			Begin = End = 0;
+			Positions = TCoords = Normals = 0;
+		}
+
+		// Group name (o/g line) and material (usemtl line)
+		std::string Name;
+		std::string Material;
+		// Name LoadFile gives the mesh of this span: Name, or Name_N
+		//	for a usemtl split or a reopened group (algorithm::MeshNamer)
+		std::string MeshName;
+		// Byte range in the .obj file
+		uint64_t Begin;
+		uint64_t End;
+		// v, vt and vn records before Begin
+		uint32_t Positions;
+		uint32_t TCoords;
+		uint32_t Normals;
+	};
+
+	// Structure: IndexCheckpoint
+	//
+	// Description: Byte offset of a line and the v/vt/vn counts
+	//	before it, taken every CheckpointInterval vertex records.
+	//	Lets a group that uses vertices defined elsewhere read
+	//	them without scanning the file from the start.
+	struct IndexCheckpoint
+	{
+		uint64_t Offset;
+		uint32_t Positions;
+		uint32_t TCoords;
+		uint32_t Normals;
+	};
+
+	// Structure: GroupIndex
+	//
+	// Description: Random access index of an OBJ file,
+	//	built by Loader::BuildIndex
+	struct GroupIndex
+	{
+		// Vertex records between two checkpoints
+		static const uint32_t CheckpointInterval = 4096;
+
+		// Paths of the .mtl files referenced by mtllib
+		std::vector<std::string> MaterialFiles;
+		std::vector<GroupSpan> Spans;
+		std::vector<IndexCheckpoint> Checkpoints;
+	};
+
+	// Structure: LoaderOptions
+	//
+	// Description: Optional behaviour of Loader::LoadFile
+	struct LoaderOptions
+	{
+		LoaderOptions()
+		{
+			KeepCombinedLists = true;
+			SortTrianglesMorton = false;
+			DetectInstances = false;
+			InstanceTolerance = 1e-4f;
+			CleanMeshes = false;
+			DegenerateArea = 1e-12f;
+			PooledMeshes = false;
+			HashMeshes = false;
+		}
+
+		// Find a file referenced by the model (mtllib) given its path
+		//	relative to the .obj directory. Returns false when the file
+		//	does not exist; empty - the path is used as is.
+		std::function<bool(const std::string& name, std::string& path)> ResolveFile;
+
+		// Fill LoadedVertices / LoadedIndices. These hold a second
+		//	copy of every mesh, turn off when only LoadedMeshes is used.
+		bool KeepCombinedLists;
+		// Put the vertices and indices of all meshes into Loader::Pool
+		//	instead of one pair of arrays per mesh (Mesh::InPool).
+		//	Without post-process passes the meshes are written into the
+		//	pool directly while parsing.
+		bool PooledMeshes;
+		// Remove degenerate and duplicate triangles and unreferenced
+		//	vertices (algorithm::CleanMesh). DegenerateArea is relative
+		//	to the squared diagonal of the mesh bounds.
+		bool CleanMeshes;
+		float DegenerateArea;
+		// Reorder triangles and vertices of every mesh along the Morton
+		//	curve of the triangle centroids (algorithm::MortonSortTriangles).
+		//	Worth it for large static meshes used by spatial queries.
+		bool SortTrianglesMorton;
+		// Fold meshes that are translated copies of each other (same
+		//	material, geometry equal within InstanceTolerance) into one
+		//	mesh with Mesh::InstanceOffsets, see algorithm::DetectInstances.
+		bool DetectInstances;
+		float InstanceTolerance;
+		// Fill Mesh::SourceHash after the post-process passes, used
+		//	to tell which meshes changed when a model is reloaded
+		bool HashMeshes;
+	};
+
+	// Class: Loader
+	//
+	// Description: The OBJ Model Loader
+	class Loader
+	{
+	public:
+		// Default Constructor
+		Loader()
+		{
+
+		}
+		~Loader()
+		{
+			LoadedMeshes.clear();
+		}
+
+		// Load a file into the loader
+		//
+		// If file is loaded return true
+		//
+		// If the file is unable to be found
+		// or unable to be loaded return false
+		//
+		// Timing, record counts and memory use of the
+		// load are available in Stats afterwards
+		bool LoadFile(std::string Path)
+		{
+			// If the file is not an .obj file return false
+			if (Path.substr(Path.size() - 4, 4) != ".obj")
+				return false;
+
+
+			std::ifstream file(Path, std::ios::binary | std::ios::ate);
+
+			if (!file.is_open())
+				return false;
+
+			stats::ScopedLoad load(Stats);
+
+			// Read the whole file at once, then count the records
+			// so that every array is allocated only once
+			std::string buffer;
+			{
+				OBJL_PHASE(Stats, PhaseTokenize);
+
+				std::streamoff size = file.tellg();
+				if (size > 0)
+				{
+					buffer.resize((size_t)size);
+					file.seekg(0);
+					file.read(&buffer[0], size);
+					buffer.resize((size_t)file.gcount());
+				}
+				file.close();
+			}
+			Stats.BytesRead = buffer.size();
+
+			RecordCounts counts;
+			CountRecords(buffer, counts);
+
+			LoadedMeshes.clear();
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			MaterialFiles.clear();
+			Pool.Clear();
+
+			// The post-process passes work on per-mesh arrays, with
+			// them the pool is packed afterwards
+			const bool pooled = Options.PooledMeshes && !NeedsPostProcess();
+			if (pooled)
+			{
+				Pool.Vertices.reserve(counts.FaceVertices);
+				Pool.Indices.reserve(counts.TriangleIndices);
+			}
+
+			std::vector<Vector3> Positions;
+			std::vector<Vector2> TCoords;
+			std::vector<Vector3> Normals;
+			Positions.reserve(counts.Positions);
+			TCoords.reserve(counts.TCoords);
+			Normals.reserve(counts.Normals);
+
+			// Current mesh, sized from the counts of its segment
+			size_t segment = 0;
+			std::vector<Vertex> Vertices;
+			std::vector<unsigned int> Indices;
+			Vertices.reserve(counts.Segments[segment].Vertices);
+			Indices.reserve(counts.Segments[segment].Indices);
+
+			if (Options.KeepCombinedLists)
+			{
+				LoadedVertices.reserve(counts.FaceVertices);
+				LoadedIndices.reserve(counts.TriangleIndices);
+			}
+
+			// Per face scratch arrays, reused between faces
+			std::vector<Vertex> vVerts;
+			std::vector<unsigned int> iIndices;
+
+			// Material of every mesh in LoadedMeshes, bound when the mesh
+			// is created: the last usemtl before it, carried across groups
+			std::vector<std::string> MeshMatNames;
+			MeshMatNames.reserve(counts.Segments.size());
+			std::string matname;
+
+			// Name of a finished mesh of the current group, unique in
+			// the file (see algorithm::MeshNamer)
+			algorithm::MeshNamer namer;
+			std::string meshname;
+			auto uniqueName = [&](bool split) -> std::string
+			{
+				return namer.Next(meshname, split);
+			};
+
+			bool listening = false;
+
+			#ifdef OBJL_CONSOLE_OUTPUT
+			const unsigned int outputEveryNth = 1000;
+			unsigned int outputIndicator = outputEveryNth;
+			#endif
+
+			std::string curline;
+			std::string token;
+			size_t linestart = 0;
+			while (linestart < buffer.size())
+			{
+				{
+					OBJL_PHASE(Stats, PhaseTokenize);
+					NextLine(buffer, linestart, curline);
+					token = algorithm::firstToken(curline);
+				}
+
+				#ifdef OBJL_CONSOLE_OUTPUT
+				if ((outputIndicator = ((outputIndicator + 1) % outputEveryNth)) == 1)
+				{
+					if (!meshname.empty())
+					{
+						std::cout
+							<< "\r- " << meshname
+							<< "\t| vertices > " << Positions.size()
+							<< "\t| texcoords > " << TCoords.size()
+							<< "\t| normals > " << Normals.size()
+							<< "\t| triangles > " << (Vertices.size() / 3)
+							<< (!matname.empty() ? "\t| material: " + matname : "");
+					}
+				}
+				#endif
+
+				// Generate a Mesh Object or Prepare for an object to be created
+				if (token == "o" || token == "g" || curline[0] == 'g')
+				{
+					OBJL_COUNT(Stats, RecordGroup);
+
+					if (!listening)
+					{
+						listening = true;
+
+						if (token == "o" || token == "g")
+						{
+							meshname = algorithm::tail(curline);
+						}
+						else
+						{
+							meshname = "unnamed";
+						}
+					}
+					else
+					{
+						// Generate the mesh to put into the array
+
+						if (!Indices.empty() && !Vertices.empty())
+						{
+							OBJL_PHASE(Stats, PhaseMeshCopy);
+
+							// Create and Insert Mesh
+							AddMesh(Vertices, Indices, pooled).MeshName = uniqueName(false);
+							MeshMatNames.push_back(matname);
+
+							// Cleanup
+							Vertices.clear();
+							Indices.clear();
+							meshname.clear();
+
+							meshname = algorithm::tail(curline);
+						}
+						else
+						{
+							if (token == "o" || token == "g")
+							{
+								meshname = algorithm::tail(curline);
+							}
+							else
+							{
+								meshname = "unnamed";
+							}
+						}
+					}
+					NextSegment(counts, segment, Vertices, Indices);
+
+					#ifdef OBJL_CONSOLE_OUTPUT
+					std::cout << std::endl;
+					outputIndicator = 0;
+					#endif
+				}
+				// Generate a Vertex Position
+				else if (token == "v")
+				{
+					OBJL_COUNT(Stats, RecordVertex);
+
+					std::vector<std::string> spos;
+					Vector3 vpos;
+					{
+						OBJL_PHASE(Stats, PhaseTokenize);
+						algorithm::split(algorithm::tail(curline), spos, " ");
+						algorithm::requireValues(spos, 3, "v");
+					}
+					{
+						OBJL_PHASE(Stats, PhaseParseFloat);
+						vpos.X = std::stof(spos[0]);
+						vpos.Y = std::stof(spos[1]);
+						vpos.Z = std::stof(spos[2]);
+					}
+
+					Positions.push_back(vpos);
+				}
+				// Generate a Vertex Texture Coordinate
+				else if (token == "vt")
+				{
+					OBJL_COUNT(Stats, RecordTexCoord);
+
+					std::vector<std::string> stex;
+					Vector2 vtex;
+					{
+						OBJL_PHASE(Stats, PhaseTokenize);
+						algorithm::split(algorithm::tail(curline), stex, " ");
+						algorithm::requireValues(stex, 2, "vt");
+					}
+					{
+						OBJL_PHASE(Stats, PhaseParseFloat);
+						vtex.X = std::stof(stex[0]);
+						vtex.Y = std::stof(stex[1]);
+					}
+
+					TCoords.push_back(vtex);
+				}
+				// Generate a Vertex Normal;
+				else if (token == "vn")
+				{
+					OBJL_COUNT(Stats, RecordNormal);
+
+					std::vector<std::string> snor;
+					Vector3 vnor;
+					{
+						OBJL_PHASE(Stats, PhaseTokenize);
+						algorithm::split(algorithm::tail(curline), snor, " ");
+						algorithm::requireValues(snor, 3, "vn");
+					}
+					{
+						OBJL_PHASE(Stats, PhaseParseFloat);
+						vnor.X = std::stof(snor[0]);
+						vnor.Y = std::stof(snor[1]);
+						vnor.Z = std::stof(snor[2]);
+					}
+
+					Normals.push_back(vnor);
+				}
+				// Generate a Face (vertices & indices)
+				else if (token == "f")
+				{
+					OBJL_COUNT(Stats, RecordFace);
+
+					// Generate the vertices
+					vVerts.clear();
+					{
+						OBJL_PHASE(Stats, PhaseFaceAssembly);
+						GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, curline);
+
+						// Add Vertices
+						Vertices.insert(Vertices.end(), vVerts.begin(), vVerts.end());
+
+						if (Options.KeepCombinedLists)
+							LoadedVertices.insert(LoadedVertices.end(), vVerts.begin(), vVerts.end());
+					}
+
+					iIndices.clear();
+					{
+						OBJL_PHASE(Stats, PhaseTriangulation);
+						VertexTriangluation(iIndices, vVerts);
+					}
+
+					// Add Indices
+					OBJL_PHASE(Stats, PhaseFaceAssembly);
+					for (int i = 0; i < int(iIndices.size()); i++)
+					{
+						unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
+						Indices.push_back(indnum);
+
+						if (Options.KeepCombinedLists)
+						{
+							indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
+							LoadedIndices.push_back(indnum);
+						}
+					}
+				}
+				// Get Mesh Material Name
+				else if (token == "usemtl")
+				{
+					OBJL_COUNT(Stats, RecordUseMtl);
+
+					// Create new Mesh, if Material changes within a group.
+					// It keeps the material it was built with
+					if (!Indices.empty() && !Vertices.empty())
+					{
+						OBJL_PHASE(Stats, PhaseMeshCopy);
+
+						// Create and Insert Mesh
+						AddMesh(Vertices, Indices, pooled).MeshName = uniqueName(true);
+						MeshMatNames.push_back(matname);
+
+						// Cleanup
+						Vertices.clear();
+						Indices.clear();
+					}
+
+					matname = algorithm::tail(curline);
+
+					NextSegment(counts, segment, Vertices, Indices);
+
+					#ifdef OBJL_CONSOLE_OUTPUT
+					outputIndicator = 0;
+					#endif
+				}
+				// Load Materials
+				else if (token == "mtllib")
+				{
+					OBJL_COUNT(Stats, RecordMtlLib);
+					OBJL_PHASE(Stats, PhaseMaterials);
+
+					// Generate LoadedMaterial
+
+					// Generate a path to the material file
+					std::string pathtomat = MaterialPath(Path, algorithm::tail(curline));
+					MaterialFiles.push_back(pathtomat);
+
+					#ifdef OBJL_CONSOLE_OUTPUT
+					std::cout << std::endl << "- find materials in: " << pathtomat << std::endl;
+					#endif
+
+					// Load Materials
+					LoadMaterials(pathtomat);
+				}
+				else if (token.empty() || token[0] == '#')
+				{
+					OBJL_COUNT(Stats, RecordComment);
+				}
+				else
+				{
+					OBJL_COUNT(Stats, RecordOther);
+				}
+			}
+
+			#ifdef OBJL_CONSOLE_OUTPUT
+			std::cout << std::endl;
+			#endif
+
+			// Deal with last mesh
+
+			if (!Indices.empty() && !Vertices.empty())
+			{
+				OBJL_PHASE(Stats, PhaseMeshCopy);
+
+				// Create and Insert Mesh
+				AddMesh(Vertices, Indices, pooled).MeshName = uniqueName(false);
+				MeshMatNames.push_back(matname);
+			}
+
+			// Set Materials for each Mesh
+			{
+				OBJL_PHASE(Stats, PhaseMaterials);
+
+				// Material by name, the first definition wins
+				std::unordered_map<std::string, size_t> materialIndex;
+				materialIndex.reserve(LoadedMaterials.size());
+				for (size_t j = 0; j < LoadedMaterials.size(); j++)
+					materialIndex.emplace(LoadedMaterials[j].name, j);
+
+				for (size_t i = 0; i < LoadedMeshes.size(); i++)
+				{
+					// Find corresponding material name in loaded materials
+					// when found copy material variables into mesh material
+					auto found = materialIndex.find(MeshMatNames[i]);
+					if (found != materialIndex.end())
+						LoadedMeshes[i].MeshMaterial = LoadedMaterials[found->second];
+				}
+			}
+
+			PostProcess();
+
+			if (Options.PooledMeshes)
+				PackPool();
+
+			if (Options.HashMeshes)
+				HashMeshes();
+
+			if (LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty())
+			{
+				return false;
+			}
+			else
+			{
+				return true;
+			}
+		}
+
+		// Save the loaded meshes to a compressed cache file
+		//
+		// SourcePath is the .obj the meshes were loaded from,
+		// its size and modification time are stored so that
+		// LoadCache can reject a stale cache
+		bool SaveCache(std::string Path, std::string SourcePath = "",
+			const codec::Settings& settings = codec::Settings())
+		{
+			auto start = std::chrono::steady_clock::now();
+
+			std::vector<uint8_t> out;
+			codec::ByteWriter w(out);
+
+			uint64_t srcSize = 0, srcTime = 0;
+			if (!SourcePath.empty())
+				codec::FileStamp(SourcePath, srcSize, srcTime);
+
+			w.PutU32(codec::Magic);
+			w.PutU32(codec::Version);
+			w.PutU64(srcSize);
+			w.PutU64(srcTime);
+
+			// Materials are cached too, so each .mtl is stamped like the .obj
+			w.PutVarint(uint32_t(MaterialFiles.size()));
+			for (const std::string& f : MaterialFiles)
+			{
+				uint64_t mtlSize = 0, mtlTime = 0;
+				codec::FileStamp(f, mtlSize, mtlTime);
+				w.PutString(f);
+				w.PutU64(mtlSize);
+				w.PutU64(mtlTime);
+			}
+
+			w.PutVarint(uint32_t(LoadedMaterials.size()));
+			for (const Material& m : LoadedMaterials)
+				codec::EncodeMaterial(w, m);
+
+			uint64_t raw = 0;
+			w.PutVarint(uint32_t(LoadedMeshes.size()));
+			for (const Mesh& m : LoadedMeshes)
+			{
+				if (m.InPool)
+				{
+					codec::EncodeMesh(w, m, Pool.Vertices.data() + m.VertexOffset, m.VertexCount,
+						Pool.Indices.data() + m.IndexOffset, m.IndexCount, settings);
+					raw += m.VertexCount * sizeof(Vertex) + m.IndexCount * sizeof(unsigned int);
+				}
+				else
+				{
+					codec::EncodeMesh(w, m, settings);
+					raw += m.Vertices.size() * sizeof(Vertex) + m.Indices.size() * sizeof(unsigned int);
+				}
+			}
+
+			std::ofstream file(Path, std::ios::binary);
+			if (!file.is_open())
+				return false;
+			file.write((const char*)out.data(), std::streamsize(out.size()));
+			if (!file)
+				return false;
+
+			CacheStats.RawBytes = raw;
+			CacheStats.EncodedBytes = out.size();
+			CacheStats.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			#ifdef OBJL_CONSOLE_OUTPUT
+			std::cout << "- cache saved: " << Path
+				<< "\t| " << CacheStats.RawBytes << " -> " << CacheStats.EncodedBytes << " bytes"
+				<< "\t| ratio " << CacheStats.Ratio() << std::endl;
+			#endif
+
+			return true;
+		}
+
+		// Load meshes from a cache file written by SaveCache
+		//
+		// If SourcePath is given and its size or modification
+		// time (or those of one of its .mtl files) differ from
+		// the ones stored in the cache, the cache is considered
+		// stale and false is returned
+		bool LoadCache(std::string Path, std::string SourcePath = "")
+		{
+			std::ifstream file(Path, std::ios::binary | std::ios::ate);
+			if (!file.is_open())
+				return false;
+
+			stats::ScopedLoad load(Stats);
+			Stats.FromCache = true;
+
+			std::streamoff size = file.tellg();
+			if (size <= 0)
+				return false;
+			std::vector<uint8_t> data((size_t)size);
+			file.seekg(0);
+			if (!file.read((char*)data.data(), size))
+				return false;
+			Stats.BytesRead = data.size();
+
+			auto start = std::chrono::steady_clock::now();
+
+			codec::ByteReader r(data.data(), data.data() + data.size());
+			if (r.GetU32() != codec::Magic || r.GetU32() != codec::Version)
+				return false;
+
+			uint64_t srcSize = r.GetU64();
+			uint64_t srcTime = r.GetU64();
+			if (!SourcePath.empty())
+			{
+				uint64_t curSize, curTime;
+				if (!codec::FileStamp(SourcePath, curSize, curTime) || curSize != srcSize || curTime != srcTime)
+					return false;
+			}
+
+			std::vector<std::string> materialFiles(r.GetCount(1 + 2 * sizeof(uint64_t)));
+			for (std::string& f : materialFiles)
+			{
+				f = r.GetString();
+				uint64_t mtlSize = r.GetU64();
+				uint64_t mtlTime = r.GetU64();
+				if (!SourcePath.empty())
+				{
+					uint64_t curSize = 0, curTime = 0;
+					codec::FileStamp(f, curSize, curTime);
+					if (curSize != mtlSize || curTime != mtlTime)
+						return false;
+				}
+			}
+
+			std::vector<Material> materials(r.GetCount(codec::MinMaterialBytes));
+			for (Material& m : materials)
+				m = codec::DecodeMaterial(r);
+
+			std::vector<Mesh> meshes(r.GetCount(codec::MinMeshBytes));
+			uint64_t raw = 0;
+			for (Mesh& m : meshes)
+			{
+				if (!r.Ok || !codec::DecodeMesh(r, m))
+					return false;
+				raw += m.Vertices.size() * sizeof(Vertex) + m.Indices.size() * sizeof(unsigned int);
+			}
+			if (!r.Ok)
+				return false;
+
+			CacheStats.RawBytes = raw;
+			CacheStats.EncodedBytes = data.size();
+			CacheStats.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+			MaterialFiles.swap(materialFiles);
+			LoadedMaterials.swap(materials);
+			LoadedMeshes.swap(meshes);
+
+			// Rebuild the combined vertex and index lists
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			if (Options.KeepCombinedLists)
+				RebuildCombinedLists();
+
+			Pool.Clear();
+			if (Options.PooledMeshes)
+				PackPool();
+
+			#ifdef OBJL_CONSOLE_OUTPUT
+			std::cout << "- cache loaded: " << Path
+				<< "\t| meshes > " << LoadedMeshes.size()
+				<< "\t| ratio " << CacheStats.Ratio()
+				<< "\t| decode " << CacheStats.Throughput() << " MB/s" << std::endl;
+			#endif
+
+			return !LoadedMeshes.empty();
+		}
+
+		// Build the group index of an OBJ file
+		//
+		// Only looks at the first characters of every line,
+		// nothing is parsed, so this runs at close to disk speed
+		bool BuildIndex(std::string Path, GroupIndex& index)
+		{
+			std::ifstream file(Path, std::ios::binary | std::ios::ate);
+			if (!file.is_open())
+				return false;
+
+			std::string buffer;
+			std::streamoff size = file.tellg();
+			if (size > 0)
+			{
+				buffer.resize((size_t)size);
+				file.seekg(0);
+				file.read(&buffer[0], size);
+				buffer.resize((size_t)file.gcount());
+			}
+
+			index = GroupIndex();
+			// group is the name LoadFile names the meshes after, empty
+			//	before the first o/g line
+			algorithm::MeshNamer namer;
+			std::string group;
+			GroupSpan span;
+			span.Name = "unnamed";
+			bool faces = false;
+			uint32_t positions = 0, tcoords = 0, normals = 0;
+			uint32_t sinceCheckpoint = GroupIndex::CheckpointInterval;
+
+			std::string line;
+			size_t pos = 0;
+			while (pos < buffer.size())
+			{
+				size_t start = pos;
+				size_t eol = buffer.find('\n', pos);
+				if (eol == std::string::npos)
+					eol = buffer.size();
+				pos = eol + 1;
+
+				const char* p = buffer.data() + start;
+				const char* end = buffer.data() + eol;
+				while (p < end && (*p == ' ' || *p == '\t'))
+					p++;
+				if (p == end)
+					continue;
+
+				const char c0 = p[0];
+				const char c1 = p + 1 < end ? p[1] : ' ';
+				const bool sep1 = (c1 == ' ' || c1 == '\t' || c1 == '\r');
+
+				if (c0 == 'v' && (sep1 || c1 == 't' || c1 == 'n'))
+				{
+					if (sinceCheckpoint >= GroupIndex::CheckpointInterval)
+					{
+						IndexCheckpoint cp;
+						cp.Offset = start;
+						cp.Positions = positions;
+						cp.TCoords = tcoords;
+						cp.Normals = normals;
+						index.Checkpoints.push_back(cp);
+						sinceCheckpoint = 0;
+					}
+					sinceCheckpoint++;
+
+					if (sep1)
+						positions++;
+					else if (c1 == 't')
+						tcoords++;
+					else
+						normals++;
+				}
+				else if (c0 == 'f' && sep1)
+				{
+					faces = true;
+				}
+				else if (c0 == 'o' || c0 == 'g' || c0 == 'u' || c0 == 'm' || buffer[start] == 'g')
+				{
+					size_t linepos = start;
+					NextLine(buffer, linepos, line);
+					std::string token = algorithm::firstToken(line);
+					if (token == "o" || token == "g" || line[0] == 'g' || token == "usemtl")
+					{
+						// Close the current span, spans without faces are dropped.
+						//	The material stays set across groups, as in the OBJ format.
+						span.End = uint64_t(start);
+						if (faces)
+						{
+							span.MeshName = namer.Next(group, token == "usemtl");
+							index.Spans.push_back(span);
+						}
+						faces = false;
+
+						span.Begin = uint64_t(std::min(pos, buffer.size()));
+						span.Positions = positions;
+						span.TCoords = tcoords;
+						span.Normals = normals;
+						if (token == "usemtl")
+							span.Material = algorithm::tail(line);
+						else
+							group = span.Name = (token == "o" || token == "g") ? algorithm::tail(line) : "unnamed";
+					}
+					else if (token == "mtllib")
+					{
+						index.MaterialFiles.push_back(MaterialPath(Path, algorithm::tail(line)));
+					}
+				}
+			}
+			span.End = uint64_t(buffer.size());
+			if (faces)
+			{
+				span.MeshName = namer.Next(group, false);
+				index.Spans.push_back(span);
+			}
+			return true;
+		}
+
+		// Save a group index next to the .obj file
+		//
+		// Like the mesh cache, it stores the size and modification
+		// time of SourcePath so that LoadIndex can reject it once
+		// the .obj changes
+		bool SaveIndex(std::string Path, std::string SourcePath, const GroupIndex& index)
+		{
+			std::vector<uint8_t> out;
+			codec::ByteWriter w(out);
+
+			uint64_t srcSize = 0, srcTime = 0;
+			codec::FileStamp(SourcePath, srcSize, srcTime);
+
+			w.PutU32(codec::IndexMagic);
+			w.PutU32(codec::IndexVersion);
+			w.PutU64(srcSize);
+			w.PutU64(srcTime);
+
+			w.PutVarint(uint32_t(index.MaterialFiles.size()));
+			for (const std::string& f : index.MaterialFiles)
+				w.PutString(f);
+
+			w.PutVarint(uint32_t(index.Spans.size()));
+			for (const GroupSpan& s : index.Spans)
+			{
+				w.PutString(s.Name);
+				w.PutString(s.Material);
+				w.PutString(s.MeshName);
+				w.PutU64(s.Begin);
+				w.PutU64(s.End);
+				w.PutVarint(s.Positions);
+				w.PutVarint(s.TCoords);
+				w.PutVarint(s.Normals);
+			}
+
+			w.PutVarint(uint32_t(index.Checkpoints.size()));
+			for (const IndexCheckpoint& c : index.Checkpoints)
+			{
+				w.PutU64(c.Offset);
+				w.PutVarint(c.Positions);
+				w.PutVarint(c.TCoords);
+				w.PutVarint(c.Normals);
+			}
+
+			std::ofstream file(Path, std::ios::binary);
+			if (!file.is_open())
+				return false;
+			file.write((const char*)out.data(), std::streamsize(out.size()));
+			return bool(file);
+		}
+
+		// Load a group index written by SaveIndex,
+		// false if it is missing, corrupt or stale
+		bool LoadIndex(std::string Path, std::string SourcePath, GroupIndex& index)
+		{
+			std::ifstream file(Path, std::ios::binary | std::ios::ate);
+			if (!file.is_open())
+				return false;
+
+			std::streamoff size = file.tellg();
+			if (size <= 0)
+				return false;
+			std::vector<uint8_t> data((size_t)size);
+			file.seekg(0);
+			if (!file.read((char*)data.data(), size))
+				return false;
+
+			codec::ByteReader r(data.data(), data.data() + data.size());
+			if (r.GetU32() != codec::IndexMagic || r.GetU32() != codec::IndexVersion)
+				return false;
+
+			uint64_t srcSize = r.GetU64();
+			uint64_t srcTime = r.GetU64();
+			uint64_t curSize, curTime;
+			if (!codec::FileStamp(SourcePath, curSize, curTime) || curSize != srcSize || curTime != srcTime)
+				return false;
+
+			GroupIndex result;
+			result.MaterialFiles.resize(r.GetCount());
+			for (std::string& f : result.MaterialFiles)
+				f = r.GetString();
+
+			result.Spans.resize(r.GetCount(codec::MinSpanBytes));
+			for (GroupSpan& s : result.Spans)
+			{
+				s.Name = r.GetString();
+				s.Material = r.GetString();
+				s.MeshName = r.GetString();
+				s.Begin = r.GetU64();
+				s.End = r.GetU64();
+				s.Positions = r.GetVarint();
+				s.TCoords = r.GetVarint();
+				s.Normals = r.GetVarint();
+				if (s.End < s.Begin || s.End > curSize)
+					return false;
+			}
+
+			result.Checkpoints.resize(r.GetCount(codec::MinCheckpointBytes));
+			for (IndexCheckpoint& c : result.Checkpoints)
+			{
+				c.Offset = r.GetU64();
+				c.Positions = r.GetVarint();
+				c.TCoords = r.GetVarint();
+				c.Normals = r.GetVarint();
+			}
+			if (!r.Ok)
+				return false;
+
+			index = std::move(result);
+			return true;
+		}
+
+		// Load a single group of an OBJ file
+		//
+		// Uses the index in Path + ".idx", building it first if it
+		// is missing or stale. Only the byte ranges of the group are
+		// parsed; vertices it uses from elsewhere in the file are
+		// read starting at the nearest checkpoint. Every span with
+		// the name is loaded, in file order, as its own mesh: one per
+		// usemtl split and one per place the group is reopened. The
+		// meshes get the names LoadFile gives them (GroupSpan::MeshName),
+		// so FindMesh and name matching agree between the two paths.
+		bool LoadGroup(std::string Path, std::string Name)
+		{
+			GroupIndex index;
+			const std::string indexPath = Path + ".idx";
+			if (!LoadIndex(indexPath, Path, index))
+			{
+				if (!BuildIndex(Path, index))
+					return false;
+				SaveIndex(indexPath, Path, index);
+			}
+
+			std::ifstream file(Path, std::ios::binary);
+			if (!file.is_open())
+				return false;
+
+			stats::ScopedLoad load(Stats);
+
+			LoadedMeshes.clear();
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			LoadedMaterials.clear();
+			Pool.Clear();
+			MaterialFiles = index.MaterialFiles;
+
+			{
+				OBJL_PHASE(Stats, PhaseMaterials);
+				for (const std::string& f : MaterialFiles)
+					LoadMaterials(f);
+			}
+
+			for (const GroupSpan& span : index.Spans)
+			{
+				if (span.Name != Name)
+					continue;
+				if (!LoadSpan(file, index, span))
+					return false;
+			}
+
+			PostProcess();
+
+			if (Options.PooledMeshes)
+				PackPool();
+
+			if (Options.HashMeshes)
+				HashMeshes();
+
+			return !LoadedMeshes.empty();
+		}
+
+		// Find a loaded mesh by name. With LoaderOptions::DetectInstances
+		//	a mesh folded into another one is found by its name in
+		//	Mesh::InstanceNames; instance then receives its index in
+		//	InstanceOffsets (0 for a mesh found by MeshName). Returns
+		//	nullptr if no mesh has the name.
+		Mesh* FindMesh(const std::string& Name, size_t* instance = nullptr)
+		{
+			for (Mesh& mesh : LoadedMeshes)
+			{
+				if (mesh.MeshName == Name)
+				{
+					if (instance)
+						*instance = 0;
+					return &mesh;
+				}
+				for (size_t i = 1; i < mesh.InstanceNames.size(); i++)
+				{
+					if (mesh.InstanceNames[i] == Name)
+					{
+						if (instance)
+							*instance = i;
+						return &mesh;
+					}
+				}
+			}
+			return nullptr;
+		}
+
+		// Loaded Mesh Objects
+		std::vector<Mesh> LoadedMeshes;
+		// Loaded Vertex Objects
+		std::vector<Vertex> LoadedVertices;
+		// Loaded Index Positions
+		std::vector<unsigned int> LoadedIndices;
+		// Loaded Material Objects
+		std::vector<Material> LoadedMaterials;
+		// Vertices and indices of all meshes with LoaderOptions::PooledMeshes
+		MeshPool Pool;
+		// Loading options, set before LoadFile
+		LoaderOptions Options;
+		// Paths of the .mtl files referenced by mtllib
+		std::vector<std::string> MaterialFiles;
+		// Statistics of the last SaveCache or LoadCache
+		codec::Stats CacheStats;
+		// Instrumentation of the last LoadFile or LoadCache
+		stats::LoadStats Stats;
+
+	private:
+		// True if PostProcess has anything to do
+		bool NeedsPostProcess() const
+		{
+			return Options.CleanMeshes || Options.SortTrianglesMorton || Options.DetectInstances;
+		}
+
+		// Add a finished mesh to LoadedMeshes. The arrays are moved into
+		//	the mesh, or with pooled appended to Pool and cleared, keeping
+		//	their capacity for the next mesh, so that no allocation per
+		//	mesh remains.
+		Mesh& AddMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, bool pooled)
+		{
+			if (!pooled)
+			{
+				LoadedMeshes.emplace_back(std::move(vertices), std::move(indices));
+				return LoadedMeshes.back();
+			}
+
+			LoadedMeshes.emplace_back();
+			Mesh& mesh = LoadedMeshes.back();
+			mesh.InPool = true;
+			mesh.VertexOffset = (unsigned int)Pool.Vertices.size();
+			mesh.VertexCount = (unsigned int)vertices.size();
+			mesh.IndexOffset = (unsigned int)Pool.Indices.size();
+			mesh.IndexCount = (unsigned int)indices.size();
+			Pool.Vertices.insert(Pool.Vertices.end(), vertices.begin(), vertices.end());
+			Pool.Indices.insert(Pool.Indices.end(), indices.begin(), indices.end());
+			vertices.clear();
+			indices.clear();
+			return mesh;
+		}
+
+		// Fill Mesh::SourceHash of every mesh, in the pool or not
+		void HashMeshes()
+		{
+			for (Mesh& m : LoadedMeshes)
+			{
+				if (m.InPool)
+					m.SourceHash = algorithm::HashMesh(m, Pool.Vertices.data() + m.VertexOffset, m.VertexCount,
+						Pool.Indices.data() + m.IndexOffset, m.IndexCount);
+				else
+					m.SourceHash = algorithm::HashMesh(m);
+			}
+		}
+
+		// Move the arrays of every mesh that is not in the pool yet into it
+		void PackPool()
+		{
+			OBJL_PHASE(Stats, PhaseMeshCopy);
+
+			size_t vertices = Pool.Vertices.size(), indices = Pool.Indices.size();
+			for (const Mesh& m : LoadedMeshes)
+			{
+				vertices += m.Vertices.size();
+				indices += m.Indices.size();
+			}
+			Pool.Vertices.reserve(vertices);
+			Pool.Indices.reserve(indices);
+
+			for (Mesh& m : LoadedMeshes)
+			{
+				if (m.InPool)
+					continue;
+				m.InPool = true;
+				m.VertexOffset = (unsigned int)Pool.Vertices.size();
+				m.VertexCount = (unsigned int)m.Vertices.size();
+				m.IndexOffset = (unsigned int)Pool.Indices.size();
+				m.IndexCount = (unsigned int)m.Indices.size();
+				Pool.Vertices.insert(Pool.Vertices.end(), m.Vertices.begin(), m.Vertices.end());
+				Pool.Indices.insert(Pool.Indices.end(), m.Indices.begin(), m.Indices.end());
+				std::vector<Vertex>().swap(m.Vertices);
+				std::vector<unsigned int>().swap(m.Indices);
+			}
+		}
+
+		// Optional passes over the finished meshes, see LoaderOptions
+		void PostProcess()
+		{
+			OBJL_PHASE(Stats, PhasePostProcess);
+
+			// First, so the later passes only see real triangles
+			if (Options.CleanMeshes)
+			{
+				for (Mesh& mesh : LoadedMeshes)
+				{
+					algorithm::CleanupResult removed = algorithm::CleanMesh(mesh, Options.DegenerateArea);
+					Stats.RemovedDegenerate += removed.DegenerateTriangles;
+					Stats.RemovedDuplicates += removed.DuplicateTriangles;
+					Stats.RemovedVertices += removed.UnusedVertices;
+				}
+
+				// A mesh without triangles is dropped altogether
+				LoadedMeshes.erase(std::remove_if(LoadedMeshes.begin(), LoadedMeshes.end(),
+					[](const Mesh& m) { return m.Indices.empty(); }), LoadedMeshes.end());
+			}
+
+			if (Options.SortTrianglesMorton)
+			{
+				double before = 0.0, after = 0.0, weight = 0.0;
+				for (Mesh& mesh : LoadedMeshes)
+				{
+					double tris = double(mesh.Indices.size() / 3);
+					before += algorithm::TriangleLocality(mesh) * tris;
+					algorithm::MortonSortTriangles(mesh);
+					after += algorithm::TriangleLocality(mesh) * tris;
+					weight += tris;
+				}
+				if (weight > 0.0)
+				{
+					Stats.LocalityBefore = before / weight;
+					Stats.LocalityAfter = after / weight;
+				}
+
+			}
+
+			// After the sort: copies get the same order (up to rounding),
+			//	so their vertex lists still line up
+			if (Options.DetectInstances)
+			{
+				Stats.FoldedInstances = algorithm::DetectInstances(LoadedMeshes, Options.InstanceTolerance);
+			}
+
+			// The combined lists are rebuilt from the changed meshes;
+			//	with instancing they hold the centred prototypes only
+			if (Options.KeepCombinedLists && NeedsPostProcess())
+				RebuildCombinedLists();
+		}
+
+		// Fill LoadedVertices / LoadedIndices from LoadedMeshes
+		void RebuildCombinedLists()
+		{
+			LoadedVertices.clear();
+			LoadedIndices.clear();
+			for (const Mesh& m : LoadedMeshes)
+			{
+				unsigned int base = (unsigned int)LoadedVertices.size();
+				LoadedVertices.insert(LoadedVertices.end(), m.Vertices.begin(), m.Vertices.end());
+				for (unsigned int i : m.Indices)
+					LoadedIndices.push_back(base + i);
+			}
+		}
+
+		// Path of a material library named in an mtllib line,
+		//	relative to the directory of the .obj file and resolved
+		//	through Options.ResolveFile when one is set
+		std::string MaterialPath(const std::string& objPath, const std::string& name) const
+		{
+			size_t slash = objPath.find_last_of("/\\");
+			std::string pathtomat = slash == std::string::npos ? name : objPath.substr(0, slash + 1) + name;
 
-				// Generate a Mesh Object or Prepare for an object to be created
-				if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g" || curline[0] == 'g')
+			std::string resolved;
+			if (Options.ResolveFile && Options.ResolveFile(pathtomat, resolved))
+				return resolved;
+			return pathtomat;
+		}
+
+		// Read the lines [begin, end) of an open file
+		static bool ReadRange(std::ifstream& file, uint64_t begin, uint64_t end, std::string& buffer)
+		{
+			buffer.resize(size_t(end - begin));
+			if (buffer.empty())
+				return true;
+			file.clear();
+			file.seekg(std::streamoff(begin));
+			return bool(file.read(&buffer[0], std::streamsize(buffer.size())));
+		}
+
+		// File position (0-based) of every v/vt/vn reference of an f line.
+		//	count holds the records read so far, for negative indices.
+		//	Unused slots (v//vn) are -1.
+		static void FaceReferences(const std::string& line, const uint32_t count[3], std::vector<long>& refs)
+		{
+			std::vector<std::string> sface, svert;
+			algorithm::split(algorithm::tail(line), sface, " ");
+
+			refs.clear();
+			for (const std::string& corner : sface)
+			{
+				algorithm::split(corner, svert, "/");
+				for (size_t k = 0; k < 3; k++)
 				{
-					if (!listening)
+					long at = -1;
+					if (k < svert.size() && !svert[k].empty())
 					{
-						listening = true;
-
-						if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g")
-						{
-							meshname = algorithm::tail(curline);
-						}
-						else
-						{
-							meshname = "unnamed";
-						}
+						long idx = std::stol(svert[k]);
+						at = idx > 0 ? idx - 1 : long(count[k]) + idx;
 					}
-					else
-					{
-						// Generate the mesh to put into the array
+					refs.push_back(at);
+				}
+			}
+		}
 
-						if (!Indices.empty() && !Vertices.empty())
-						{
-							// Create Mesh
-							tempMesh = Mesh(Vertices, Indices);
-							tempMesh.MeshName = meshname;
+		// Parse one span of a group, see LoadGroup
+		//
+		// The vertex arrays hold the records the faces use from before
+		// the span first, then the records of the span; face indices
+		// are rewritten to match before GenVerticesFromRawOBJ sees them
+		bool LoadSpan(std::ifstream& file, const GroupIndex& index, const GroupSpan& span)
+		{
+			std::string buffer;
+			{
+				OBJL_PHASE(Stats, PhaseTokenize);
+				if (!ReadRange(file, span.Begin, span.End, buffer))
+					return false;
+			}
+			Stats.BytesRead += buffer.size();
 
-							// Insert Mesh
-							LoadedMeshes.push_back(tempMesh);
+			const uint32_t before[3] = { span.Positions, span.TCoords, span.Normals };
 
-							// Cleanup
-							Vertices.clear();
-							Indices.clear();
-							meshname.clear();
+			// First pass: records from before the span the faces refer to,
+			//	numbered in the order of their file positions
+			std::unordered_map<uint32_t, uint32_t> outside[3];
+			std::vector<long> refs;
+			std::string curline, token;
+			{
+				OBJL_PHASE(Stats, PhaseTokenize);
 
-							meshname = algorithm::tail(curline);
-						}
-						else
+				uint32_t count[3] = { before[0], before[1], before[2] };
+				std::vector<uint32_t> needed[3];
+				size_t pos = 0;
+				while (pos < buffer.size())
+				{
+					NextLine(buffer, pos, curline);
+					token = algorithm::firstToken(curline);
+					if (token == "v")
+						count[0]++;
+					else if (token == "vt")
+						count[1]++;
+					else if (token == "vn")
+						count[2]++;
+					else if (token == "f")
+					{
+						FaceReferences(curline, count, refs);
+						for (size_t r = 0; r < refs.size(); r++)
 						{
-							if (algorithm::firstToken(curline) == "o" || algorithm::firstToken(curline) == "g")
-							{
-								meshname = algorithm::tail(curline);
-							}
-							else
-							{
-								meshname = "unnamed";
-							}
+							if (refs[r] >= 0 && refs[r] < long(before[r % 3]))
+								needed[r % 3].push_back(uint32_t(refs[r]));
 						}
 					}
-					#ifdef OBJL_CONSOLE_OUTPUT
-					std::cout << std::endl;
-					outputIndicator = 0;
-					#endif
 				}
-				// Generate a Vertex Position
-				if (algorithm::firstToken(curline) == "v")
-				{
-					std::vector<std::string> spos;
-					Vector3 vpos;
-					algorithm::split(algorithm::tail(curline), spos, " ");
 
-					vpos.X = std::stof(spos[0]);
-					vpos.Y = std::stof(spos[1]);
-					vpos.Z = std::stof(spos[2]);
-
-					Positions.push_back(vpos);
-				}
-				// Generate a Vertex Texture Coordinate
-				if (algorithm::firstToken(curline) == "vt")
+				for (int k = 0; k < 3; k++)
 				{
-					std::vector<std::string> stex;
-					Vector2 vtex;
-					algorithm::split(algorithm::tail(curline), stex, " ");
-
-					vtex.X = std::stof(stex[0]);
-					vtex.Y = std::stof(stex[1]);
-
-					TCoords.push_back(vtex);
+					std::sort(needed[k].begin(), needed[k].end());
+					needed[k].erase(std::unique(needed[k].begin(), needed[k].end()), needed[k].end());
+					for (uint32_t i = 0; i < (uint32_t)needed[k].size(); i++)
+						outside[k][needed[k][i]] = i;
 				}
-				// Generate a Vertex Normal;
-				if (algorithm::firstToken(curline) == "vn")
-				{
-					std::vector<std::string> snor;
-					Vector3 vnor;
-					algorithm::split(algorithm::tail(curline), snor, " ");
+			}
 
-					vnor.X = std::stof(snor[0]);
-					vnor.Y = std::stof(snor[1]);
-					vnor.Z = std::stof(snor[2]);
+			std::vector<Vector3> Positions(outside[0].size());
+			std::vector<Vector2> TCoords(outside[1].size());
+			std::vector<Vector3> Normals(outside[2].size());
 
-					Normals.push_back(vnor);
-				}
-				// Generate a Face (vertices & indices)
-				if (algorithm::firstToken(curline) == "f")
-				{
-					// Generate the vertices
-					std::vector<Vertex> vVerts;
-					GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, curline);
+			// Fetch them: each record lies between the last checkpoint
+			//	at or before it and the next one, read every such
+			//	interval once. Checkpoints are sorted by offset and so
+			//	by each record count, both searches are binary.
+			if (!outside[0].empty() || !outside[1].empty() || !outside[2].empty())
+			{
+				const std::vector<IndexCheckpoint>& cps = index.Checkpoints;
+				auto limit = std::lower_bound(cps.begin(), cps.end(), span.Begin,
+					[](const IndexCheckpoint& cp, uint64_t offset) { return cp.Offset < offset; });
 
-					// Add Vertices
-					for (int i = 0; i < int(vVerts.size()); i++)
+				std::vector<size_t> intervals;
+				for (int k = 0; k < 3; k++)
+				{
+					for (const auto& rec : outside[k])
 					{
-						Vertices.push_back(vVerts[i]);
-
-						LoadedVertices.push_back(vVerts[i]);
+						auto next = std::upper_bound(cps.begin(), limit, rec.first,
+							[k](uint32_t record, const IndexCheckpoint& cp)
+							{
+								return record < (k == 0 ? cp.Positions : k == 1 ? cp.TCoords : cp.Normals);
+							});
+						intervals.push_back(next == cps.begin() ? 0 : size_t(next - cps.begin()) - 1);
 					}
+				}
+				std::sort(intervals.begin(), intervals.end());
+				intervals.erase(std::unique(intervals.begin(), intervals.end()), intervals.end());
 
-					std::vector<unsigned int> iIndices;
-
-					VertexTriangluation(iIndices, vVerts);
-
-					// Add Indices
-					for (int i = 0; i < int(iIndices.size()); i++)
+				std::string range;
+				std::vector<std::string> sval;
+				for (size_t c : intervals)
+				{
+					if (c >= index.Checkpoints.size())
+						return false;
+					const IndexCheckpoint& cp = index.Checkpoints[c];
+					uint64_t end = c + 1 < index.Checkpoints.size() ? index.Checkpoints[c + 1].Offset : span.Begin;
+					end = std::min(end, span.Begin);
 					{
-						unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
-						Indices.push_back(indnum);
-
-						indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
-						LoadedIndices.push_back(indnum);
-
+						OBJL_PHASE(Stats, PhaseTokenize);
+						if (!ReadRange(file, cp.Offset, end, range))
+							return false;
 					}
-				}
-				// Get Mesh Material Name
-				if (algorithm::firstToken(curline) == "usemtl")
-				{
-					MeshMatNames.push_back(algorithm::tail(curline));
+					Stats.BytesRead += range.size();
 
-					// Create new Mesh, if Material changes within a group
-					if (!Indices.empty() && !Vertices.empty())
+					uint32_t at[3] = { cp.Positions, cp.TCoords, cp.Normals };
+					size_t pos = 0;
+					while (pos < range.size())
 					{
-						// Create Mesh
-						tempMesh = Mesh(Vertices, Indices);
-						tempMesh.MeshName = meshname;
-						int i = 2;
-						while(1) {
-							tempMesh.MeshName = meshname + "_" + std::to_string(i);
-
-							for (auto &m : LoadedMeshes)
-								if (m.MeshName == tempMesh.MeshName)
-									continue;
-							break;
+						{
+							OBJL_PHASE(Stats, PhaseTokenize);
+							NextLine(range, pos, curline);
+							token = algorithm::firstToken(curline);
 						}
+						int k = token == "v" ? 0 : token == "vt" ? 1 : token == "vn" ? 2 : -1;
+						if (k < 0)
+							continue;
+						auto slot = outside[k].find(at[k]++);
+						if (slot == outside[k].end())
+							continue;
 
-						// Insert Mesh
-						LoadedMeshes.push_back(tempMesh);
-
-						// Cleanup
-						Vertices.clear();
-						Indices.clear();
+						{
+							OBJL_PHASE(Stats, PhaseTokenize);
+							algorithm::split(algorithm::tail(curline), sval, " ");
+						}
+						OBJL_PHASE(Stats, PhaseParseFloat);
+						ParseVertexRecord(k, sval, slot->second, Positions, TCoords, Normals);
 					}
-
-					#ifdef OBJL_CONSOLE_OUTPUT
-					outputIndicator = 0;
-					#endif
 				}
-				// Load Materials
-				if (algorithm::firstToken(curline) == "mtllib")
-				{
-					// Generate LoadedMaterial
-
-					// Generate a path to the material file
-					std::vector<std::string> temp;
-					algorithm::split(Path, temp, "/");
+			}
 
-					std::string pathtomat = "";
+			// Second pass: the span itself
+			std::vector<Vertex> Vertices;
+			std::vector<unsigned int> Indices;
+			std::vector<Vertex> vVerts;
+			std::vector<unsigned int> iIndices;
+			std::vector<std::string> sval;
+			{
+				uint32_t count[3] = { before[0], before[1], before[2] };
+				size_t pos = 0;
+				while (pos < buffer.size())
+				{
+					{
+						OBJL_PHASE(Stats, PhaseTokenize);
+						NextLine(buffer, pos, curline);
+						token = algorithm::firstToken(curline);
+					}
 
-					if (temp.size() != 1)
+					int k = token == "v" ? 0 : token == "vt" ? 1 : token == "vn" ? 2 : -1;
+					if (k >= 0)
 					{
-						for (int i = 0; i < temp.size() - 1; i++)
 						{
-							pathtomat += temp[i] + "/";
+							OBJL_PHASE(Stats, PhaseTokenize);
+							algorithm::split(algorithm::tail(curline), sval, " ");
 						}
+						OBJL_PHASE(Stats, PhaseParseFloat);
+						size_t slot = outside[k].size() + (count[k]++ - before[k]);
+						ParseVertexRecord(k, sval, slot, Positions, TCoords, Normals);
 					}
+					else if (token == "f")
+					{
+						OBJL_COUNT(Stats, RecordFace);
+						OBJL_PHASE(Stats, PhaseFaceAssembly);
+
+						// Rewrite the face with indices into the arrays above.
+						//	Trailing empty slots are dropped again, so a corner
+						//	keeps its v, v/vt, v//vn or v/vt/vn form.
+						FaceReferences(curline, count, refs);
+						std::string face = "f";
+						for (size_t r = 0; r < refs.size(); r++)
+						{
+							const int a = int(r % 3);
+							if (a == 0)
+							{
+								while (face.back() == '/')
+									face.pop_back();
+								face += ' ';
+							}
+							else
+							{
+								face += '/';
+							}
+							if (refs[r] < 0)
+								continue;
+							uint32_t at = uint32_t(refs[r]);
+							uint32_t local;
+							if (at < before[a])
+								local = outside[a][at];
+							else if (at < count[a])
+								local = uint32_t(outside[a].size()) + (at - before[a]);
+							else
+								return false; // refers to a record after the line
+							face += std::to_string(local + 1);
+						}
+						while (face.back() == '/')
+							face.pop_back();
 
+						vVerts.clear();
+						GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, face);
 
-					pathtomat += algorithm::tail(curline);
-
-					#ifdef OBJL_CONSOLE_OUTPUT
-					std::cout << std::endl << "- find materials in: " << pathtomat << std::endl;
-					#endif
+						iIndices.clear();
+						VertexTriangluation(iIndices, vVerts);
 
-					// Load Materials
-					LoadMaterials(pathtomat);
+						unsigned int first = (unsigned int)Vertices.size();
+						Vertices.insert(Vertices.end(), vVerts.begin(), vVerts.end());
+						for (unsigned int i : iIndices)
+							Indices.push_back(first + i);
+					}
 				}
 			}
 
-			#ifdef OBJL_CONSOLE_OUTPUT
-			std::cout << std::endl;
-			#endif
+			if (Indices.empty())
+				return true;
 
-			// Deal with last mesh
+			LoadedMeshes.emplace_back(std::move(Vertices), std::move(Indices));
+			Mesh& mesh = LoadedMeshes.back();
+			mesh.MeshName = span.MeshName;
+			for (const Material& m : LoadedMaterials)
+			{
+				if (m.name == span.Material)
+				{
+					mesh.MeshMaterial = m;
+					break;
+				}
+			}
 
-			if (!Indices.empty() && !Vertices.empty())
+			if (Options.KeepCombinedLists)
 			{
-				// Create Mesh
-				tempMesh = Mesh(Vertices, Indices);
-				tempMesh.MeshName = meshname;
+				unsigned int first = (unsigned int)LoadedVertices.size();
+				LoadedVertices.insert(LoadedVertices.end(), mesh.Vertices.begin(), mesh.Vertices.end());
+				for (unsigned int i : mesh.Indices)
+					LoadedIndices.push_back(first + i);
+			}
+			return true;
+		}
 
-				// Insert Mesh
-				LoadedMeshes.push_back(tempMesh);
+		// Store the split values of a v (k = 0), vt (1) or vn (2)
+		//	record at the given slot of its array, growing it if needed
+		void ParseVertexRecord(int k, const std::vector<std::string>& sval, size_t slot,
+			std::vector<Vector3>& Positions, std::vector<Vector2>& TCoords, std::vector<Vector3>& Normals)
+		{
+			if (k == 0)
+			{
+				OBJL_COUNT(Stats, RecordVertex);
+				algorithm::requireValues(sval, 3, "v");
+				if (slot >= Positions.size())
+					Positions.resize(slot + 1);
+				Positions[slot] = Vector3(std::stof(sval[0]), std::stof(sval[1]), std::stof(sval[2]));
+			}
+			else if (k == 1)
+			{
+				OBJL_COUNT(Stats, RecordTexCoord);
+				algorithm::requireValues(sval, 2, "vt");
+				if (slot >= TCoords.size())
+					TCoords.resize(slot + 1);
+				TCoords[slot] = Vector2(std::stof(sval[0]), std::stof(sval[1]));
+			}
+			else
+			{
+				OBJL_COUNT(Stats, RecordNormal);
+				algorithm::requireValues(sval, 3, "vn");
+				if (slot >= Normals.size())
+					Normals.resize(slot + 1);
+				Normals[slot] = Vector3(std::stof(sval[0]), std::stof(sval[1]), std::stof(sval[2]));
 			}
+		}
 
-			file.close();
+		// Structure: RecordCounts
+		//
+		// Description: Record counts of an OBJ file, used to size
+		//	the arrays before parsing. A segment is the run of faces
+		//	between two o/g/usemtl lines, i.e. at most one mesh.
+		struct RecordCounts
+		{
+			struct Segment
+			{
+				Segment()
+				{
+					Vertices = 0;
+					Indices = 0;
+				}
+				size_t Vertices;
+				size_t Indices;
+			};
 
-			// Set Materials for each Mesh
-			for (int i = 0; i < MeshMatNames.size(); i++)
+			RecordCounts()
 			{
-				std::string matname = MeshMatNames[i];
+				Positions = 0;
+				TCoords = 0;
+				Normals = 0;
+				FaceVertices = 0;
+				TriangleIndices = 0;
+				Segments.resize(1);
+			}
 
-				// Find corresponding material name in loaded materials
-				// when found copy material variables into mesh material
-				for (int j = 0; j < LoadedMaterials.size(); j++)
+			size_t Positions;
+			size_t TCoords;
+			size_t Normals;
+			size_t FaceVertices;
+			size_t TriangleIndices;
+			std::vector<Segment> Segments;
+		};
+
+		// Copy the line starting at pos into line (without the
+		//	line break) and move pos to the start of the next line
+		static void NextLine(const std::string& buffer, size_t& pos, std::string& line)
+		{
+			size_t eol = buffer.find('\n', pos);
+			if (eol == std::string::npos)
+				eol = buffer.size();
+			size_t end = eol;
+			if (end > pos && buffer[end - 1] == '\r')
+				end--;
+			line.assign(buffer, pos, end - pos);
+			pos = eol + 1;
+		}
+
+		// Count the records of a whole OBJ file. Uses the same
+		//	rules as LoadFile to find the mesh boundaries.
+		static void CountRecords(const std::string& buffer, RecordCounts& counts)
+		{
+			std::string line;
+			size_t pos = 0;
+			while (pos < buffer.size())
+			{
+				size_t start = pos;
+				size_t eol = buffer.find('\n', pos);
+				if (eol == std::string::npos)
+					eol = buffer.size();
+				pos = eol + 1;
+
+				const char* p = buffer.data() + start;
+				const char* end = buffer.data() + eol;
+				while (p < end && (*p == ' ' || *p == '\t'))
+					p++;
+				if (p == end)
+					continue;
+
+				const char c0 = p[0];
+				const char c1 = p + 1 < end ? p[1] : ' ';
+				const bool sep1 = (c1 == ' ' || c1 == '\t' || c1 == '\r');
+
+				if (c0 == 'v' && sep1)
+				{
+					counts.Positions++;
+				}
+				else if (c0 == 'v' && (c1 == 't' || c1 == 'n'))
+				{
+					if (c1 == 't')
+						counts.TCoords++;
+					else
+						counts.Normals++;
+				}
+				else if (c0 == 'f' && sep1)
 				{
-					if (LoadedMaterials[j].name == matname)
+					// Count the vertex references of the face
+					size_t k = 0;
+					bool inword = false;
+					for (const char* q = p + 1; q < end; q++)
 					{
-						LoadedMeshes[i].MeshMaterial = LoadedMaterials[j];
-						break;
+						bool space = (*q == ' ' || *q == '\t' || *q == '\r');
+						if (!space && !inword)
+							k++;
+						inword = !space;
 					}
+					size_t tris = k >= 3 ? (k - 2) * 3 : 0;
+					counts.FaceVertices += k;
+					counts.TriangleIndices += tris;
+					counts.Segments.back().Vertices += k;
+					counts.Segments.back().Indices += tris;
+				}
+				else if (c0 == 'o' || c0 == 'g' || c0 == 'u' || buffer[start] == 'g')
+				{
+					line.assign(buffer, start, eol - start);
+					if (!line.empty() && line.back() == '\r')
+						line.pop_back();
+					std::string token = algorithm::firstToken(line);
+					if (token == "o" || token == "g" || line[0] == 'g' || token == "usemtl")
+						counts.Segments.push_back(RecordCounts::Segment());
 				}
 			}
+		}
 
-			if (LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty())
-			{
-				return false;
-			}
-			else
+		// Move on to the next segment; an empty current mesh
+		//	is sized for the faces of that segment
+		static void NextSegment(const RecordCounts& counts, size_t& segment,
+			std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+		{
+			if (segment + 1 < counts.Segments.size())
+				segment++;
+			if (vertices.empty() && indices.empty())
 			{
-				return true;
+				vertices.reserve(counts.Segments[segment].Vertices);
+				indices.reserve(counts.Segments[segment].Indices);
 			}
 		}
 
-		// Loaded Mesh Objects
-		std::vector<Mesh> LoadedMeshes;
-		// Loaded Vertex Objects
-		std::vector<Vertex> LoadedVertices;
-		// Loaded Index Positions
-		std::vector<unsigned int> LoadedIndices;
-		// Loaded Material Objects
-		std::vector<Material> LoadedMaterials;
-
-	private:
 		// Generate vertices from a list of positions, 
 		//	tcoords, normals and a face line
 		void GenVerticesFromRawOBJ(std::vector<Vertex>& oVerts,
@@ -1021,10 +3812,16 @@ namespace objl
 
 			// Go through each line looking for material variables
 			std::string curline;
+			std::string token;
 			while (std::getline(file, curline))
 			{
+				// Strip the CR of files with Windows line endings
+				if (!curline.empty() && curline.back() == '\r')
+					curline.pop_back();
+				token = algorithm::firstToken(curline);
+
 				// new material and material name
-				if (algorithm::firstToken(curline) == "newmtl")
+				if (token == "newmtl")
 				{
 					if (!listening)
 					{
@@ -1060,7 +3857,7 @@ namespace objl
 					}
 				}
 				// Ambient Color
-				if (algorithm::firstToken(curline) == "Ka")
+				if (token == "Ka")
 				{
 					std::vector<std::string> temp;
 					algorithm::split(algorithm::tail(curline), temp, " ");
@@ -1073,7 +3870,7 @@ namespace objl
 					tempMaterial.Ka.Z = std::stof(temp[2]);
 				}
 				// Diffuse Color
-				if (algorithm::firstToken(curline) == "Kd")
+				if (token == "Kd")
 				{
 					std::vector<std::string> temp;
 					algorithm::split(algorithm::tail(curline), temp, " ");
@@ -1086,7 +3883,7 @@ namespace objl
 					tempMaterial.Kd.Z = std::stof(temp[2]);
 				}
 				// Specular Color
-				if (algorithm::firstToken(curline) == "Ks")
+				if (token == "Ks")
 				{
 					std::vector<std::string> temp;
 					algorithm::split(algorithm::tail(curline), temp, " ");
@@ -1099,55 +3896,66 @@ namespace objl
 					tempMaterial.Ks.Z = std::stof(temp[2]);
 				}
 				// Specular Exponent
-				if (algorithm::firstToken(curline) == "Ns")
+				if (token == "Ns")
 				{
 					tempMaterial.Ns = std::stof(algorithm::tail(curline));
 				}
 				// Optical Density
-				if (algorithm::firstToken(curline) == "Ni")
+				if (token == "Ni")
 				{
 					tempMaterial.Ni = std::stof(algorithm::tail(curline));
 				}
 				// Dissolve
-				if (algorithm::firstToken(curline) == "d")
+				if (token == "d")
 				{
 					tempMaterial.d = std::stof(algorithm::tail(curline));
 				}
 				// Illumination
-				if (algorithm::firstToken(curline) == "illum")
+				if (token == "illum")
 				{
 					tempMaterial.illum = std::stoi(algorithm::tail(curline));
 				}
 				// Ambient Texture Map
-				if (algorithm::firstToken(curline) == "map_Ka")
+				if (token == "map_Ka")
 				{
 					tempMaterial.map_Ka = algorithm::tail(curline);
 				}
 				// Diffuse Texture Map
-				if (algorithm::firstToken(curline) == "map_Kd")
+				if (token == "map_Kd")
 				{
 					tempMaterial.map_Kd = algorithm::tail(curline);
 				}
 				// Specular Texture Map
-				if (algorithm::firstToken(curline) == "map_Ks")
+				if (token == "map_Ks")
 				{
 					tempMaterial.map_Ks = algorithm::tail(curline);
 				}
 				// Specular Hightlight Map
-				if (algorithm::firstToken(curline) == "map_Ns")
+				if (token == "map_Ns")
 				{
 					tempMaterial.map_Ns = algorithm::tail(curline);
 				}
 				// Alpha Texture Map
-				if (algorithm::firstToken(curline) == "map_d")
+				if (token == "map_d")
 				{
 					tempMaterial.map_d = algorithm::tail(curline);
 				}
 				// Bump Map
-				if (algorithm::firstToken(curline) == "map_Bump" || algorithm::firstToken(curline) == "map_bump" || algorithm::firstToken(curline) == "bump")
+				if (token == "map_Bump" || token == "map_bump" || token == "bump")
 				{
 					tempMaterial.map_bump = algorithm::tail(curline);
 				}
+				// Texture Size Limit (extension, not part of the MTL spec).
+				//	A value that is not a whole number is ignored: the
+				//	material then has no limit of its own
+				if (token == "map_max_size")
+				{
+					std::string value = algorithm::tail(curline);
+					char* end = nullptr;
+					long size = std::strtol(value.c_str(), &end, 10);
+					bool valid = !value.empty() && *end == '\0' && size >= INT_MIN && size <= INT_MAX;
+					tempMaterial.map_max_size = valid ? int(size) : 0;
+				}
 			}
 
 			// Deal with last material
@@ -1165,3 +3973,177 @@ namespace objl
 		}
 	};
 }
+
+#if defined(OBJL_ALLOC_TRACKING_IMPLEMENTATION) && !defined(OBJL_ALLOC_TRACKING_DEFINED)
+#define OBJL_ALLOC_TRACKING_DEFINED
+
+#ifdef _WIN32
+#include <malloc.h>
+#define OBJL_BLOCK_SIZE(p) _msize(p)
+#define OBJL_ALIGNED_BLOCK_SIZE(p, align) _aligned_msize(p, align, 0)
+#define OBJL_ALIGNED_MALLOC(size, align) _aligned_malloc(size, align)
+#define OBJL_ALIGNED_FREE(p) _aligned_free(p)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define OBJL_BLOCK_SIZE(p) malloc_size(p)
+#else
+#include <malloc.h>
+#define OBJL_BLOCK_SIZE(p) malloc_usable_size(p)
+#endif
+
+#ifndef _WIN32
+#define OBJL_ALIGNED_BLOCK_SIZE(p, align) OBJL_BLOCK_SIZE(p)
+#define OBJL_ALIGNED_FREE(p) std::free(p)
+#endif
+
+// Counting replacements of the global operator new/delete.
+// Blocks are plain malloc blocks, their size for the heap level is
+// asked from the allocator, and only inside a load scope.
+namespace objl
+{
+	namespace stats
+	{
+		inline void* TrackedMalloc(size_t size)
+		{
+			void* p = std::malloc(size ? size : 1);
+			if (p && ActiveAllocs())
+				TrackAlloc(size, OBJL_BLOCK_SIZE(p));
+			return p;
+		}
+
+		inline void TrackedFree(void* p)
+		{
+			if (p && ActiveAllocs())
+				TrackFree(OBJL_BLOCK_SIZE(p));
+			std::free(p);
+		}
+
+#ifdef __cpp_aligned_new
+		// Over-aligned blocks (alignas above __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+		//	come from the aligned heap on Windows, which free cannot
+		//	release, so they keep their own pair. Only with C++17 aligned
+		//	new (/std:c++17 on MSVC), before that such types use operator new
+		inline void* TrackedAlignedMalloc(size_t size, std::align_val_t alignment)
+		{
+			size_t align = size_t(alignment);
+			if (size == 0)
+				size = 1;
+#ifdef _WIN32
+			void* p = OBJL_ALIGNED_MALLOC(size, align);
+#else
+			void* p = nullptr;
+			if (align < sizeof(void*))
+				align = sizeof(void*);
+			if (posix_memalign(&p, align, size) != 0)
+				p = nullptr;
+#endif
+			if (p && ActiveAllocs())
+				TrackAlloc(size, OBJL_ALIGNED_BLOCK_SIZE(p, align));
+			return p;
+		}
+
+		inline void TrackedAlignedFree(void* p, std::align_val_t alignment)
+		{
+			if (p && ActiveAllocs())
+				TrackFree(OBJL_ALIGNED_BLOCK_SIZE(p, size_t(alignment)));
+			OBJL_ALIGNED_FREE(p);
+		}
+#endif
+	}
+}
+
+void* operator new(size_t size)
+{
+	void* p = objl::stats::TrackedMalloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size)
+{
+	void* p = objl::stats::TrackedMalloc(size);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return objl::stats::TrackedMalloc(size);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return objl::stats::TrackedMalloc(size);
+}
+void operator delete(void* p) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+void operator delete[](void* p) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+void operator delete(void* p, size_t) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+void operator delete[](void* p, size_t) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	objl::stats::TrackedFree(p);
+}
+#ifdef __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t align)
+{
+	void* p = objl::stats::TrackedAlignedMalloc(size, align);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new[](size_t size, std::align_val_t align)
+{
+	void* p = objl::stats::TrackedAlignedMalloc(size, align);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return objl::stats::TrackedAlignedMalloc(size, align);
+}
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return objl::stats::TrackedAlignedMalloc(size, align);
+}
+void operator delete(void* p, std::align_val_t align) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+void operator delete[](void* p, std::align_val_t align) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+void operator delete(void* p, size_t, std::align_val_t align) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+void operator delete[](void* p, size_t, std::align_val_t align) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+void operator delete(void* p, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+void operator delete[](void* p, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	objl::stats::TrackedAlignedFree(p, align);
+}
+#endif // __cpp_aligned_new
+#endif
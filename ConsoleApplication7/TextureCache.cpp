@@ -0,0 +1,558 @@
+﻿#include "TextureCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// "CTEX" little endian
+static const uint32_t CookedMagic = 0x58455443;
+static const uint32_t CookedVersion = 6;
+
+struct CookedHeader {
+    uint32_t magic, version;
+    uint64_t sourceSize, sourceTime;
+    uint32_t width, height, components, levelCount;
+    uint32_t mipFilter, srgb;
+    uint32_t format;
+    float psnr;
+    uint32_t maxSize, downscaleFilter;
+    uint64_t sourceHash, pixelHash;
+};
+
+struct CookedLevelRecord {
+    uint32_t width, height;
+    uint64_t offset, bytes;
+};
+
+// "VTEX" little endian
+static const uint32_t TiledMagic = 0x58455456;
+static const uint32_t TiledVersion = 2;
+
+// Предел стороны уровня 0: в проходе обратной связи номер тайла - 8 бит
+static const int MaxTiledSize = VirtualTileSize * 256;
+
+struct TiledHeader {
+    uint32_t magic, version;
+    uint64_t sourceSize, sourceTime;
+    uint32_t width, height, levelCount;
+    uint32_t tileSize, border;
+    uint32_t mipFilter, srgb;
+    uint32_t components;
+    uint32_t maxSize, downscaleFilter;
+};
+
+struct TiledLevelRecord {
+    uint32_t width, height, tilesX, tilesY;
+    uint64_t offset;
+};
+
+// ---------------------------------------------------------------------------
+
+MappedFile::MappedFile() : data(nullptr), size(0) {
+#ifdef _WIN32
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    fd = -1;
+#endif
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path) {
+    Close();
+#ifdef _WIN32
+    // FILE_SHARE_DELETE - кэш можно заменить новой версией (ReplaceWith), пока он отображен
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        Close();
+        return false;
+    }
+    data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        Close();
+        return false;
+    }
+    size = (size_t)fileSize.QuadPart;
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        Close();
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    data = (const unsigned char*)view;
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap((void*)data, size);
+    if (fd >= 0) close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+// Файлы кэша пишутся под временным именем и заменяют прежние одним
+// переименованием. Прежний файл может быть отображен в память (MappedFile)
+// в этом же или другом процессе: его нельзя обрезать на месте (SIGBUS при
+// чтении отображения, на Windows запись не откроется). Прерванная запись
+// оставляет только .tmp, а не обрезанный кэш с верным размером и временем
+// исходника.
+static std::string TempPath(const std::string& path) {
+    return path + ".tmp";
+}
+
+// Заменить path записанным temp; при ошибке temp удаляется
+static bool ReplaceWith(const std::string& temp, const std::string& path) {
+#ifdef _WIN32
+    bool ok = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool ok = std::rename(temp.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) std::remove(temp.c_str());
+    return ok;
+}
+
+// ---------------------------------------------------------------------------
+
+size_t CookedTexture::Bytes() const {
+    size_t total = 0;
+    for (const auto& level : levels) {
+        total += level.bytes;
+    }
+    return total;
+}
+
+std::string CookedPath(const std::string& sourcePath) {
+    return sourcePath + ".ctex";
+}
+
+static uint64_t Rotl(uint64_t v, int bits) {
+    return (v << bits) | (v >> (64 - bits));
+}
+
+uint64_t ContentHash(const void* data, size_t size, uint64_t seed) {
+    const uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    const unsigned char* p = (const unsigned char*)data;
+
+    uint64_t lanes[4] = { seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t v;
+            memcpy(&v, p + i + k * 8, 8);
+            lanes[k] = Rotl(lanes[k] + v * Prime2, 31) * Prime1;
+        }
+    }
+
+    uint64_t h = (uint64_t)size;
+    for (int k = 0; k < 4; k++) {
+        h = (h ^ Rotl(lanes[k], 27)) * Prime1 + Prime2;
+    }
+    for (; i < size; i++) {
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    }
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime1;
+    h ^= h >> 32;
+    return h;
+}
+
+// Размер и время изменения исходника - по ним отбрасывается устаревший .ctex
+static bool SourceStamp(const std::string& path, uint64_t& size, uint64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+    mtime = (uint64_t)st.st_mtime;
+    return true;
+}
+
+// Байт в уровне width x height
+static size_t LevelBytes(BlockFormat format, int components, int width, int height) {
+    if (format == BlockFormat::None) return (size_t)width * height * components;
+    return CompressedSize(format, width, height);
+}
+
+// Разбор заголовка и таблицы уровней; пиксели остаются на месте
+static bool ParseCooked(const unsigned char* data, size_t size, CookedTexture& out) {
+    CookedHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.levelCount == 0 || header.levelCount > 32) return false;
+    if (header.format > (uint32_t)BlockFormat::BC4) return false;
+
+    size_t tableEnd = sizeof(header) + header.levelCount * sizeof(CookedLevelRecord);
+    if (size < tableEnd) return false;
+
+    out.width = (int)header.width;
+    out.height = (int)header.height;
+    out.components = (int)header.components;
+    out.format = (BlockFormat)header.format;
+    out.psnr = header.psnr;
+    out.sourceHash = header.sourceHash;
+    out.pixelHash = header.pixelHash;
+    out.levels.clear();
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        CookedLevelRecord record;
+        memcpy(&record, data + sizeof(header) + i * sizeof(record), sizeof(record));
+        if (record.offset < tableEnd || record.offset > size || record.bytes > size - record.offset ||
+            record.bytes != LevelBytes(out.format, out.components, record.width, record.height)) {
+            return false;
+        }
+        out.levels.push_back({ (int)record.width, (int)record.height, data + record.offset, (size_t)record.bytes });
+    }
+    return true;
+}
+
+// Формат, в котором текстура готовится при данных настройках
+static BlockFormat TargetFormat(const CookSettings& settings, int components) {
+    return settings.compress ? ChooseBlockFormat(components) : BlockFormat::None;
+}
+
+// Компонент в несжатых уровнях: RGB и серый с альфой расширяются до RGBA8,
+// одна компонента остается R8. Строки таких форматов выровнены по 4 байта,
+// и драйвер копирует их без перепаковки
+static int StoredComponents(BlockFormat format, int components) {
+    if (format != BlockFormat::None || components == 1) return components;
+    return 4;
+}
+
+// Пиксели из components компонент в RGBA8
+static void ExpandToRGBA(const unsigned char* src, size_t count, int components, unsigned char* dst) {
+    for (size_t i = 0; i < count; i++, src += components, dst += 4) {
+        if (components >= 3) {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = components == 4 ? src[3] : 255;
+        }
+        else {
+            dst[0] = dst[1] = dst[2] = src[0];
+            dst[3] = components == 2 ? src[1] : 255;
+        }
+    }
+}
+
+bool OpenCooked(const std::string& sourcePath, const CookSettings& settings, CookedTexture& out) {
+    uint64_t srcSize, srcTime;
+    if (!SourceStamp(sourcePath, srcSize, srcTime)) return false;
+    if (!out.mapping.Open(CookedPath(sourcePath))) return false;
+
+    CookedHeader header;
+    if (out.mapping.Size() < sizeof(header)) return false;
+    memcpy(&header, out.mapping.Data(), sizeof(header));
+    if (header.magic != CookedMagic || header.version != CookedVersion ||
+        header.sourceSize != srcSize || header.sourceTime != srcTime ||
+        header.mipFilter != (uint32_t)settings.mips.filter || header.srgb != (uint32_t)settings.mips.srgb ||
+        header.maxSize != (uint32_t)settings.maxSize || header.downscaleFilter != (uint32_t)settings.downscaleFilter ||
+        header.format != (uint32_t)TargetFormat(settings, (int)header.components)) {
+        out.mapping.Close();
+        return false;
+    }
+
+    if (!ParseCooked(out.mapping.Data(), out.mapping.Size(), out)) {
+        out.mapping.Close();
+        return false;
+    }
+    return true;
+}
+
+bool CookTexture(const std::string& sourcePath, uint64_t sourceHash, const unsigned char* pixels,
+    int width, int height, int components, const CookSettings& settings, CookedTexture& out) {
+    const BlockFormat format = TargetFormat(settings, components);
+    const int stored = StoredComponents(format, components);
+
+    // Размеры всех уровней до 1x1
+    std::vector<CookedLevelRecord> records;
+    int w = width, h = height;
+    while (true) {
+        records.push_back({ (uint32_t)w, (uint32_t)h, 0, LevelBytes(format, stored, w, h) });
+        if (w == 1 && h == 1) break;
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+
+    size_t offset = sizeof(CookedHeader) + records.size() * sizeof(CookedLevelRecord);
+    for (auto& record : records) {
+        record.offset = offset;
+        offset += (size_t)record.bytes;
+    }
+
+    // Несжатая мип-цепочка: каждый уровень строится из предыдущего
+    std::vector<size_t> pixelOffsets(records.size());
+    size_t pixelBytes = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        pixelOffsets[i] = pixelBytes;
+        pixelBytes += (size_t)records[i].width * records[i].height * stored;
+    }
+    std::vector<unsigned char> chain(pixelBytes);
+    if (stored == components) {
+        memcpy(chain.data(), pixels, (size_t)width * height * components);
+    }
+    else {
+        ExpandToRGBA(pixels, (size_t)width * height, components, chain.data());
+    }
+    for (size_t i = 1; i < records.size(); i++) {
+        BuildMipLevel(&chain[pixelOffsets[i - 1]], records[i - 1].width, records[i - 1].height,
+            &chain[pixelOffsets[i]], records[i].width, records[i].height, stored, settings.mips);
+    }
+
+    CookedHeader header;
+    header.magic = CookedMagic;
+    header.version = CookedVersion;
+    header.sourceSize = header.sourceTime = 0;
+    SourceStamp(sourcePath, header.sourceSize, header.sourceTime);
+    header.width = (uint32_t)width;
+    header.height = (uint32_t)height;
+    header.components = (uint32_t)stored;
+    header.levelCount = (uint32_t)records.size();
+    header.mipFilter = (uint32_t)settings.mips.filter;
+    header.srgb = settings.mips.srgb ? 1 : 0;
+    header.format = (uint32_t)format;
+    header.psnr = 0.0f;
+    header.maxSize = (uint32_t)settings.maxSize;
+    header.downscaleFilter = (uint32_t)settings.downscaleFilter;
+    header.sourceHash = sourceHash;
+    header.pixelHash = ContentHash(pixels, (size_t)width * height * components,
+        ((uint64_t)width << 32) ^ ((uint64_t)height << 8) ^ (uint64_t)components);
+
+    // Файл собирается целиком в памяти, из нее же потом грузится текстура
+    out.memory.resize(offset);
+    unsigned char* data = out.memory.data();
+    for (size_t i = 0; i < records.size(); i++) {
+        const unsigned char* level = &chain[pixelOffsets[i]];
+        if (format == BlockFormat::None) {
+            memcpy(data + records[i].offset, level, (size_t)records[i].bytes);
+        }
+        else {
+            CompressImage(level, records[i].width, records[i].height, components, format,
+                data + records[i].offset, settings.compressThreads);
+        }
+    }
+
+    // Качество сжатия по уровню 0, в тех же компонентах, что хранит формат
+    if (format != BlockFormat::None && components == BlockComponents(format)) {
+        std::vector<unsigned char> decoded((size_t)width * height * components);
+        DecompressImage(data + records[0].offset, width, height, format, decoded.data());
+        header.psnr = (float)ComputePSNR(pixels, decoded.data(), decoded.size());
+    }
+
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), records.data(), records.size() * sizeof(CookedLevelRecord));
+    ParseCooked(data, out.memory.size(), out);
+
+    const std::string path = CookedPath(sourcePath);
+    const std::string temp = TempPath(path);
+    {
+        std::ofstream file(temp, std::ios::binary);
+        if (!file.is_open()) return false;
+        file.write((const char*)data, (std::streamsize)out.memory.size());
+        file.close();
+        if (!file) {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    return ReplaceWith(temp, path);
+}
+
+// ---------------------------------------------------------------------------
+
+std::string TiledPath(const std::string& sourcePath) {
+    return sourcePath + ".vtex";
+}
+
+static bool ParseTiled(const unsigned char* data, size_t size, TiledTexture& out) {
+    TiledHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (header.levelCount == 0 || header.levelCount > 16) return false;
+    if (header.tileSize != VirtualTileSize || header.border != VirtualTileBorder || header.components != 4) return false;
+
+    size_t tableEnd = sizeof(header) + header.levelCount * sizeof(TiledLevelRecord);
+    if (size < tableEnd) return false;
+
+    out.width = (int)header.width;
+    out.height = (int)header.height;
+    out.levels.clear();
+    for (uint32_t i = 0; i < header.levelCount; i++) {
+        TiledLevelRecord record;
+        memcpy(&record, data + sizeof(header) + i * sizeof(record), sizeof(record));
+        // Число тайлов обязано совпадать с размером мип-уровня таблицы страниц
+        uint32_t tilesX = std::max(1u, (header.width / VirtualTileSize) >> i);
+        uint32_t tilesY = std::max(1u, (header.height / VirtualTileSize) >> i);
+        size_t bytes = (size_t)record.tilesX * record.tilesY * VirtualTileBytes;
+        if (record.tilesX != tilesX || record.tilesY != tilesY ||
+            record.offset < tableEnd || record.offset > size || bytes > size - record.offset) {
+            return false;
+        }
+        out.levels.push_back({ (int)record.width, (int)record.height, (int)tilesX, (int)tilesY, data + record.offset });
+    }
+    return true;
+}
+
+bool OpenTiled(const std::string& sourcePath, const CookSettings& settings, TiledTexture& out) {
+    const MipSettings& mips = settings.mips;
+    uint64_t srcSize, srcTime;
+    if (!SourceStamp(sourcePath, srcSize, srcTime)) return false;
+    if (!out.mapping.Open(TiledPath(sourcePath))) return false;
+
+    TiledHeader header;
+    if (out.mapping.Size() < sizeof(header)) return false;
+    memcpy(&header, out.mapping.Data(), sizeof(header));
+    if (header.magic != TiledMagic || header.version != TiledVersion ||
+        header.sourceSize != srcSize || header.sourceTime != srcTime ||
+        header.mipFilter != (uint32_t)mips.filter || header.srgb != (uint32_t)mips.srgb ||
+        header.maxSize != (uint32_t)settings.maxSize || header.downscaleFilter != (uint32_t)settings.downscaleFilter ||
+        !ParseTiled(out.mapping.Data(), out.mapping.Size(), out)) {
+        out.mapping.Close();
+        return false;
+    }
+    return true;
+}
+
+// Ближайшая степень двойки в пределах [VirtualTileSize, MaxTiledSize]
+static int NearestPowerOfTwo(int v) {
+    int p = VirtualTileSize;
+    while (p * 2 <= v && p * 2 <= MaxTiledSize) p *= 2;
+    if (p * 2 <= MaxTiledSize && v - p > p * 2 - v) p *= 2;
+    return p;
+}
+
+// Тайл (tx, ty) уровня с рамкой; пиксели за краем уровня берутся с повтором
+static void CutTile(const unsigned char* level, int width, int height, int tx, int ty, unsigned char* tile) {
+    for (int r = 0; r < VirtualTileStride; r++) {
+        int y = ty * VirtualTileSize - VirtualTileBorder + r;
+        y = ((y % height) + height) % height;
+        const uint32_t* row = (const uint32_t*)(level + (size_t)y * width * 4);
+        uint32_t* out = (uint32_t*)(tile + (size_t)r * VirtualTileStride * 4);
+        for (int c = 0; c < VirtualTileStride; c++) {
+            int x = tx * VirtualTileSize - VirtualTileBorder + c;
+            out[c] = row[((x % width) + width) % width];
+        }
+    }
+}
+
+bool CookTiled(const std::string& sourcePath, const unsigned char* rgba,
+    int width, int height, const CookSettings& settings, TiledTexture& out) {
+    const MipSettings& mips = settings.mips;
+    // Уровень 0 - ближайшие степени двойки по каждой стороне
+    int w = NearestPowerOfTwo(width), h = NearestPowerOfTwo(height);
+    std::vector<unsigned char> level((size_t)w * h * 4);
+    if (w == width && h == height) {
+        memcpy(level.data(), rgba, level.size());
+    }
+    else {
+        BuildMipLevel(rgba, width, height, level.data(), w, h, 4, mips);
+    }
+
+    std::vector<TiledLevelRecord> records;
+    for (int lw = w, lh = h; ; lw = std::max(1, lw / 2), lh = std::max(1, lh / 2)) {
+        uint32_t tilesX = (uint32_t)std::max(1, lw / VirtualTileSize);
+        uint32_t tilesY = (uint32_t)std::max(1, lh / VirtualTileSize);
+        records.push_back({ (uint32_t)lw, (uint32_t)lh, tilesX, tilesY, 0 });
+        if (tilesX == 1 && tilesY == 1) break;
+    }
+    size_t offset = sizeof(TiledHeader) + records.size() * sizeof(TiledLevelRecord);
+    for (auto& record : records) {
+        record.offset = offset;
+        offset += (size_t)record.tilesX * record.tilesY * VirtualTileBytes;
+    }
+
+    TiledHeader header;
+    header.magic = TiledMagic;
+    header.version = TiledVersion;
+    header.sourceSize = header.sourceTime = 0;
+    SourceStamp(sourcePath, header.sourceSize, header.sourceTime);
+    header.width = (uint32_t)w;
+    header.height = (uint32_t)h;
+    header.levelCount = (uint32_t)records.size();
+    header.tileSize = VirtualTileSize;
+    header.border = VirtualTileBorder;
+    header.mipFilter = (uint32_t)mips.filter;
+    header.srgb = mips.srgb ? 1 : 0;
+    header.components = 4;
+    header.maxSize = (uint32_t)settings.maxSize;
+    header.downscaleFilter = (uint32_t)settings.downscaleFilter;
+
+    const std::string path = TiledPath(sourcePath);
+    const std::string temp = TempPath(path);
+    {
+        std::ofstream file(temp, std::ios::binary);
+        if (!file.is_open()) return false;
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)records.data(), (std::streamsize)(records.size() * sizeof(TiledLevelRecord)));
+
+        // Уровни режутся по одному, следующий строится из текущего
+        std::vector<unsigned char> tile(VirtualTileBytes), next;
+        for (size_t i = 0; i < records.size(); i++) {
+            const TiledLevelRecord& record = records[i];
+            for (uint32_t ty = 0; ty < record.tilesY; ty++) {
+                for (uint32_t tx = 0; tx < record.tilesX; tx++) {
+                    CutTile(level.data(), (int)record.width, (int)record.height, (int)tx, (int)ty, tile.data());
+                    file.write((const char*)tile.data(), (std::streamsize)tile.size());
+                }
+            }
+            if (i + 1 < records.size()) {
+                next.resize((size_t)records[i + 1].width * records[i + 1].height * 4);
+                BuildMipLevel(level.data(), (int)record.width, (int)record.height,
+                    next.data(), (int)records[i + 1].width, (int)records[i + 1].height, 4, mips);
+                level.swap(next);
+            }
+        }
+        file.close();
+        if (!file) {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    if (!ReplaceWith(temp, path)) return false;
+
+    if (!out.mapping.Open(path) || !ParseTiled(out.mapping.Data(), out.mapping.Size(), out)) {
+        out.mapping.Close();
+        return false;
+    }
+    return true;
+}
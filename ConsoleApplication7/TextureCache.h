@@ -0,0 +1,142 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BlockCompress.h"
+#include "MipBuilder.h"
+
+// Файл, отображенный в память только для чтения
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool Open(const std::string& path);
+    void Close();
+
+    const unsigned char* Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const unsigned char* data;
+    size_t size;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+};
+
+// Быстрый 64-битный хеш содержимого (не криптографический): 4 независимые
+// полосы по 8 байт, несколько ГБ/с. По нему находятся одинаковые текстуры
+uint64_t ContentHash(const void* data, size_t size, uint64_t seed = 0);
+
+// Один мип-уровень: пиксели или блоки в том виде, в каком они уходят
+// в glTexSubImage2D / glCompressedTexSubImage2D
+struct CookedLevel {
+    int width, height;
+    const unsigned char* pixels;
+    size_t bytes;
+};
+
+// Текстура, готовая к загрузке на GPU: полная мип-цепочка без декодирования.
+// Пиксели лежат либо в отображенном .ctex (mapping), либо в memory,
+// если текстура только что приготовлена из исходного файла.
+struct CookedTexture {
+    int width, height, components;
+    BlockFormat format; // None - несжатые пиксели R8 или RGBA8 (components 1 или 4)
+    float psnr;         // качество сжатия уровня 0, дБ (0 для несжатых)
+    uint64_t sourceHash; // ContentHash байт исходного файла
+    uint64_t pixelHash;  // ContentHash декодированных пикселей (до мип-цепочки)
+    std::vector<CookedLevel> levels;
+    MappedFile mapping;
+    std::vector<unsigned char> memory;
+
+    size_t Bytes() const;
+};
+
+// Параметры приготовления текстуры
+struct CookSettings {
+    MipSettings mips;
+    // Сжатие в BC1/BC3/BC4 (см. ChooseBlockFormat); выключается, если
+    // драйвер не поддерживает S3TC
+    bool compress = true;
+    // Потоков на сжатие одного уровня (CompressImage), 0 - по числу ядер.
+    // Рабочие потоки TextureManager передают 1, как и mips.threads
+    int compressThreads = 0;
+    // Предел стороны уровня 0 (0 - без предела): изображение побольше
+    // уменьшается при загрузке с сохранением пропорций фильтром downscaleFilter
+    // (JPEG - сначала прямо при декодировании, см. TextureManager)
+    int maxSize = 0;
+    MipFilter downscaleFilter = MipFilter::Lanczos;
+};
+
+// Кэш приготовленных текстур лежит рядом с исходным файлом: "<файл>.ctex".
+// Формат: заголовок (размер и время изменения исходника, размеры,
+// число компонент, фильтр мип-уровней, предел стороны и фильтр уменьшения,
+// формат сжатия и его PSNR, хеши исходного файла и пикселей),
+// таблица уровней и данные всех уровней подряд.
+std::string CookedPath(const std::string& sourcePath);
+
+// Открыть .ctex для sourcePath; false, если его нет, он поврежден,
+// исходный файл изменился после приготовления или он готовился с другими
+// настройками (в том числе с другим пределом стороны)
+bool OpenCooked(const std::string& sourcePath, const CookSettings& settings, CookedTexture& out);
+
+// Построить мип-цепочку для декодированного изображения (BuildMipLevel),
+// при settings.compress сжать уровни (CompressImage) и записать .ctex.
+// Несжатые RGB и серый с альфой хранятся как RGBA8. sourceHash - ContentHash
+// исходного файла, хеш пикселей считается здесь.
+// out заполняется в любом случае; false - только если файл не записался.
+bool CookTexture(const std::string& sourcePath, uint64_t sourceHash, const unsigned char* pixels,
+    int width, int height, int components, const CookSettings& settings, CookedTexture& out);
+
+// ---------------------------------------------------------------------------
+// Тайлы виртуальных текстур (см. VirtualTexture.h)
+
+// Сторона тайла и рамка вокруг него: рамка повторяет соседние пиксели
+// (с повтором текстуры на краях), чтобы билинейная выборка не выходила за тайл.
+// Те же числа заданы в шейдерах (VtTile, VtBorder).
+const int VirtualTileSize = 128;
+const int VirtualTileBorder = 4;
+const int VirtualTileStride = VirtualTileSize + 2 * VirtualTileBorder;
+const size_t VirtualTileBytes = (size_t)VirtualTileStride * VirtualTileStride * 4;
+
+// Уровень тайловой текстуры: тайлы RGBA8 с рамкой, построчно
+struct TiledLevel {
+    int width, height;
+    int tilesX, tilesY;
+    const unsigned char* tiles;
+};
+
+// Очень большое изображение, разрезанное на тайлы по всем мип-уровням.
+// Уровень 0 приводится к ближайшим степеням двойки - тогда число тайлов
+// уровня L равно max(1, tiles0 >> L), как у мип-уровней таблицы страниц.
+// Уровни идут до первого, который помещается в один тайл.
+struct TiledTexture {
+    int width, height;
+    std::vector<TiledLevel> levels;
+    MappedFile mapping;
+
+    const unsigned char* Tile(int level, int tx, int ty) const {
+        const TiledLevel& l = levels[level];
+        return l.tiles + ((size_t)ty * l.tilesX + tx) * VirtualTileBytes;
+    }
+};
+
+// "<файл>.vtex": заголовок (как у .ctex), таблица уровней и тайлы
+std::string TiledPath(const std::string& sourcePath);
+
+// Открыть .vtex для sourcePath; false, если его нет, он поврежден или устарел
+bool OpenTiled(const std::string& sourcePath, const CookSettings& settings, TiledTexture& out);
+
+// Разрезать декодированное (и уже уменьшенное до settings.maxSize) RGBA
+// изображение на тайлы, записать .vtex и отобразить его в out. Уровни
+// пишутся в файл по одному, так что в памяти одновременно только два
+// соседних уровня.
+bool CookTiled(const std::string& sourcePath, const unsigned char* rgba,
+    int width, int height, const CookSettings& settings, TiledTexture& out);
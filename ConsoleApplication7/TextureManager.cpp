@@ -0,0 +1,1033 @@
+﻿#include "TextureManager.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include "stb_image.h"
+
+// Несжатые уровни - R8 или RGBA8 (см. CookTexture)
+static GLenum PixelFormat(int components) {
+    return components == 1 ? GL_RED : GL_RGBA;
+}
+
+static GLenum SizedFormat(int components) {
+    return components == 1 ? GL_R8 : GL_RGBA8;
+}
+
+static GLenum CompressedFormat(BlockFormat format) {
+    switch (format) {
+    case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+    default: return 0;
+    }
+}
+
+static const char* FormatName(BlockFormat format, int components) {
+    switch (format) {
+    case BlockFormat::BC1: return "BC1";
+    case BlockFormat::BC3: return "BC3";
+    case BlockFormat::BC4: return "BC4";
+    default: return components == 1 ? "R8" : "RGBA8";
+    }
+}
+
+// Пиксели изображения: буфер stb_image или уменьшенная копия
+typedef std::unique_ptr<unsigned char, void (*)(void*)> Pixels;
+
+// Исходный файл уже отображен в память (по нему считается хеш): stb_image видит
+// весь поток сразу и может разбирать интервалы рестарта больших JPEG
+// в нескольких потоках (STBI_JPEG_THREADS; в потоках пула - в одном, см. Run).
+// Изображение со стороной больше settings.maxSize уменьшается с сохранением
+// пропорций. JPEG декодируется сразу в 1/2, 1/4 или 1/8 размера (обратное
+// DCT только по младшим частотам блоков), но не меньше предела, остаток
+// уменьшения делает BuildMipLevel фильтром settings.downscaleFilter.
+static Pixels LoadPixels(const MappedFile& file, const CookSettings& settings,
+    int& width, int& height, int& components, int wanted) {
+    if (file.Size() > INT_MAX) return Pixels(nullptr, free);
+    const unsigned char* data = file.Data();
+    const int size = (int)file.Size();
+
+    // Наибольший делитель, при котором сторона еще не меньше предела
+    const int limit = settings.maxSize;
+    int fullWidth = 0, fullHeight = 0, denom = 1;
+    if (limit > 0 && stbi_info_from_memory(data, size, &fullWidth, &fullHeight, &components)) {
+        int side = std::max(fullWidth, fullHeight);
+        while (denom < 8 && (side + denom * 2 - 1) / (denom * 2) >= limit) denom *= 2;
+    }
+
+    stbi_set_jpeg_scale_denom_thread(denom);
+    Pixels pixels(stbi_load_from_memory(data, size, &width, &height, &components, wanted), stbi_image_free);
+    stbi_set_jpeg_scale_denom_thread(1);
+    if (!pixels || limit <= 0 || std::max(width, height) <= limit) return pixels;
+
+    // Размер считается по исходным пропорциям: у уменьшенного при
+    // декодировании JPEG стороны округлены вверх
+    if (fullWidth <= 0 || fullHeight <= 0) {
+        fullWidth = width;
+        fullHeight = height;
+    }
+    double scale = (double)limit / std::max(fullWidth, fullHeight);
+    int w = std::max(1, (int)(fullWidth * scale + 0.5));
+    int h = std::max(1, (int)(fullHeight * scale + 0.5));
+    int c = wanted ? wanted : components;
+
+    Pixels scaled((unsigned char*)malloc((size_t)w * h * c), free);
+    if (!scaled) return Pixels(nullptr, free);
+    MipSettings resize = settings.mips;
+    resize.filter = settings.downscaleFilter;
+    BuildMipLevel(pixels.get(), width, height, scaled.get(), w, h, c, resize);
+    width = w;
+    height = h;
+    return scaled;
+}
+
+static bool ReadInfo(const std::string& path, int& width, int& height, int& components) {
+    MappedFile file;
+    if (!file.Open(path) || file.Size() > INT_MAX) return false;
+    return stbi_info_from_memory(file.Data(), (int)file.Size(), &width, &height, &components) != 0;
+}
+
+TextureManager::TextureManager()
+    : residentCount(0), residentBytes(0), reclaimBytes(0), allocatedBytes(0), memoryBudget(0), frame(0),
+    hits(0), misses(0), evictions(0), drops(0), ringNext(0), uploadBudget(8 * 1024 * 1024),
+    immutableStorage(false), assets(nullptr), virtualThreshold(4096), running(false) {
+    entries.push_back({ std::string(), TextureState::Failed, { -1, 0, 0, 0, 0, 0, 0 }, -1, 0, 0, 0, 0, false, 0, 0, false, NoTexture });
+    for (auto& b : ring) {
+        b = { 0, 0, nullptr };
+    }
+}
+
+// Ключ хеша файла: с другим пределом стороны получается другая текстура
+static uint64_t SourceKey(uint64_t sourceHash, int maxSize) {
+    return sourceHash ^ ((uint64_t)maxSize * 0x9E3779B97F4A7C15ull);
+}
+
+TextureManager::~TextureManager() {
+    Stop();
+}
+
+void TextureManager::Start(int workerCount) {
+    if (running) return;
+    if (workerCount <= 0) {
+        workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+    running = true;
+    for (int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&TextureManager::Run, this);
+    }
+    virtualTextures.Start();
+}
+
+void TextureManager::Stop() {
+    if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+    for (auto& w : workers) {
+        w.join();
+    }
+    workers.clear();
+    virtualTextures.Stop();
+
+    done.clear();
+    uploads.clear();
+    jobs.clear();
+}
+
+TextureHandle TextureManager::Request(const std::string& filename, int maxSize) {
+    if (maxSize == 0) maxSize = cookSettings.maxSize;
+    if (maxSize < 0) maxSize = 0;
+
+    const std::string key = AssetFS::Normalize(filename);
+    auto found = byName.find(key);
+    if (found != byName.end()) {
+        // Действует больший предел
+        Entry& entry = entries[found->second];
+        int merged = (entry.maxSize == 0 || maxSize == 0) ? 0 : std::max(entry.maxSize, maxSize);
+        if (merged != entry.maxSize) {
+            entry.maxSize = merged;
+            RaiseLimit(found->second);
+        }
+        return found->second;
+    }
+
+    TextureHandle handle = (TextureHandle)entries.size();
+    entries.push_back({ filename, TextureState::Unloaded, { -1, 0, 0, 0, 0, 0, 0 }, -1, 0, 0, 0, 0, false, 0, maxSize, false, NoTexture });
+    byName[key] = handle;
+    return handle;
+}
+
+void TextureManager::MarkVisible(TextureHandle handle) {
+    if (handle == NoTexture || handle >= entries.size()) return;
+    handle = Canonical(handle);
+    Entry& entry = entries[handle];
+    entry.lastUsed = frame;
+    if (entry.state == TextureState::Resident) {
+        hits++;
+        return;
+    }
+    if (entry.state == TextureState::Failed) return;
+
+    misses++;
+    if (entry.state == TextureState::Unloaded) {
+        Queue(handle, 0);
+    }
+}
+
+void TextureManager::Prefetch(TextureHandle handle) {
+    if (handle == NoTexture || handle >= entries.size()) return;
+    handle = Canonical(handle);
+    Entry& entry = entries[handle];
+    if (entry.state != TextureState::Unloaded) return;
+    entry.lastUsed = frame;
+    Queue(handle, 0);
+}
+
+// Отдать файл рабочим потокам; перезагружаемая текстура остается Resident
+void TextureManager::Queue(TextureHandle handle, int skipLevels) {
+    Entry& entry = entries[handle];
+    if (!entry.reloading) {
+        entry.state = TextureState::Queued;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ handle, entry.filename, skipLevels, entry.maxSize });
+    }
+    wake.notify_one();
+}
+
+// Предел стороны вырос после того, как текстура ушла рабочим потокам.
+// Заявка, которую еще не взял рабочий поток, получает новый предел; загруженная
+// текстура перезагружается (прежняя рисуется, пока не загрузится новая);
+// декодируемая или загружаемая сейчас - перезагружается после Finish.
+void TextureManager::RaiseLimit(TextureHandle handle) {
+    Entry& entry = entries[handle];
+    if (entry.state == TextureState::Unloaded || entry.state == TextureState::Failed || entry.virtualId >= 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& job : jobs) {
+            if (job.handle == handle) {
+                job.maxSize = entry.maxSize;
+                return;
+            }
+        }
+    }
+    if (entry.state == TextureState::Resident && !entry.reloading) {
+        entry.reloading = true;
+        Queue(handle, entry.dropped);
+        return;
+    }
+    entry.stale = true;
+}
+
+bool TextureManager::GetSlot(TextureHandle handle, TextureSlot& slot) const {
+    if (handle == NoTexture || handle >= entries.size()) return false;
+    const Entry& entry = entries[Canonical(handle)];
+    // Частично загруженная текстура не отдается
+    if (entry.state != TextureState::Resident) return false;
+
+    if (entry.virtualId >= 0) {
+        if (!virtualTextures.Ready(entry.virtualId)) return false;
+        slot.texture = 0;
+        slot.layer = 0.0f;
+        slot.rect[0] = slot.rect[1] = 0.0f;
+        slot.rect[2] = slot.rect[3] = 1.0f;
+        slot.virtualId = entry.virtualId;
+        return true;
+    }
+
+    const Placement& place = entry.place;
+    const TexturePage& page = pages[place.page];
+    slot.texture = page.texture;
+    slot.layer = (float)place.layer;
+    slot.rect[0] = (float)place.x / page.width;
+    slot.rect[1] = (float)place.y / page.height;
+    slot.rect[2] = (float)place.width / page.width;
+    slot.rect[3] = (float)place.height / page.height;
+    slot.virtualId = -1;
+    return true;
+}
+
+TextureState TextureManager::GetState(TextureHandle handle) const {
+    if (handle == NoTexture || handle >= entries.size()) return TextureState::Failed;
+    return entries[Canonical(handle)].state;
+}
+
+// Текстура, чей слой используется: дубликат ссылается на первую
+// текстуру с тем же содержимым
+TextureHandle TextureManager::Canonical(TextureHandle handle) const {
+    while (entries[handle].alias != NoTexture) {
+        handle = entries[handle].alias;
+    }
+    return handle;
+}
+
+TextureStats TextureManager::GetStats() const {
+    TextureStats stats;
+    stats.residentCount = residentCount;
+    stats.residentBytes = residentBytes;
+    stats.allocatedBytes = allocatedBytes;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.evictions = evictions;
+    stats.drops = drops;
+    stats.duplicates = 0;
+    stats.sharedBytes = 0;
+    for (TextureHandle h = 1; h < entries.size(); h++) {
+        if (entries[h].alias == NoTexture) continue;
+        stats.duplicates++;
+        const Entry& owner = entries[Canonical(h)];
+        if (owner.state == TextureState::Resident) stats.sharedBytes += owner.bytes;
+    }
+    return stats;
+}
+
+void TextureManager::Update() {
+    frame++;
+    std::vector<Decoded> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(done);
+    }
+
+    for (auto& d : ready) {
+        if (d.duplicateOf != NoTexture) {
+            Entry& entry = entries[d.handle];
+            TextureHandle owner = Canonical(d.duplicateOf);
+            std::cout << "Текстура совпадает с " << entries[owner].filename << ": " << entry.filename << std::endl;
+            entry.alias = owner;
+            entry.state = TextureState::Unloaded;
+            // Дубликат был виден - первая текстура могла быть уже выгружена
+            if (entries[owner].state == TextureState::Unloaded) {
+                Queue(owner, 0);
+            }
+            continue;
+        }
+        if (d.tiled) {
+            Entry& entry = entries[d.handle];
+            const TiledTexture& tiled = *d.tiled;
+            std::cout << "Виртуальная текстура: " << d.path << " (" << tiled.width << "x" << tiled.height
+                << ", уровней: " << tiled.levels.size() << ")" << (d.cached ? " из кэша" : "") << std::endl;
+            entry.virtualId = virtualTextures.Add(std::move(d.tiled));
+            entry.state = TextureState::Resident;
+            residentCount++;
+            continue;
+        }
+        if (!d.image) {
+            Fail(d);
+            continue;
+        }
+        Entry& entry = entries[d.handle];
+        if (!entry.reloading) {
+            entry.state = TextureState::Uploading;
+        }
+        int levelCount = (int)d.image->levels.size();
+        uploads.push_back({ std::move(d), { -1, 0, 0, 0, 0, 0, 0 }, 0, levelCount, 0, {}, {} });
+    }
+
+    // Очередь грузится по порядку; останавливаемся, когда бюджет кадра
+    // исчерпан или все PBO кольца еще заняты GPU
+    size_t sent = 0;
+    while (!uploads.empty() && sent < uploadBudget) {
+        Upload& upload = uploads.front();
+        if (!UploadRows(upload, sent)) break;
+        if (upload.level == upload.levelCount) {
+            Finish(upload);
+            uploads.pop_front();
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    EnforceBudget();
+    virtualTextures.Update();
+}
+
+// Передать очередную полосу строк текущего мип-уровня через PBO.
+// У сжатой текстуры единица передачи - строка блоков 4x4.
+// Если бюджета не хватает даже на одну строку, она все равно передается,
+// но только первой в кадре - иначе очень широкая текстура не загрузится никогда.
+bool TextureManager::UploadRows(Upload& upload, size_t& sent) {
+    // Место на странице выделяется до привязки PBO: новая страница
+    // создается с nullptr, который иначе был бы понят как смещение в буфере
+    if (upload.target.page < 0) {
+        Place(upload);
+    }
+
+    const CookedTexture& image = *upload.decoded.image;
+    const CookedLevel& level = upload.levels[upload.level];
+    const bool compressed = image.format != BlockFormat::None;
+    GLenum format = compressed ? CompressedFormat(image.format) : PixelFormat(image.components);
+    int rowHeight = compressed ? 4 : 1;
+    int rowCount = (level.height + rowHeight - 1) / rowHeight;
+    size_t rowBytes = compressed
+        ? (size_t)((level.width + 3) / 4) * BlockBytes(image.format)
+        : (size_t)level.width * image.components;
+
+    size_t rows = (uploadBudget - sent) / rowBytes;
+    if (rows == 0) {
+        if (sent > 0) return false;
+        rows = 1;
+    }
+    rows = std::min(rows, (size_t)(rowCount - upload.rowsDone));
+    size_t bytes = rows * rowBytes;
+    int y = upload.rowsDone * rowHeight;
+    GLsizei height = std::min((int)rows * rowHeight, level.height - y);
+
+    // Уровень в атласе грузится вместе с рамкой
+    const Placement& place = upload.target;
+    const TexturePage& page = pages[place.page];
+    int x0 = (place.x - place.gutter) >> upload.level;
+    int y0 = ((place.y - place.gutter) >> upload.level) + y;
+
+    PixelBuffer* buffer = AcquireBuffer(bytes);
+    if (!buffer) return false;
+
+    const unsigned char* src = level.pixels + (size_t)upload.rowsDone * rowBytes;
+    void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (dst) {
+        memcpy(dst, src, bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, page.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (!dst) {
+        // Отобразить буфер не удалось - грузим напрямую из памяти
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    const void* pixels = dst ? nullptr : src;
+    if (compressed) {
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, x0, y0, place.layer,
+            level.width, height, 1, format, (GLsizei)bytes, pixels);
+    }
+    else {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, upload.level, x0, y0, place.layer,
+            level.width, height, 1, format, GL_UNSIGNED_BYTE, pixels);
+    }
+    if (dst) {
+        buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    upload.rowsDone += (int)rows;
+    if (upload.rowsDone == rowCount) {
+        upload.level++;
+        upload.rowsDone = 0;
+    }
+    sent += bytes;
+    return true;
+}
+
+// Следующий PBO кольца, достаточный для bytes; nullptr, если GPU его еще читает
+TextureManager::PixelBuffer* TextureManager::AcquireBuffer(size_t bytes) {
+    PixelBuffer& b = ring[ringNext];
+    if (b.fence) {
+        if (glClientWaitSync(b.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return nullptr;
+        }
+        glDeleteSync(b.fence);
+        b.fence = nullptr;
+    }
+
+    if (b.buffer == 0) {
+        glGenBuffers(1, &b.buffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, b.buffer);
+    if (b.capacity < bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        b.capacity = bytes;
+    }
+
+    ringNext = (ringNext + 1) % RingSize;
+    return &b;
+}
+
+// Выбор страницы для текстуры: атлас для маленьких текстур со сторонами-степенями
+// двойки, иначе слой массива того же размера и формата
+void TextureManager::Place(Upload& upload) {
+    const CookedTexture& image = *upload.decoded.image;
+    Placement& place = upload.target;
+    place.width = image.width;
+    place.height = image.height;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (PlaceInAtlas(place, image)) {
+        upload.levelCount = std::min(upload.levelCount, (int)AtlasLevels);
+        PadLevels(upload);
+    }
+    else {
+        place.gutter = 0;
+        PlaceInArray(place, image);
+        upload.levels = image.levels;
+    }
+    pages[place.page].residents++;
+}
+
+// Рамка атласа: у сжатых текстур в блоках по 4 пикселя на последнем уровне
+int TextureManager::GutterFor(BlockFormat format) {
+    return format != BlockFormat::None ? AtlasGutter * 4 : AtlasGutter;
+}
+
+// Сторона ячейки атласа: текстура с рамкой, округленная до степени двойки
+int TextureManager::CellSize(const Placement& place) {
+    int needed = std::max(place.width, place.height) + 2 * place.gutter;
+    int size = 1;
+    while (size < needed) size *= 2;
+    return size;
+}
+
+// Копия уровня с рамкой gutter единиц со всех сторон. Рамка повторяет
+// противоположный край, как GL_REPEAT; единица - пиксель или блок BC
+// (края текстуры совпадают с границами блоков, блок копируется целиком)
+static void PadWrapped(const unsigned char* src, int cols, int rows, size_t unit, int gutter, unsigned char* dst) {
+    const int paddedCols = cols + 2 * gutter;
+    for (int y = 0; y < rows + 2 * gutter; y++) {
+        int sy = ((y - gutter) % rows + rows) % rows;
+        const unsigned char* srcRow = src + (size_t)sy * cols * unit;
+        unsigned char* dstRow = dst + (size_t)y * paddedCols * unit;
+        for (int x = 0; x < paddedCols; x++) {
+            int sx = ((x - gutter) % cols + cols) % cols;
+            memcpy(dstRow + (size_t)x * unit, srcRow + (size_t)sx * unit, unit);
+        }
+    }
+}
+
+// Уровни текстуры в атласе вместе с рамкой (upload.padded)
+void TextureManager::PadLevels(Upload& upload) {
+    const CookedTexture& image = *upload.decoded.image;
+    const bool compressed = image.format != BlockFormat::None;
+    const int texel = compressed ? 4 : 1;
+    const size_t unit = compressed ? (size_t)BlockBytes(image.format) : (size_t)image.components;
+
+    std::vector<size_t> offsets;
+    size_t total = 0;
+    upload.levels.clear();
+    for (int i = 0; i < upload.levelCount; i++) {
+        const CookedLevel& level = image.levels[i];
+        int gutter = upload.target.gutter >> i;
+        int cols = (level.width + texel - 1) / texel + 2 * gutter / texel;
+        int rows = (level.height + texel - 1) / texel + 2 * gutter / texel;
+        offsets.push_back(total);
+        upload.levels.push_back({ level.width + 2 * gutter, level.height + 2 * gutter, nullptr, (size_t)cols * rows * unit });
+        total += upload.levels.back().bytes;
+    }
+
+    upload.padded.resize(total);
+    for (int i = 0; i < upload.levelCount; i++) {
+        const CookedLevel& level = image.levels[i];
+        PadWrapped(level.pixels, (level.width + texel - 1) / texel, (level.height + texel - 1) / texel,
+            unit, (upload.target.gutter >> i) / texel, upload.padded.data() + offsets[i]);
+        upload.levels[i].pixels = upload.padded.data() + offsets[i];
+    }
+}
+
+static bool IsPowerOfTwo(int v) {
+    return v > 0 && (v & (v - 1)) == 0;
+}
+
+// Наименьшая свободная ячейка атласа не меньше size
+static bool FindCell(const std::vector<std::vector<int>>& freeCells, int size, int& bestLayer, size_t& bestCell) {
+    bestLayer = -1;
+    for (int layer = 0; layer < (int)freeCells.size(); layer++) {
+        const std::vector<int>& cells = freeCells[layer];
+        for (size_t c = 0; c < cells.size(); c += 3) {
+            int cellSize = cells[c + 2];
+            if (cellSize >= size && (bestLayer < 0 || cellSize < freeCells[bestLayer][bestCell + 2])) {
+                bestLayer = layer;
+                bestCell = c;
+            }
+        }
+    }
+    return bestLayer >= 0;
+}
+
+// Вернуть ячейку; если свободны все четыре четверти родительской ячейки,
+// они сливаются обратно (и так до размера слоя)
+static void FreeCell(std::vector<int>& cells, int x, int y, int size, int layerSize) {
+    while (size < layerSize) {
+        int parentSize = size * 2;
+        int px = x - x % parentSize, py = y - y % parentSize;
+        size_t siblings[3];
+        int count = 0;
+        for (size_t c = 0; c < cells.size() && count < 3; c += 3) {
+            int cx = cells[c], cy = cells[c + 1];
+            if (cells[c + 2] == size && cx - cx % parentSize == px && cy - cy % parentSize == py) {
+                siblings[count++] = c;
+            }
+        }
+        if (count < 3) break;
+
+        std::sort(siblings, siblings + 3, std::greater<size_t>());
+        for (size_t c : siblings) {
+            cells.erase(cells.begin() + c, cells.begin() + c + 3);
+        }
+        x = px;
+        y = py;
+        size = parentSize;
+    }
+    cells.insert(cells.end(), { x, y, size });
+}
+
+bool TextureManager::PlaceInAtlas(Placement& place, const CookedTexture& image) {
+    if (!IsPowerOfTwo(image.width) || !IsPowerOfTwo(image.height)) return false;
+    if (std::min(image.width, image.height) < AtlasMinTile) return false;
+    if (std::max(image.width, image.height) > AtlasMaxTile) return false;
+
+    // Ячейки квадратные, выровнены по своему размеру и делятся на четверти:
+    // свободная ячейка наименьшего подходящего размера дробится до нужного.
+    // Текстура лежит в ячейке вместе с рамкой, ее угол - через рамку от угла ячейки
+    place.gutter = GutterFor(image.format);
+    int size = CellSize(place);
+    int p = -1, bestLayer = -1;
+    size_t bestCell = 0;
+    for (size_t i = 0; i < pages.size(); i++) {
+        const TexturePage& page = pages[i];
+        if (!page.texture || !page.atlas || page.format != image.format || page.components != image.components) continue;
+        if (FindCell(page.freeCells, size, bestLayer, bestCell)) {
+            p = (int)i;
+            break;
+        }
+    }
+    if (p < 0) {
+        p = CreatePage(image, AtlasSize, AtlasSize, AtlasLevels, AtlasLayers, true);
+        FindCell(pages[p].freeCells, size, bestLayer, bestCell);
+    }
+
+    std::vector<int>& cells = pages[p].freeCells[bestLayer];
+    int x = cells[bestCell], y = cells[bestCell + 1], cellSize = cells[bestCell + 2];
+    cells.erase(cells.begin() + bestCell, cells.begin() + bestCell + 3);
+    while (cellSize > size) {
+        cellSize /= 2;
+        int quarters[] = { x + cellSize, y, x, y + cellSize, x + cellSize, y + cellSize };
+        for (int q = 0; q < 6; q += 2) {
+            cells.insert(cells.end(), { quarters[q], quarters[q + 1], cellSize });
+        }
+    }
+
+    place.page = p;
+    place.layer = bestLayer;
+    place.x = x + place.gutter;
+    place.y = y + place.gutter;
+    return true;
+}
+
+void TextureManager::PlaceInArray(Placement& place, const CookedTexture& image) {
+    const int levels = (int)image.levels.size();
+    place.x = place.y = 0;
+    for (size_t p = 0; p < pages.size(); p++) {
+        TexturePage& page = pages[p];
+        if (!page.texture || page.atlas || page.freeLayers.empty()) continue;
+        if (page.width != image.width || page.height != image.height || page.levels != levels ||
+            page.format != image.format || page.components != image.components) continue;
+        place.page = (int)p;
+        place.layer = page.freeLayers.back();
+        page.freeLayers.pop_back();
+        return;
+    }
+
+    // Новая страница: слоев столько, сколько помещается в ArrayPageBytes
+    int layers = (int)std::max((size_t)1, std::min((size_t)MaxArrayLayers, ArrayPageBytes / std::max((size_t)1, image.Bytes())));
+    place.page = CreatePage(image, image.width, image.height, levels, layers, false);
+    place.layer = pages[place.page].freeLayers.back();
+    pages[place.page].freeLayers.pop_back();
+}
+
+// Создание GL_TEXTURE_2D_ARRAY без данных, слои заполняются через PBO.
+// Индекс удаленной страницы используется повторно.
+int TextureManager::CreatePage(const CookedTexture& image, int width, int height, int levels, int layers, bool atlas) {
+    TexturePage page;
+    page.width = width;
+    page.height = height;
+    page.levels = levels;
+    page.layers = layers;
+    page.format = image.format;
+    page.components = image.components;
+    page.atlas = atlas;
+    page.residents = 0;
+    page.bytes = 0;
+    if (atlas) {
+        page.freeCells.assign(layers, std::vector<int>{ 0, 0, width });
+    }
+    else {
+        for (int layer = layers - 1; layer >= 0; layer--) {
+            page.freeLayers.push_back(layer);
+        }
+    }
+
+    const bool compressed = image.format != BlockFormat::None;
+    GLenum internalFormat = compressed ? CompressedFormat(image.format) : SizedFormat(image.components);
+
+    // Неизменяемое хранилище сразу под все уровни: драйверу не нужно
+    // проверять полноту мип-цепочки и перевыделять память при загрузке.
+    // Без ARB_texture_storage уровни выделяются по одному, в том же формате
+    glGenTextures(1, &page.texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, page.texture);
+    if (immutableStorage) {
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, width, height, layers);
+    }
+    for (int i = 0; i < levels; i++) {
+        int w = std::max(1, width >> i), h = std::max(1, height >> i);
+        if (compressed) {
+            GLsizei bytes = (GLsizei)(CompressedSize(image.format, w, h) * layers);
+            if (!immutableStorage) {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, internalFormat, w, h, layers, 0, bytes, nullptr);
+            }
+            page.bytes += (size_t)bytes;
+        }
+        else {
+            if (!immutableStorage) {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, i, internalFormat, w, h, layers, 0,
+                    PixelFormat(image.components), GL_UNSIGNED_BYTE, nullptr);
+            }
+            page.bytes += (size_t)w * h * image.components * layers;
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    // Одна компонента (R8, BC4) - оттенки серого, шейдер читает .rgb
+    if (image.components == 1) {
+        const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    // Атлас повторяет UV внутри прямоугольника в шейдере, сам слой не повторяется
+    GLint wrap = atlas ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    allocatedBytes += page.bytes;
+
+    std::cout << "Страница текстур: " << width << "x" << height << " x " << layers
+        << (atlas ? " (атлас)" : "") << std::endl;
+    for (size_t p = 0; p < pages.size(); p++) {
+        if (!pages[p].texture) {
+            pages[p] = std::move(page);
+            return (int)p;
+        }
+    }
+    pages.push_back(std::move(page));
+    return (int)pages.size() - 1;
+}
+
+// Освободить слой или ячейку атласа; опустевшая страница удаляется
+void TextureManager::Release(Placement& place) {
+    if (place.page < 0) return;
+    TexturePage& page = pages[place.page];
+    if (page.atlas) {
+        FreeCell(page.freeCells[place.layer], place.x - place.gutter, place.y - place.gutter, CellSize(place), page.width);
+    }
+    else {
+        page.freeLayers.push_back(place.layer);
+    }
+    place.page = -1;
+
+    if (--page.residents == 0) {
+        std::cout << "Страница текстур освобождена: " << page.width << "x" << page.height << " x " << page.layers
+            << (page.atlas ? " (атлас)" : "") << std::endl;
+        glDeleteTextures(1, &page.texture);
+        page.texture = 0;
+        page.freeLayers.clear();
+        page.freeCells.clear();
+        allocatedBytes -= page.bytes;
+    }
+}
+
+// Все уровни загружены: мип-цепочка готовая, glGenerateMipmap не нужен.
+// Перезагруженная версия только теперь заменяет прежнюю.
+void TextureManager::Finish(Upload& upload) {
+    const CookedTexture& image = *upload.decoded.image;
+    Entry& entry = entries[upload.decoded.handle];
+
+    size_t bytes = 0;
+    for (int i = 0; i < upload.levelCount; i++) {
+        bytes += upload.levels[i].bytes;
+    }
+    if (entry.place.page >= 0) {
+        Release(entry.place);
+        residentBytes -= entry.bytes;
+    }
+    else {
+        residentCount++;
+    }
+    entry.place = upload.target;
+    entry.state = TextureState::Resident;
+    entry.reloading = false;
+    reclaimBytes -= entry.reclaim;
+    entry.reclaim = 0;
+    entry.bytes = bytes;
+    entry.dropped = upload.decoded.skipped;
+    residentBytes += bytes;
+
+    std::cout << "Текстура загружена: " << upload.decoded.path << " (" << image.width << "x" << image.height
+        << ", " << FormatName(image.format, image.components);
+    if (image.format != BlockFormat::None && image.psnr > 0.0f) {
+        std::cout << ", PSNR " << image.psnr << " дБ";
+    }
+    if (entry.dropped > 0) {
+        std::cout << ", без верхних уровней: " << entry.dropped;
+    }
+    std::cout << ", " << bytes / 1024 << " КБ)" << (upload.decoded.cached ? " из кэша" : "") << std::endl;
+    upload.decoded.image.reset();
+
+    // Загружена версия со старым пределом стороны
+    if (entry.stale) {
+        entry.stale = false;
+        entry.reloading = true;
+        Queue(upload.decoded.handle, entry.dropped);
+    }
+}
+
+void TextureManager::Fail(const Decoded& image) {
+    Entry& entry = entries[image.handle];
+    entry.stale = false;
+    std::cout << "ОШИБКА: Не удалось загрузить текстуру: " << entry.filename << std::endl;
+    if (entry.reloading) {
+        // Остается прежняя версия. Не удалось вернуть уровни - больше не
+        // пробуем; не удалось уменьшить - текстура выгрузится как обычно
+        entry.reloading = false;
+        if (entry.reclaim == 0) {
+            entry.dropped = 0;
+        }
+        reclaimBytes -= entry.reclaim;
+        entry.reclaim = 0;
+        return;
+    }
+    entry.state = TextureState::Failed;
+}
+
+// Бюджет памяти: пока он превышен, место освобождают текстуры, дольше всех
+// не попадавшие в кадр. Если бюджет позволяет, одна видимая уменьшенная
+// текстура за кадр получает обратно верхний уровень.
+void TextureManager::EnforceBudget() {
+    if (memoryBudget == 0) return;
+
+    // Уменьшаемые текстуры освобождают место только после загрузки
+    while (residentBytes - reclaimBytes > memoryBudget) {
+        TextureHandle victim = NoTexture;
+        for (TextureHandle h = 1; h < entries.size(); h++) {
+            const Entry& e = entries[h];
+            if (e.state != TextureState::Resident || e.virtualId >= 0 || e.reloading) continue;
+            if (e.lastUsed + ProtectFrames >= frame) continue;
+            if (victim == NoTexture || e.lastUsed < entries[victim].lastUsed) {
+                victim = h;
+            }
+        }
+        if (victim == NoTexture) break;
+        Evict(victim);
+    }
+
+    TextureHandle restore = NoTexture;
+    for (TextureHandle h = 1; h < entries.size(); h++) {
+        const Entry& e = entries[h];
+        // Пока идет одна перезагрузка, другая не начинается
+        if (e.reloading) return;
+        if (e.state != TextureState::Resident || e.dropped == 0 || e.lastUsed + ProtectFrames < frame) continue;
+        // Пока новая версия грузится, прежняя остается: нужно место на обе
+        if (residentBytes + e.bytes * 4 > memoryBudget) continue;
+        if (restore == NoTexture) restore = h;
+    }
+    if (restore != NoTexture) {
+        entries[restore].reloading = true;
+        Queue(restore, entries[restore].dropped - 1);
+    }
+}
+
+// Освободить место текстуры. Недавно видимая перезагружается без верхнего
+// уровня: как и при возврате уровней, прежняя версия рисуется, пока Finish
+// не заменит ее уменьшенной. Давно не видимая выгружается до следующего
+// MarkVisible. Пока текстура не попала в кадр снова, второй раз она не
+// уменьшается, а выгружается - иначе уменьшенная версия вытеснялась бы по кругу.
+void TextureManager::Evict(TextureHandle handle) {
+    Entry& entry = entries[handle];
+    const Placement place = entry.place;
+    bool drop = frame - entry.lastUsed <= DropFrames && entry.dropped < MaxDroppedLevels &&
+        (entry.dropped == 0 || entry.droppedAt != entry.lastUsed) &&
+        std::min(place.width, place.height) >= MinDropSize * 2;
+
+    if (drop) {
+        drops++;
+        entry.droppedAt = entry.lastUsed;
+        // Без верхнего уровня остается около четверти байт
+        entry.reclaim = entry.bytes - entry.bytes / 4;
+        reclaimBytes += entry.reclaim;
+        entry.reloading = true;
+        std::cout << "Текстура уменьшена: " << entry.filename << " (" << place.width / 2 << "x"
+            << place.height / 2 << ")" << std::endl;
+        Queue(handle, entry.dropped + 1);
+    }
+    else {
+        Release(entry.place);
+        residentBytes -= entry.bytes;
+        residentCount--;
+        entry.bytes = 0;
+        evictions++;
+        std::cout << "Текстура выгружена: " << entry.filename << std::endl;
+        entry.dropped = 0;
+        entry.state = TextureState::Unloaded;
+    }
+}
+
+void TextureManager::DeleteTextures() {
+    uploads.clear();
+
+    for (auto& page : pages) {
+        glDeleteTextures(1, &page.texture);
+    }
+    pages.clear();
+    virtualTextures.DeleteTextures();
+    for (auto& entry : entries) {
+        if (entry.place.page >= 0 || entry.virtualId >= 0) {
+            entry.place.page = -1;
+            entry.virtualId = -1;
+            entry.state = TextureState::Unloaded;
+        }
+        entry.bytes = 0;
+        entry.dropped = 0;
+        entry.reloading = false;
+        entry.stale = false;
+        entry.reclaim = 0;
+    }
+    for (auto& b : ring) {
+        if (b.fence) glDeleteSync(b.fence);
+        if (b.buffer) glDeleteBuffers(1, &b.buffer);
+        b = { 0, 0, nullptr };
+    }
+    residentCount = 0;
+    residentBytes = 0;
+    reclaimBytes = 0;
+    allocatedBytes = 0;
+}
+
+void TextureManager::Run() {
+    // Пул уже декодирует по текстуре на поток - JPEG разбирается
+    // в этом же потоке, без своих потоков для интервалов рестарта
+    stbi_set_jpeg_threads_thread(1);
+    while (true) {
+        DecodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return !running || !jobs.empty(); });
+            if (!running) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        Decoded decoded = Decode(job);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(std::move(decoded));
+    }
+}
+
+// Чтение и декодирование файла (рабочий поток, без вызовов GL).
+// Путь к файлу берется из индекса ресурсов. Сначала ищется приготовленный
+// .ctex, иначе файл декодируется и готовится для следующих запусков.
+// Из-за бюджета памяти верхние skipLevels уровней могут быть отброшены.
+// stb_image 2.30 хранит свое состояние в thread_local, так что
+// несколько потоков декодируют одновременно.
+TextureManager::Decoded TextureManager::Decode(const DecodeJob& job) {
+    Decoded d;
+    d.handle = job.handle;
+    d.cached = false;
+    d.skipped = 0;
+    d.duplicateOf = NoTexture;
+
+    // Файла нет в индексе ресурсов (путь вне корней, абсолютный или
+    // появился после сканирования) - открываем путь как есть
+    std::string path;
+    if (!assets || !assets->Resolve(job.filename, path)) {
+        path = job.filename;
+    }
+    CookSettings settings = cookSettings;
+    settings.maxSize = job.maxSize;
+    // Пул уже разбирает по текстуре на поток - уровни строятся и сжимаются
+    // в этом же потоке
+    settings.mips.threads = 1;
+    settings.compressThreads = 1;
+    if (DecodeTiled(path, settings, d)) {
+        return d;
+    }
+
+    // Копия файла отбрасывается до декодирования, копия пикселей - после
+    // (приготовленный .ctex хранит оба хеша)
+    std::unique_ptr<CookedTexture> image(new CookedTexture());
+    if (OpenCooked(path, settings, *image)) {
+        d.cached = true;
+        if (FindDuplicate(bySource, SourceKey(image->sourceHash, job.maxSize), d)) return d;
+    }
+    else {
+        MappedFile file;
+        if (!file.Open(path)) return d;
+        uint64_t sourceHash = ContentHash(file.Data(), file.Size());
+        if (FindDuplicate(bySource, SourceKey(sourceHash, job.maxSize), d)) return d;
+
+        int width, height, components;
+        Pixels pixels = LoadPixels(file, settings, width, height, components, 0);
+        if (!pixels) return d;
+        if (!CookTexture(path, sourceHash, pixels.get(), width, height, components, settings, *image)) {
+            std::cout << "Не удалось записать кэш текстуры: " << CookedPath(path) << std::endl;
+        }
+    }
+    if (FindDuplicate(byPixels, image->pixelHash, d)) return d;
+
+    // Пиксели уровней остаются в mapping/memory, отбрасываются только записи
+    int skip = std::min(job.skipLevels, (int)image->levels.size() - 1);
+    if (skip > 0) {
+        image->levels.erase(image->levels.begin(), image->levels.begin() + skip);
+        image->width = image->levels[0].width;
+        image->height = image->levels[0].height;
+        d.skipped = skip;
+    }
+    d.path = path;
+    d.image = std::move(image);
+    return d;
+}
+
+// Хеш занимает первая текстура; true - у текстуры d то же содержимое,
+// что у другой, d.duplicateOf указывает на нее
+bool TextureManager::FindDuplicate(std::map<uint64_t, TextureHandle>& owners, uint64_t hash, Decoded& d) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto inserted = owners.insert({ hash, d.handle });
+    if (inserted.second || inserted.first->second == d.handle) return false;
+    d.duplicateOf = inserted.first->second;
+    return true;
+}
+
+// Очень большое изображение - в тайлы виртуальной текстуры (.vtex).
+// Размер узнается по заголовку, без декодирования; false - файла нет,
+// он меньше порога (с учетом предела стороны) или тайлы не записались
+// (тогда текстура грузится целиком).
+bool TextureManager::DecodeTiled(const std::string& path, const CookSettings& settings, Decoded& d) const {
+    int width, height, components;
+    if (virtualThreshold <= 0 || !ReadInfo(path, width, height, components)) return false;
+    int side = std::max(width, height);
+    if (settings.maxSize > 0) side = std::min(side, settings.maxSize);
+    if (side < virtualThreshold) return false;
+
+    std::unique_ptr<TiledTexture> tiled(new TiledTexture());
+    if (OpenTiled(path, settings, *tiled)) {
+        d.path = path;
+        d.tiled = std::move(tiled);
+        d.cached = true;
+        return true;
+    }
+
+    MappedFile file;
+    if (!file.Open(path)) return false;
+    Pixels pixels = LoadPixels(file, settings, width, height, components, 4);
+    file.Close();
+    if (!pixels) return false;
+    bool cooked = CookTiled(path, pixels.get(), width, height, settings, *tiled);
+    pixels.reset();
+    if (!cooked) {
+        std::cout << "Не удалось записать тайлы виртуальной текстуры: " << TiledPath(path) << std::endl;
+        return false;
+    }
+    d.path = path;
+    d.tiled = std::move(tiled);
+    return true;
+}
@@ -0,0 +1,331 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+#include "AssetFS.h"
+#include "TextureCache.h"
+#include "VirtualTexture.h"
+
+// Дескриптор текстуры в TextureManager, 0 - текстуры нет
+typedef uint32_t TextureHandle;
+const TextureHandle NoTexture = 0;
+
+enum class TextureState {
+    Unloaded,  // зарегистрирована, файл не читался
+    Queued,    // попала в кадр, ждет декодирования
+    Uploading, // декодирована, строки идут на GPU через PBO
+    Resident,  // загружена в GL
+    Failed     // файл не найден или не декодируется
+};
+
+// Счетчики TextureManager
+struct TextureStats {
+    int residentCount;
+    size_t residentBytes;  // загруженные уровни текстур
+    size_t allocatedBytes; // все страницы вместе со свободными слоями и ячейками
+    uint64_t hits;         // MarkVisible для загруженной текстуры
+    uint64_t misses;       // MarkVisible для незагруженной
+    uint64_t evictions;    // выгружено целиком
+    uint64_t drops;        // уменьшено на мип-уровень
+    int duplicates;        // файлов, совпавших по содержимому с другой текстурой
+    size_t sharedBytes;    // байт в GL, которые заняли бы дубликаты
+};
+
+// Где лежит текстура: слой GL_TEXTURE_2D_ARRAY и прямоугольник UV в нем
+// (у текстуры на весь слой rect = 0, 0, 1, 1)
+struct TextureSlot {
+    unsigned int texture; // GL_TEXTURE_2D_ARRAY
+    float layer;
+    float rect[4];        // смещение и размер в долях слоя
+    int virtualId;        // >= 0 - виртуальная текстура (VirtualTextureCache::GetBinding)
+};
+
+// Отложенная загрузка текстур по видимости.
+// Request только регистрирует файл и возвращает дескриптор. Декодирование
+// начинается, когда меш с этой текстурой впервые попал в кадр (MarkVisible),
+// или сразу по Prefetch, если загрузчик модели просит все текстуры заранее:
+// файлы читаются и декодируются пулом рабочих потоков, а в GL текстура
+// загружается в Update между кадрами. Пока текстура не загружена,
+// GetSlot возвращает false и меш рисуется цветом material_Kd.
+//
+// Декодированная текстура готовится один раз (см. TextureCache.h): мип-цепочка
+// строится на CPU, сжимается в BC1/BC3/BC4 и записывается в .ctex, при следующих
+// запусках файл отображается в память и уровни уходят на GPU без декодирования.
+//
+// Загрузка в GL идет через кольцо PBO: пиксели копируются в отображенный
+// буфер, а glTexSubImage3D (glCompressedTexSubImage3D у сжатых) читает из него
+// в слой страницы асинхронно, не останавливая кадр.
+// За кадр передается не больше UploadBudget байт; большая текстура
+// загружается полосами строк за несколько кадров.
+//
+// Текстуры не получают отдельных GL объектов: одинаковые по размеру и формату
+// становятся слоями общего GL_TEXTURE_2D_ARRAY, а маленькие текстуры со
+// сторонами-степенями двойки упаковываются в атлас (тоже массив слоев).
+// Вокруг текстуры в атласе рамка, повторяющая ее противоположные края: шейдер
+// повторяет UV внутри прямоугольника текстуры, и фильтрация на всех уровнях
+// у края читает рамку, а не соседнюю текстуру.
+// Меши с текстурами одной страницы рисуются без перепривязки - отличаются
+// только слой и прямоугольник UV (см. GetSlot).
+//
+// Изображения со стороной от VirtualThreshold пикселей целиком не загружаются:
+// они режутся на тайлы и становятся виртуальными текстурами (VirtualTexture.h),
+// на GPU попадают только видимые тайлы.
+//
+// Память ограничена бюджетом (SetMemoryBudget). Для каждой текстуры помнится
+// кадр, когда она последний раз была видна; при превышении бюджета текстуры,
+// дольше всех не попадавшие в кадр, освобождают свой слой или ячейку атласа.
+// Недавно видимые при этом не выгружаются, а перезагружаются без верхнего
+// мип-уровня (в 4 раза меньше), давно не видимые выгружаются целиком.
+// Уменьшенная текстура, снова попавшая в кадр, возвращает уровень, когда
+// бюджет это позволяет. Пустые страницы удаляются.
+//
+// Сторона уровня 0 ограничена пределом (SetMaxTextureSize, для отдельного
+// материала - параметр Request): изображение больше предела уменьшается
+// после декодирования, до загрузки на GPU. JPEG при этом декодируется сразу
+// в 1/2, 1/4 или 1/8 размера, так что полноразмерные пиксели не появляются.
+//
+// Одна и та же картинка загружается один раз. Имена сравниваются после
+// AssetFS::Normalize ("./a.jpg" и "A.JPG" - один дескриптор), а рабочий поток
+// сравнивает хеш байт файла (до декодирования) и хеш декодированных пикселей
+// (копия, пересохраненная без потерь) с уже загружаемыми текстурами. Дескриптор
+// дубликата становится ссылкой на первую текстуру: у них общий слой страницы,
+// видимость и состояние.
+class TextureManager {
+public:
+    TextureManager();
+    ~TextureManager();
+
+    // workerCount = 0 - по числу ядер минус поток рендера
+    void Start(int workerCount = 0);
+    void Stop();
+
+    // Зарегистрировать текстуру (повторный запрос того же файла дает тот же дескриптор).
+    // maxSize - предел стороны для этого запроса (материала): 0 - общий
+    // (SetMaxTextureSize), меньше нуля - без предела. Если файл запрошен
+    // с разными пределами, действует больший: текстура, которая уже
+    // декодируется или загружена с меньшим пределом, перезагружается.
+    // Виртуальные текстуры сохраняют первый предел.
+    TextureHandle Request(const std::string& filename, int maxSize = 0);
+
+    // Меш с этой текстурой виден в текущем кадре
+    void MarkVisible(TextureHandle handle);
+
+    // Начать декодирование, не дожидаясь видимости: LoadMeshes с prefetch
+    // отдает пулу все текстуры модели сразу, и они декодируются параллельно.
+    // Загрузка в GL - как обычно, в Update по порядку готовности; если
+    // бюджет памяти превышен, не попавшие в кадр вытесняются первыми
+    void Prefetch(TextureHandle handle);
+
+    // Загрузка декодированных текстур в GL, вызывается из GL потока между кадрами
+    void Update();
+
+    // Лимит байт, передаваемых на GPU за один Update
+    void SetUploadBudget(size_t bytesPerFrame) { uploadBudget = bytesPerFrame; }
+
+    // Лимит байт загруженных текстур (0 - без лимита); кэш виртуальных
+    // текстур ограничен отдельно
+    void SetMemoryBudget(size_t bytes) { memoryBudget = bytes; }
+
+    // Фильтр мип-уровней и сжатие при приготовлении текстур (задаются до Start)
+    void SetMipSettings(const MipSettings& settings) { cookSettings.mips = settings; }
+    void SetCompression(bool compress) { cookSettings.compress = compress; }
+
+    // Неизменяемое хранилище страниц и кэша тайлов (glTexStorage*), если
+    // драйвер поддерживает ARB_texture_storage (задается до первой загрузки)
+    void SetImmutableStorage(bool immutable) {
+        immutableStorage = immutable;
+        virtualTextures.SetImmutableStorage(immutable);
+    }
+
+    // Общий предел стороны текстуры (0 - без предела) и фильтр уменьшения;
+    // задается до Request
+    void SetMaxTextureSize(int pixels, MipFilter filter = MipFilter::Lanczos) {
+        cookSettings.maxSize = pixels;
+        cookSettings.downscaleFilter = filter;
+    }
+
+    // Индекс файлов, по которому ищутся текстуры (задается до Start; без него
+    // имя файла открывается как есть)
+    void SetFileSystem(const AssetFS* fs) { assets = fs; }
+
+    // Сторона изображения, начиная с которой текстура становится виртуальной (0 - никогда)
+    void SetVirtualThreshold(int pixels) { virtualThreshold = pixels; }
+    VirtualTextureCache& VirtualTextures() { return virtualTextures; }
+
+    // Слой с текстурой; false, если она еще не загружена
+    bool GetSlot(TextureHandle handle, TextureSlot& slot) const;
+    TextureState GetState(TextureHandle handle) const;
+
+    // Освободить все GL текстуры и PBO (GL поток, перед уничтожением контекста)
+    void DeleteTextures();
+
+    int ResidentCount() const { return residentCount; }
+    size_t ResidentBytes() const { return residentBytes; }
+    TextureStats GetStats() const;
+
+private:
+    // Место текстуры на странице
+    struct Placement {
+        int page;          // индекс в pages, -1 - место не выделено
+        int layer, x, y;   // слой и угол текстуры (без рамки) в пикселях уровня 0 страницы
+        int width, height;
+        int gutter;        // рамка атласа вокруг текстуры, пикселей уровня 0 (в массиве 0)
+    };
+
+    struct Entry {
+        std::string filename;
+        TextureState state;
+        Placement place;
+        int virtualId;     // номер в virtualTextures, -1 - обычная текстура
+        unsigned lastUsed; // кадр, в котором текстура последний раз была видна
+        size_t bytes;      // загружено в GL
+        int dropped;       // пропущено верхних мип-уровней из-за бюджета
+        unsigned droppedAt; // lastUsed при последнем уменьшении
+        bool reloading;    // грузится версия с другим числом уровней, текущая пока рисуется
+        size_t reclaim;    // сколько байт освободит грузящаяся уменьшенная версия
+        int maxSize;       // предел стороны уровня 0, 0 - без предела
+        bool stale;        // предел вырос, пока текстура грузилась - перезагрузить в Finish
+        TextureHandle alias; // совпадает по содержимому с этой текстурой, NoTexture - своя
+    };
+
+    // Общий GL_TEXTURE_2D_ARRAY для текстур одного размера и формата (или атлас).
+    // texture = 0 - страница удалена, ее индекс используется следующей
+    struct TexturePage {
+        GLuint texture;
+        int width, height, levels, layers;
+        BlockFormat format;
+        int components;
+        bool atlas;
+        int residents;     // текстур на странице (вместе с загружаемыми)
+        size_t bytes;
+        // Массив: свободные слои
+        std::vector<int> freeLayers;
+        // Атлас: свободные квадратные ячейки (x, y, сторона) каждого слоя
+        std::vector<std::vector<int>> freeCells;
+    };
+
+    // Заявка рабочему потоку
+    struct DecodeJob {
+        TextureHandle handle;
+        std::string filename;
+        int skipLevels;    // не загружать столько верхних мип-уровней
+        int maxSize;       // предел стороны уровня 0 (CookSettings::maxSize)
+    };
+
+    // Результат рабочего потока; image и tiled пусты, если файл не прочитан
+    struct Decoded {
+        TextureHandle handle;
+        std::string path;
+        std::unique_ptr<CookedTexture> image;
+        std::unique_ptr<TiledTexture> tiled; // виртуальная текстура вместо image
+        bool cached; // из .ctex/.vtex, без декодирования
+        int skipped; // пропущено верхних уровней
+        TextureHandle duplicateOf; // то же содержимое уже у этой текстуры (image пуст)
+    };
+
+    // Текстура, загружаемая в GL по частям (только GL поток)
+    struct Upload {
+        Decoded decoded;
+        Placement target;
+        int level;
+        int levelCount; // в атласе грузятся только первые AtlasLevels уровней
+        int rowsDone;   // у сжатой текстуры - строк блоков
+        // Загружаемые уровни: decoded.image->levels, в атласе - их копии
+        // с рамкой в padded (заполняются в Place)
+        std::vector<CookedLevel> levels;
+        std::vector<unsigned char> padded;
+    };
+
+    // Элемент кольца PBO; fence сигналит, когда GPU дочитал буфер
+    struct PixelBuffer {
+        GLuint buffer;
+        size_t capacity;
+        GLsync fence;
+    };
+
+    static const int RingSize = 3;
+
+    // Атлас: слои AtlasSize x AtlasSize, текстуры со сторонами AtlasMinTile..AtlasMaxTile.
+    // При AtlasLevels уровнях у самой маленькой текстуры последний уровень 4x4.
+    // Рамка - AtlasGutter пикселей уровня 0, на последнем уровне это 1 пиксель;
+    // у сжатых текстур в 4 раза шире, чтобы на всех уровнях и текстура, и рамка
+    // начинались с границы блока BC (см. GutterFor).
+    static const int AtlasSize = 1024;
+    static const int AtlasLayers = 4;
+    static const int AtlasLevels = 4;
+    static const int AtlasMinTile = 32;
+    static const int AtlasMaxTile = 128;
+    static const int AtlasGutter = 1 << (AtlasLevels - 1);
+
+    // Страница-массив занимает не больше этого (число слоев подбирается по размеру)
+    static const size_t ArrayPageBytes = 64 * 1024 * 1024;
+    static const int MaxArrayLayers = 16;
+
+    // Вытесняются только текстуры, не попадавшие в кадр дольше ProtectFrames кадров;
+    // видимые не раньше DropFrames кадров назад теряют верхний уровень, а не выгружаются
+    static const unsigned ProtectFrames = 2;
+    static const unsigned DropFrames = 600;
+    static const int MaxDroppedLevels = 3;
+    // Меньше этой стороны текстура не уменьшается
+    static const int MinDropSize = 32;
+
+    void Run();
+    Decoded Decode(const DecodeJob& job);
+    bool FindDuplicate(std::map<uint64_t, TextureHandle>& owners, uint64_t hash, Decoded& d);
+    TextureHandle Canonical(TextureHandle handle) const;
+    bool DecodeTiled(const std::string& path, const CookSettings& settings, Decoded& d) const;
+    bool UploadRows(Upload& upload, size_t& sent);
+    PixelBuffer* AcquireBuffer(size_t bytes);
+    void Place(Upload& upload);
+    bool PlaceInAtlas(Placement& place, const CookedTexture& image);
+    void PadLevels(Upload& upload);
+    static int GutterFor(BlockFormat format);
+    static int CellSize(const Placement& place);
+    void PlaceInArray(Placement& place, const CookedTexture& image);
+    int CreatePage(const CookedTexture& image, int width, int height, int levels, int layers, bool atlas);
+    void Release(Placement& place);
+    void Finish(Upload& upload);
+    void Fail(const Decoded& image);
+    void Queue(TextureHandle handle, int skipLevels);
+    void RaiseLimit(TextureHandle handle);
+    void EnforceBudget();
+    void Evict(TextureHandle handle);
+
+    std::vector<Entry> entries; // entries[0] не используется (NoTexture)
+    std::map<std::string, TextureHandle> byName;
+    int residentCount;
+    size_t residentBytes;
+    size_t reclaimBytes; // освободится, когда догрузятся уменьшенные версии
+    size_t allocatedBytes;
+    size_t memoryBudget;
+    unsigned frame;
+    uint64_t hits, misses, evictions, drops;
+
+    std::vector<TexturePage> pages;
+    std::deque<Upload> uploads;
+    PixelBuffer ring[RingSize];
+    int ringNext;
+    size_t uploadBudget;
+    bool immutableStorage;
+    CookSettings cookSettings;
+    const AssetFS* assets;
+    int virtualThreshold;
+    VirtualTextureCache virtualTextures;
+
+    std::vector<std::thread> workers;
+    std::atomic<bool> running;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<DecodeJob> jobs;
+    std::vector<Decoded> done;
+    // Первая текстура с данным хешем файла / пикселей (под mutex)
+    std::map<uint64_t, TextureHandle> bySource, byPixels;
+};
@@ -0,0 +1,429 @@
+﻿#include "VirtualTexture.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+VirtualTextureCache::VirtualTextureCache()
+    : cache(0), cacheTiles(15), frame(0), uploadBudget(4 * 1024 * 1024), immutableStorage(false),
+    feedbackFBO(0), feedbackColor(0), feedbackDepth(0), feedbackWidth(0), feedbackHeight(0),
+    readbackNext(0), running(false) {
+    for (auto& r : readbacks) {
+        r = { 0, nullptr };
+    }
+}
+
+VirtualTextureCache::~VirtualTextureCache() {
+    Stop();
+}
+
+void VirtualTextureCache::Start() {
+    if (running) return;
+    running = true;
+    worker = std::thread(&VirtualTextureCache::Run, this);
+}
+
+void VirtualTextureCache::Stop() {
+    if (!running) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+    worker.join();
+
+    jobs.clear();
+    done.clear();
+}
+
+int VirtualTextureCache::Add(std::unique_ptr<TiledTexture> image) {
+    if (cache == 0) {
+        CreateCache();
+    }
+
+    VirtualTexture vt;
+    const int levels = (int)image->levels.size();
+    vt.slotOf.resize(levels);
+    for (int i = 0; i < levels; i++) {
+        vt.slotOf[i].assign((size_t)image->levels[i].tilesX * image->levels[i].tilesY, -1);
+    }
+
+    // Мип-уровни таблицы страниц - ровно сетки тайлов уровней текстуры
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glGenTextures(1, &vt.pageTable);
+    glBindTexture(GL_TEXTURE_2D, vt.pageTable);
+    if (immutableStorage) {
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, image->levels[0].tilesX, image->levels[0].tilesY);
+    }
+    else {
+        for (int i = 0; i < levels; i++) {
+            glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, image->levels[i].tilesX, image->levels[i].tilesY, 0,
+                GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    vt.dirty = true;
+    vt.image = std::move(image);
+    textures.push_back(std::move(vt));
+    const int id = (int)textures.size() - 1;
+
+    // Самый грубый тайл закреплен: к нему сводится любая выборка
+    int slot = AllocateSlot();
+    if (slot < 0) {
+        std::cout << "ОШИБКА: Нет места в кэше виртуальных текстур" << std::endl;
+        return id;
+    }
+    LoadTile(id, levels - 1, 0, 0, slot, true);
+    return id;
+}
+
+bool VirtualTextureCache::Ready(int id) const {
+    if (id < 0 || id >= (int)textures.size()) return false;
+    int root = textures[id].slotOf.back()[0];
+    return root >= 0 && slots[root].resident;
+}
+
+bool VirtualTextureCache::GetBinding(int id, VirtualBinding& binding) const {
+    if (!Ready(id)) return false;
+    const TiledTexture& image = *textures[id].image;
+    binding.pageTable = textures[id].pageTable;
+    binding.cache = cache;
+    binding.width = (float)image.width;
+    binding.height = (float)image.height;
+    binding.maxLevel = (float)(image.levels.size() - 1);
+    binding.cacheSize = (float)(cacheTiles * VirtualTileStride);
+    return true;
+}
+
+float VirtualTextureCache::FeedbackBias() const {
+    return -std::log2((float)FeedbackScale);
+}
+
+int VirtualTextureCache::ResidentTiles() const {
+    int count = 0;
+    for (const auto& slot : slots) {
+        if (slot.resident) count++;
+    }
+    return count;
+}
+
+void VirtualTextureCache::Update() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& tile : done) {
+            loaded.push_back(std::move(tile));
+        }
+        done.clear();
+    }
+
+    // Прочитанные тайлы - в свои ячейки кэша
+    size_t sent = 0;
+    if (!loaded.empty()) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, cache);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    }
+    while (!loaded.empty() && sent < uploadBudget) {
+        LoadedTile& tile = loaded.front();
+        Slot& slot = slots[tile.slot];
+        glTexSubImage2D(GL_TEXTURE_2D, 0,
+            (tile.slot % cacheTiles) * VirtualTileStride, (tile.slot / cacheTiles) * VirtualTileStride,
+            VirtualTileStride, VirtualTileStride, GL_RGBA, GL_UNSIGNED_BYTE, tile.pixels.data());
+        slot.resident = true;
+        textures[slot.texture].dirty = true;
+        sent += tile.pixels.size();
+        loaded.pop_front();
+    }
+
+    ReadFeedback();
+
+    for (auto& vt : textures) {
+        if (vt.dirty) {
+            UpdatePageTable(vt);
+        }
+    }
+}
+
+void VirtualTextureCache::BeginFeedback(int viewportWidth, int viewportHeight) {
+    int width = std::max(1, viewportWidth / FeedbackScale);
+    int height = std::max(1, viewportHeight / FeedbackScale);
+    if (width != feedbackWidth || height != feedbackHeight) {
+        CreateFeedback(width, height);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+    glViewport(0, 0, width, height);
+    // Нулевой пиксель - виртуальной текстуры нет
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTextureCache::EndFeedback() {
+    // Копирование идет в PBO асинхронно; если оба буфера еще не разобраны,
+    // кадр пропускается, а не ждет GPU
+    Readback& r = readbacks[readbackNext];
+    if (!r.fence) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackNext = (readbackNext + 1) % 2;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VirtualTextureCache::CreateCache() {
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    cacheTiles = std::max(1, std::min(cacheTiles, (int)maxSize / VirtualTileStride));
+    const int side = cacheTiles * VirtualTileStride;
+
+    glGenTextures(1, &cache);
+    glBindTexture(GL_TEXTURE_2D, cache);
+    if (immutableStorage) {
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, side, side);
+    }
+    else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, side, side, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    slots.assign((size_t)cacheTiles * cacheTiles, { -1, 0, 0, 0, 0, false, false });
+    std::cout << "Кэш виртуальных текстур: " << side << "x" << side << " (" << slots.size()
+        << " тайлов, " << CacheBytes() / (1024 * 1024) << " МБ)" << std::endl;
+}
+
+void VirtualTextureCache::CreateFeedback(int width, int height) {
+    if (!feedbackFBO) {
+        glGenFramebuffers(1, &feedbackFBO);
+        glGenTextures(1, &feedbackColor);
+        glGenRenderbuffers(1, &feedbackDepth);
+    }
+    feedbackWidth = width;
+    feedbackHeight = height;
+
+    glBindTexture(GL_TEXTURE_2D, feedbackColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "ОШИБКА: Framebuffer обратной связи не complete!" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Прежние PBO другого размера - их содержимое больше не нужно
+    for (auto& r : readbacks) {
+        if (r.fence) glDeleteSync(r.fence);
+        if (!r.buffer) glGenBuffers(1, &r.buffer);
+        r.fence = nullptr;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Разбор готовых PBO обратной связи, от старого к новому
+void VirtualTextureCache::ReadFeedback() {
+    const int count = feedbackWidth * feedbackHeight;
+    for (int i = 0; i < 2; i++) {
+        Readback& r = readbacks[(readbackNext + i) % 2];
+        if (!r.fence) continue;
+        if (glClientWaitSync(r.fence, 0, 0) == GL_TIMEOUT_EXPIRED) continue;
+        glDeleteSync(r.fence);
+        r.fence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, r.buffer);
+        const unsigned char* pixels = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+            (GLsizeiptr)count * 4, GL_MAP_READ_BIT);
+        if (pixels) {
+            ProcessFeedback(pixels, count);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+// Пиксель обратной связи: R - номер текстуры + 1, G - уровень, B, A - тайл.
+// Видимые тайлы и все их предки отмечаются использованными в этом кадре,
+// недостающие заказываются от грубых к точным.
+void VirtualTextureCache::ProcessFeedback(const unsigned char* pixels, int count) {
+    frame++;
+
+    std::vector<uint32_t> keys;
+    keys.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const unsigned char* p = pixels + (size_t)i * 4;
+        if (p[0] == 0) continue;
+        keys.push_back((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<TileRequest> missing;
+    for (uint32_t key : keys) {
+        int id = (int)(key >> 24) - 1;
+        int level = (int)(key >> 16 & 0xFF);
+        int tx = (int)(key >> 8 & 0xFF), ty = (int)(key & 0xFF);
+        if (id >= (int)textures.size()) continue;
+        VirtualTexture& vt = textures[id];
+        const int levels = (int)vt.image->levels.size();
+        if (level >= levels) continue;
+        if (tx >= vt.image->levels[level].tilesX || ty >= vt.image->levels[level].tilesY) continue;
+
+        for (int l = level; l < levels; l++, tx >>= 1, ty >>= 1) {
+            int slot = vt.slotOf[l][(size_t)ty * vt.image->levels[l].tilesX + tx];
+            if (slot >= 0) {
+                slots[slot].lastUsed = frame;
+            }
+            else {
+                missing.push_back({ id, l, tx, ty });
+            }
+        }
+    }
+
+    std::sort(missing.begin(), missing.end(), [](const TileRequest& a, const TileRequest& b) {
+        if (a.level != b.level) return a.level > b.level;
+        if (a.texture != b.texture) return a.texture < b.texture;
+        return a.ty != b.ty ? a.ty < b.ty : a.tx < b.tx;
+    });
+    missing.erase(std::unique(missing.begin(), missing.end(), [](const TileRequest& a, const TileRequest& b) {
+        return a.texture == b.texture && a.level == b.level && a.tx == b.tx && a.ty == b.ty;
+    }), missing.end());
+
+    int requested = 0;
+    for (const auto& request : missing) {
+        if (requested == MaxRequestsPerFrame) break;
+        int slot = AllocateSlot();
+        // Кэш занят тайлами этого кадра - остальные подождут
+        if (slot < 0) break;
+        LoadTile(request.texture, request.level, request.tx, request.ty, slot, false);
+        requested++;
+    }
+}
+
+// Свободная ячейка или ячейка тайла, дольше всех не попадавшего в кадр.
+// Читаемые, закрепленные и видимые в этом кадре тайлы не вытесняются.
+int VirtualTextureCache::AllocateSlot() {
+    int oldest = -1;
+    for (int i = 0; i < (int)slots.size(); i++) {
+        const Slot& slot = slots[i];
+        if (slot.texture < 0) return i;
+        if (!slot.resident || slot.pinned || slot.lastUsed == frame) continue;
+        if (oldest < 0 || slot.lastUsed < slots[oldest].lastUsed) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) return -1;
+
+    Slot& slot = slots[oldest];
+    VirtualTexture& vt = textures[slot.texture];
+    vt.slotOf[slot.level][(size_t)slot.ty * vt.image->levels[slot.level].tilesX + slot.tx] = -1;
+    vt.dirty = true;
+    slot.texture = -1;
+    slot.resident = false;
+    return oldest;
+}
+
+void VirtualTextureCache::LoadTile(int texture, int level, int tx, int ty, int slot, bool pinned) {
+    VirtualTexture& vt = textures[texture];
+    slots[slot] = { texture, level, tx, ty, frame, false, pinned };
+    vt.slotOf[level][(size_t)ty * vt.image->levels[level].tilesX + tx] = slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({ slot, vt.image->Tile(level, tx, ty) });
+    }
+    wake.notify_one();
+}
+
+// Таблица страниц строится от грубого уровня к точному: тайл, которого нет
+// в кэше, наследует запись родителя (ближайшего загруженного предка)
+void VirtualTextureCache::UpdatePageTable(VirtualTexture& vt) {
+    const TiledTexture& image = *vt.image;
+    const int levels = (int)image.levels.size();
+    std::vector<unsigned char> parent, current;
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, vt.pageTable);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int l = levels - 1; l >= 0; l--) {
+        const TiledLevel& level = image.levels[l];
+        current.assign((size_t)level.tilesX * level.tilesY * 4, 0);
+        for (int ty = 0; ty < level.tilesY; ty++) {
+            for (int tx = 0; tx < level.tilesX; tx++) {
+                unsigned char* entry = &current[((size_t)ty * level.tilesX + tx) * 4];
+                int slot = vt.slotOf[l][(size_t)ty * level.tilesX + tx];
+                if (slot >= 0 && slots[slot].resident) {
+                    entry[0] = (unsigned char)(slot % cacheTiles);
+                    entry[1] = (unsigned char)(slot / cacheTiles);
+                    entry[2] = (unsigned char)l;
+                    entry[3] = 255;
+                }
+                else if (l + 1 < levels) {
+                    const int parentTilesX = image.levels[l + 1].tilesX;
+                    const unsigned char* from = &parent[((size_t)(ty >> 1) * parentTilesX + (tx >> 1)) * 4];
+                    std::copy(from, from + 4, entry);
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, level.tilesX, level.tilesY, GL_RGBA, GL_UNSIGNED_BYTE, current.data());
+        parent.swap(current);
+    }
+    vt.dirty = false;
+}
+
+void VirtualTextureCache::DeleteTextures() {
+    for (auto& vt : textures) {
+        glDeleteTextures(1, &vt.pageTable);
+    }
+    textures.clear();
+    slots.clear();
+    loaded.clear();
+    if (cache) glDeleteTextures(1, &cache);
+    cache = 0;
+
+    for (auto& r : readbacks) {
+        if (r.fence) glDeleteSync(r.fence);
+        if (r.buffer) glDeleteBuffers(1, &r.buffer);
+        r = { 0, nullptr };
+    }
+    if (feedbackFBO) {
+        glDeleteFramebuffers(1, &feedbackFBO);
+        glDeleteTextures(1, &feedbackColor);
+        glDeleteRenderbuffers(1, &feedbackDepth);
+    }
+    feedbackFBO = feedbackColor = feedbackDepth = 0;
+    feedbackWidth = feedbackHeight = 0;
+}
+
+// Рабочий поток: тайл копируется из отображенного файла, так что чтение
+// страниц с диска происходит здесь, а не в GL потоке
+void VirtualTextureCache::Run() {
+    while (true) {
+        TileJob job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return !running || !jobs.empty(); });
+            if (!running) return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        LoadedTile tile;
+        tile.slot = job.slot;
+        tile.pixels.assign(job.source, job.source + VirtualTileBytes);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(std::move(tile));
+    }
+}
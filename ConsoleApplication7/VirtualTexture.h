@@ -0,0 +1,146 @@
+﻿#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+#include "TextureCache.h"
+
+// Что нужно шейдеру для выборки из виртуальной текстуры
+struct VirtualBinding {
+    GLuint pageTable;    // GL_TEXTURE_2D RGBA8, мип-уровень на каждый уровень текстуры
+    GLuint cache;        // GL_TEXTURE_2D RGBA8, общий кэш тайлов
+    float width, height; // размер уровня 0 в пикселях
+    float maxLevel;
+    float cacheSize;     // сторона кэша в пикселях
+};
+
+// Виртуальные текстуры для изображений, которые не стоит держать в памяти целиком.
+//
+// Изображение один раз режется на тайлы по всем мип-уровням (.vtex, см.
+// TiledTexture), файл отображается в память. На GPU лежат только нужные тайлы:
+// - кэш тайлов - одна текстура из CacheTiles x CacheTiles ячеек, общая для всех
+//   виртуальных текстур; занятая память не зависит от размера изображений;
+// - таблица страниц у каждой текстуры - по текселю на тайл каждого уровня:
+//   ячейка кэша (R, G) и уровень тайла, который в ней лежит (B). Если тайла
+//   нет в кэше, в таблицу пишется ближайший загруженный предок - выборка
+//   получается размытой, но не пустой. Самый грубый тайл закреплен в кэше.
+//
+// Какие тайлы нужны, определяет проход обратной связи: меши с виртуальными
+// текстурами рисуются в буфер 1/FeedbackScale разрешения, каждый пиксель
+// которого - номер текстуры, уровень и тайл. Буфер читается через PBO кадром
+// позже, недостающие тайлы (сначала грубые) отдаются рабочему потоку, который
+// читает их из отображенного файла, а в GL они загружаются в Update. Если кэш
+// полон, вытесняются тайлы, дольше всех не попадавшие в кадр.
+class VirtualTextureCache {
+public:
+    VirtualTextureCache();
+    ~VirtualTextureCache();
+
+    void Start();
+    void Stop();
+
+    // Сторона кэша в тайлах (до первой текстуры)
+    void SetCacheTiles(int tilesPerSide) { cacheTiles = tilesPerSide; }
+    // Лимит байт тайлов, передаваемых на GPU за один Update
+    void SetUploadBudget(size_t bytesPerFrame) { uploadBudget = bytesPerFrame; }
+    // Кэш и таблицы страниц в неизменяемом хранилище (glTexStorage2D)
+    void SetImmutableStorage(bool immutable) { immutableStorage = immutable; }
+
+    // Зарегистрировать тайловую текстуру (GL поток), возвращает ее номер
+    int Add(std::unique_ptr<TiledTexture> image);
+
+    // Загрузка прочитанных тайлов, разбор обратной связи, обновление таблиц страниц
+    void Update();
+
+    // Текстура готова к выборке - закрепленный тайл загружен
+    bool Ready(int id) const;
+    bool GetBinding(int id, VirtualBinding& binding) const;
+
+    // Проход обратной связи: между Begin и End рисуются меши с виртуальными
+    // текстурами шейдером обратной связи, к уровню прибавляется FeedbackBias
+    void BeginFeedback(int viewportWidth, int viewportHeight);
+    void EndFeedback();
+    float FeedbackBias() const;
+
+    // Освободить все GL объекты (GL поток, перед уничтожением контекста)
+    void DeleteTextures();
+
+    int Count() const { return (int)textures.size(); }
+    int ResidentTiles() const;
+    size_t CacheBytes() const { return (size_t)cacheTiles * cacheTiles * VirtualTileBytes; }
+
+private:
+    struct VirtualTexture {
+        std::unique_ptr<TiledTexture> image;
+        GLuint pageTable;
+        std::vector<std::vector<int>> slotOf; // по уровням: ячейка кэша тайла, -1 - нет
+        bool dirty;                           // таблицу страниц нужно перезалить
+    };
+
+    // Ячейка кэша; texture = -1 - свободна, resident = false - тайл еще читается
+    struct Slot {
+        int texture, level, tx, ty;
+        unsigned lastUsed;
+        bool resident, pinned;
+    };
+
+    struct TileJob {
+        int slot;
+        const unsigned char* source; // тайл в отображенном .vtex
+    };
+
+    struct LoadedTile {
+        int slot;
+        std::vector<unsigned char> pixels;
+    };
+
+    struct TileRequest {
+        int texture, level, tx, ty;
+    };
+
+    // PBO чтения обратной связи; fence сигналит, когда пиксели скопированы
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+    };
+
+    // Буфер обратной связи меньше экрана во столько раз по каждой стороне
+    static const int FeedbackScale = 8;
+    // Новых тайлов за один разбор обратной связи
+    static const int MaxRequestsPerFrame = 32;
+
+    void Run();
+    void CreateCache();
+    void CreateFeedback(int width, int height);
+    void ReadFeedback();
+    void ProcessFeedback(const unsigned char* pixels, int count);
+    int AllocateSlot();
+    void LoadTile(int texture, int level, int tx, int ty, int slot, bool pinned);
+    void UpdatePageTable(VirtualTexture& vt);
+
+    std::vector<VirtualTexture> textures;
+    std::vector<Slot> slots;
+    GLuint cache;
+    int cacheTiles;
+    unsigned frame;
+    size_t uploadBudget;
+    bool immutableStorage;
+    std::deque<LoadedTile> loaded;
+
+    GLuint feedbackFBO, feedbackColor, feedbackDepth;
+    int feedbackWidth, feedbackHeight;
+    Readback readbacks[2];
+    int readbackNext;
+
+    std::thread worker;
+    std::atomic<bool> running;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TileJob> jobs;
+    std::vector<LoadedTile> done;
+};
@@ -274,6 +274,16 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// The JPEG colour conversion and 2x2 chroma upsampling also have AVX2
+// versions, selected at run time on CPUs that support it; define
+// STBI_NO_AVX2 to leave them out.
+//
+// In C++ builds, defining STBI_JPEG_THREADS to a thread count lets large
+// baseline JPEGs with restart markers be decoded from memory in parallel,
+// one run of restart intervals per thread. stbi_set_jpeg_threads (and the
+// _thread variant) lower that count at run time; a loader that already
+// runs one image per core should set 1 on its worker threads.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -517,12 +527,23 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// decode JPEGs at 1/denom of their size (denom 2, 4 or 8; 1 is full size).
+// each 8x8 block goes through a smaller inverse DCT of its low frequencies,
+// so the full-size image is never produced. other formats are unaffected.
+STBIDEF void stbi_set_jpeg_scale_denom(int denom);
+
+// at most this many threads for one JPEG when built with STBI_JPEG_THREADS
+// (capped by that value; 1 decodes on the calling thread only)
+STBIDEF void stbi_set_jpeg_threads(int threads);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
 STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpremultiply);
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
+STBIDEF void stbi_set_jpeg_scale_denom_thread(int denom);
+STBIDEF void stbi_set_jpeg_threads_thread(int threads);
 
 // ZLIB client - used by PNG, available for other purposes
 
@@ -598,6 +619,15 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #include <stdio.h>
 #endif
 
+// STBI_JPEG_THREADS n: decode the restart intervals of large baseline JPEGs
+// loaded from memory on up to n threads (needs C++11 for std::thread)
+#if defined(STBI_JPEG_THREADS) && defined(__cplusplus) && !defined(STBI_NO_JPEG)
+#define STBI__JPEG_THREADS
+#include <thread>
+#include <vector>
+#define STBI__JPEG_PARALLEL_PIXELS (1 << 20) // smaller images aren't worth the threads
+#endif
+
 #ifndef STBI_ASSERT
 #include <assert.h>
 #define STBI_ASSERT(x) assert(x)
@@ -774,6 +804,39 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2 kernels are compiled alongside the SSE2 ones with a per-function
+// target, and are only picked at run time if the CPU and OS support them,
+// so the build itself doesn't need /arch:AVX2 or -mavx2.
+//
+// #define STBI_NO_AVX2 to leave them out.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG) && \
+    ((defined(_MSC_VER) && _MSC_VER >= 1900) || (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   __cpuid(info,0);
+   if (info[0] < 7) return 0;
+   __cpuid(info,1);
+   // OSXSAVE and AVX, and the OS must save the YMM state (XCR0 bits 1-2)
+   if ((info[2] & (3 << 27)) != (3 << 27)) return 0;
+   if ((_xgetbv(0) & 6) != 6) return 0;
+   __cpuidex(info,7,0);
+   return (info[1] >> 5) & 1;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+   return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -1134,6 +1197,56 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_scale_denom_global = 1;
+
+STBIDEF void stbi_set_jpeg_scale_denom(int denom)
+{
+   stbi__jpeg_scale_denom_global = denom;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_denom  stbi__jpeg_scale_denom_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_denom_local, stbi__jpeg_scale_denom_set;
+
+STBIDEF void stbi_set_jpeg_scale_denom_thread(int denom)
+{
+   stbi__jpeg_scale_denom_local = denom;
+   stbi__jpeg_scale_denom_set = 1;
+}
+
+#define stbi__jpeg_scale_denom  (stbi__jpeg_scale_denom_set         \
+                                  ? stbi__jpeg_scale_denom_local    \
+                                  : stbi__jpeg_scale_denom_global)
+#endif // STBI_THREAD_LOCAL
+
+#ifdef STBI_JPEG_THREADS
+static int stbi__jpeg_threads_global = STBI_JPEG_THREADS;
+#else
+static int stbi__jpeg_threads_global = 1;
+#endif
+
+STBIDEF void stbi_set_jpeg_threads(int threads)
+{
+   stbi__jpeg_threads_global = threads;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_threads  stbi__jpeg_threads_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_threads_local, stbi__jpeg_threads_set;
+
+STBIDEF void stbi_set_jpeg_threads_thread(int threads)
+{
+   stbi__jpeg_threads_local = threads;
+   stbi__jpeg_threads_set = 1;
+}
+
+#define stbi__jpeg_threads  (stbi__jpeg_threads_set         \
+                              ? stbi__jpeg_threads_local    \
+                              : stbi__jpeg_threads_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1993,6 +2106,8 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift; // blocks decode to (8 >> scale_shift) pixels a side
+
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2523,6 +2638,62 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// scaled decoding: the n-point inverse DCT of the lowest n x n frequencies
+// of a block gives the block at n/8 size. with the basis c(u)/2 *
+// cos((2x+1)u*pi/2n), c(0) = 1/sqrt(2), the normalization is the same as
+// the full 8x8 transform, e.g. n = 1 gives the block average, dc/8.
+//
+// 4-point version, split into even and odd halves like the 8-point one:
+//    out0,3 = e0 +- o0,   out1,2 = e1 +- o1
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   int e0 = (s0 + s2) * stbi__f2f(0.35355339f); \
+   int e1 = (s0 - s2) * stbi__f2f(0.35355339f); \
+   int o0 = s1 * stbi__f2f(0.46193977f) + s3 * stbi__f2f(0.19134172f); \
+   int o1 = s1 * stbi__f2f(0.19134172f) - s3 * stbi__f2f(0.46193977f);
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i, val[16], *v=val;
+   short *d = data;
+   stbi_uc *o;
+
+   // columns; keep 2 extra bits like stbi__idct_block
+   for (i=0; i < 4; ++i, ++d, ++v) {
+      STBI__IDCT_4(d[0], d[8], d[16], d[24])
+      v[ 0] = (e0 + o0 + 512) >> 10;
+      v[12] = (e0 - o0 + 512) >> 10;
+      v[ 4] = (e1 + o1 + 512) >> 10;
+      v[ 8] = (e1 - o1 + 512) >> 10;
+   }
+
+   // rows, then descale with rounding and the +128 level shift
+   for (i=0, v=val, o=out; i < 4; ++i, v+=4, o+=out_stride) {
+      STBI__IDCT_4(v[0], v[1], v[2], v[3])
+      e0 += (128 << 14) + (1 << 13);
+      e1 += (128 << 14) + (1 << 13);
+      o[0] = stbi__clamp((e0 + o0) >> 14);
+      o[3] = stbi__clamp((e0 - o0) >> 14);
+      o[1] = stbi__clamp((e1 + o1) >> 14);
+      o[2] = stbi__clamp((e1 - o1) >> 14);
+   }
+}
+
+// 2-point basis products are all +-1/8
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   int a = data[0] + 4 + (128 << 3), b = data[1], c = data[8], d = data[9];
+   out[0]            = stbi__clamp((a + b + c + d) >> 3);
+   out[1]            = stbi__clamp((a - b + c - d) >> 3);
+   out[out_stride  ] = stbi__clamp((a + b - c - d) >> 3);
+   out[out_stride+1] = stbi__clamp((a - b - c + d) >> 3);
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp((data[0] + 4 + (128 << 3)) >> 3);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2946,67 +3117,203 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// decode the baseline MCUs [first, last) of the current scan, in scan order;
+// in a non-interleaved scan every block is an MCU. *next receives the MCU
+// after the last one decoded, which is less than last if the data stopped
+// at a marker other than a restart.
+static int stbi__jpeg_decode_mcus(stbi__jpeg *z, int first, int last, int *next)
+{
+   int m = first;
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      // non-interleaved data, we just need to process one block at a time,
+      // in trivial scanline order
+      // number of blocks to do just depends on how many actual "pixels" this
+      // component has, independent of interleaved MCU blocking and such
+      int w = (z->img_comp[n].x+7) >> 3;
+      int bs = 8 >> z->scale_shift;
+      int i = first % w, j = first / w;
+      for (; m < last; ++m) {
+         int ha = z->img_comp[n].ha;
+         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
+         if (++i == w) { i = 0; ++j; }
+         // every data block is an MCU, so countdown the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            // if it's NOT a restart, then just bail, so we get corrupt data
+            // rather than no data
+            if (!STBI__RESTART(z->marker)) { *next = m+1; return 1; }
+            stbi__jpeg_reset(z);
+         }
+      }
+   } else { // interleaved
+      int i = first % z->img_mcu_x, j = first / z->img_mcu_x, k,x,y;
+      int bs = 8 >> z->scale_shift;
+      for (; m < last; ++m) {
+         // scan an interleaved mcu... process scan_n components in order
+         for (k=0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            // scan out an mcu's worth of this component; that's just determined
+            // by the basic H and V specified for the component
+            for (y=0; y < z->img_comp[n].v; ++y) {
+               for (x=0; x < z->img_comp[n].h; ++x) {
+                  int x2 = (i*z->img_comp[n].h + x)*bs;
+                  int y2 = (j*z->img_comp[n].v + y)*bs;
+                  int ha = z->img_comp[n].ha;
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+               }
+            }
+         }
+         if (++i == z->img_mcu_x) { i = 0; ++j; }
+         // after all interleaved components, that's an interleaved MCU,
+         // so now count down the restart interval
+         if (--z->todo <= 0) {
+            if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+            if (!STBI__RESTART(z->marker)) { *next = m+1; return 1; }
+            stbi__jpeg_reset(z);
+         }
+      }
+   }
+   *next = last;
+   return 1;
+}
+
+#ifdef STBI__JPEG_THREADS
+// Restart markers reset the entropy decoder and the DC predictions, so the
+// intervals between them can be decoded independently, each into its own
+// blocks of the component planes. For a large baseline scan read from
+// memory, find where every interval starts and hand contiguous runs of
+// intervals to worker threads; the calling thread takes the last run, so
+// its decoder ends up in the same state as after a serial decode.
+// Returns -1 if the scan isn't suitable, otherwise the decode result.
+static int stbi__jpeg_decode_parallel(stbi__jpeg *z, int total)
+{
+   stbi__context *s = z->s;
+   stbi_uc *p, *end = s->img_buffer_end, **starts;
+   int ri = z->restart_interval, segments, count, threads, t, next, result = 0, ok = 1;
+
+   if (ri == 0 || s->io.read != NULL) return -1; // no restarts, or not from memory
+   if ((double) s->img_x * s->img_y < STBI__JPEG_PARALLEL_PIXELS) return -1;
+   segments = (total + ri - 1) / ri;
+   threads = (int) std::thread::hardware_concurrency();
+   if (threads > STBI_JPEG_THREADS) threads = STBI_JPEG_THREADS;
+   if (threads > stbi__jpeg_threads) threads = stbi__jpeg_threads;
+   if (threads > segments) threads = segments;
+   if (threads < 2) return -1;
+
+   // every interval but the first begins right after its RSTn; fill bytes
+   // (FF FF) and stuffed zeros (FF 00) are skipped the way the entropy
+   // decoder skips them, and any other marker ends the scan
+   starts = (stbi_uc **) stbi__malloc(sizeof(*starts) * segments);
+   if (!starts) return -1;
+   starts[0] = s->img_buffer;
+   count = 1;
+   for (p = s->img_buffer; p < end; ) {
+      stbi_uc *q = (stbi_uc *) memchr(p, 0xff, end - p);
+      if (!q) break;
+      while (q < end && *q == 0xff) ++q;
+      if (q == end) break;
+      p = q + 1;
+      if (*q == 0) continue;
+      if (!STBI__RESTART(*q)) break;
+      if (count == segments) { count = 0; break; } // more restarts than intervals
+      starts[count++] = p;
+   }
+   if (count != segments) {
+      // damaged or unusual stream: leave it to the serial decoder
+      STBI_FREE(starts);
+      return -1;
+   }
+
+   {
+      std::vector<std::thread> workers;
+      std::vector<stbi__context> contexts;
+      std::vector<stbi__jpeg *> decoders;
+      std::vector<int> done;
+      try {
+         // reserved up front, so push_back below never throws with a
+         // started thread in hand
+         workers.reserve(threads - 1);
+         contexts.resize(threads - 1);
+         decoders.assign(threads - 1, (stbi__jpeg *) NULL);
+         done.assign(threads - 1, 0);
+      } catch (...) {
+         STBI_FREE(starts);
+         return -1;
+      }
+
+      for (t=0; t < threads-1; ++t) {
+         int a = (int) ((double) segments * t / threads);
+         int b = (int) ((double) segments * (t+1) / threads);
+         // stbi__jpeg is large, so copies live on the heap
+         stbi__jpeg *d = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+         if (!d) { ok = 0; break; }
+         *d = *z;
+         stbi__start_mem(&contexts[t], starts[a], (int) (end - starts[a]));
+         d->s = &contexts[t];
+         stbi__jpeg_reset(d);
+         decoders[t] = d;
+         try {
+            workers.push_back(std::thread([d, a, b, ri, &done, t]() {
+               int n;
+               done[t] = stbi__jpeg_decode_mcus(d, a*ri, b*ri, &n) && n == b*ri;
+            }));
+         } catch (...) {
+            // no thread left: join the ones already running, then decode
+            // the scan serially like any other failure
+            ok = 0;
+            break;
+         }
+      }
+
+      if (ok) {
+         int a = (int) ((double) segments * (threads-1) / threads);
+         s->img_buffer = starts[a];
+         stbi__jpeg_reset(z);
+         result = stbi__jpeg_decode_mcus(z, a*ri, total, &next);
+      }
+
+      for (t=0; t < (int) workers.size(); ++t) {
+         workers[t].join();
+         ok = ok && done[t];
+      }
+      for (t=0; t < threads-1; ++t)
+         STBI_FREE(decoders[t]);
+
+      if (!ok) {
+         // a worker failed or stopped early; decode the whole scan again in
+         // order so the image and any error are exactly the serial ones
+         s->img_buffer = starts[0];
+         stbi__jpeg_reset(z);
+         result = stbi__jpeg_decode_mcus(z, 0, total, &next);
+      }
+   }
+   STBI_FREE(starts);
+   return result;
+}
+#endif
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
    if (!z->progressive) {
+      int next, total;
       if (z->scan_n == 1) {
-         int i,j;
-         STBI_SIMD_ALIGN(short, data[64]);
          int n = z->order[0];
-         // non-interleaved data, we just need to process one block at a time,
-         // in trivial scanline order
-         // number of blocks to do just depends on how many actual "pixels" this
-         // component has, independent of interleaved MCU blocking and such
-         int w = (z->img_comp[n].x+7) >> 3;
-         int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-               // every data block is an MCU, so countdown the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  // if it's NOT a restart, then just bail, so we get corrupt data
-                  // rather than no data
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
-            }
-         }
-         return 1;
-      } else { // interleaved
-         int i,j,k,x,y;
-         STBI_SIMD_ALIGN(short, data[64]);
-         for (j=0; j < z->img_mcu_y; ++j) {
-            for (i=0; i < z->img_mcu_x; ++i) {
-               // scan an interleaved mcu... process scan_n components in order
-               for (k=0; k < z->scan_n; ++k) {
-                  int n = z->order[k];
-                  // scan out an mcu's worth of this component; that's just determined
-                  // by the basic H and V specified for the component
-                  for (y=0; y < z->img_comp[n].v; ++y) {
-                     for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
-                        int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
-                     }
-                  }
-               }
-               // after all interleaved components, that's an interleaved MCU,
-               // so now count down the restart interval
-               if (--z->todo <= 0) {
-                  if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
-                  if (!STBI__RESTART(z->marker)) return 1;
-                  stbi__jpeg_reset(z);
-               }
-            }
-         }
-         return 1;
+         total = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+      } else {
+         total = z->img_mcu_x * z->img_mcu_y;
+      }
+#ifdef STBI__JPEG_THREADS
+      {
+         int result = stbi__jpeg_decode_parallel(z, total);
+         if (result >= 0) return result;
       }
+#endif
+      return stbi__jpeg_decode_mcus(z, 0, total, &next);
    } else {
       if (z->scan_n == 1) {
          int i,j;
@@ -3082,6 +3389,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
+      int bs = 8 >> z->scale_shift;
       for (n=0; n < z->s->img_n; ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
@@ -3089,7 +3397,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3328,9 +3636,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-      // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // so these muls can't overflow with 32-bit ints (which we require).
+      // when decoding scaled, every block is smaller than 8x8
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3340,10 +3649,9 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 64, z->img_comp[i].coeff_h, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3643,6 +3951,78 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// same filter as stbi__resample_row_hv_2_simd, 16 pixels at a time
+STBI__AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   // as in the SSE2 version, the last pixel in a row is left to the scalar loop
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass: 3*near + far = 4*near + (far - near)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff);
+
+      // "prev" and "next" are the current row shifted by one pixel across
+      // the whole register; alignr works within 128-bit lanes, so the lane
+      // carrying over is brought next to it with a permute first.
+      __m256i lo0  = _mm256_permute2x128_si256(curr, curr, 0x08); // [0, curr.lo]
+      __m256i hi0  = _mm256_permute2x128_si256(curr, curr, 0x81); // [curr.hi, 0]
+      __m256i prv0 = _mm256_alignr_epi8(curr, lo0, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hi0, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // even pixels = 3*cur + prev, odd pixels = 3*cur + next
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleaving within lanes and packing back gives the 32 output
+      // bytes in order: pixels 0-7 in the low lane, 8-15 in the high one
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3817,6 +4197,93 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// same arithmetic as the SSE2 version (and so the same results as the scalar
+// one), 16 pixels at a time, for both 3- and 4-channel output
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 3 || step == 4) {
+      __m128i signflip  = _mm_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m128i alpha = _mm_set1_epi8(-1);
+      // step 3 interleave: each 16-byte output picks bytes of r, g and b
+      // (-128 gives zero)
+      __m128i r0 = _mm_setr_epi8(0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128, 5);
+      __m128i g0 = _mm_setr_epi8(-128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128);
+      __m128i b0 = _mm_setr_epi8(-128, -128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128);
+      __m128i r1 = _mm_setr_epi8(-128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10, -128);
+      __m128i g1 = _mm_setr_epi8(5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10);
+      __m128i b1 = _mm_setr_epi8(-128, 5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128);
+      __m128i r2 = _mm_setr_epi8(-128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128, -128);
+      __m128i g2 = _mm_setr_epi8(-128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128);
+      __m128i b2 = _mm_setr_epi8(10, -128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15);
+
+      for (; i+15 < count; i += 16) {
+         // load, then widen to short: y as (y << 8) + 128 like the SSE2
+         // unpack with y_bias, cr and cb biased by -128 and shifted left by 8
+         __m128i y_bytes  = _mm_loadu_si128((__m128i *) (y+i));
+         __m128i cr_bytes = _mm_loadu_si128((__m128i *) (pcr+i));
+         __m128i cb_bytes = _mm_loadu_si128((__m128i *) (pcb+i));
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(_mm256_cvtepu8_epi16(y_bytes), 8), y_bias);
+         __m256i crw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(cr_bytes, signflip)), 8);
+         __m256i cbw = _mm256_slli_epi16(_mm256_cvtepi8_epi16(_mm_xor_si128(cb_bytes, signflip)), 8);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte; packus works per lane, the permute puts r and g
+         // into their own halves
+         __m256i rg = _mm256_permute4x64_epi64(_mm256_packus_epi16(rw, gw), 0xD8);
+         __m128i r  = _mm256_castsi256_si128(rg);
+         __m128i g  = _mm256_extracti128_si256(rg, 1);
+         __m128i b  = _mm_packus_epi16(_mm256_castsi256_si128(bw), _mm256_extracti128_si256(bw, 1));
+
+         if (step == 4) {
+            __m128i rg0 = _mm_unpacklo_epi8(r, g);
+            __m128i rg1 = _mm_unpackhi_epi8(r, g);
+            __m128i ba0 = _mm_unpacklo_epi8(b, alpha);
+            __m128i ba1 = _mm_unpackhi_epi8(b, alpha);
+            _mm_storeu_si128((__m128i *) (out +  0), _mm_unpacklo_epi16(rg0, ba0));
+            _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi16(rg0, ba0));
+            _mm_storeu_si128((__m128i *) (out + 32), _mm_unpacklo_epi16(rg1, ba1));
+            _mm_storeu_si128((__m128i *) (out + 48), _mm_unpackhi_epi16(rg1, ba1));
+            out += 64;
+         } else {
+            __m128i o0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(b, b0));
+            __m128i o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(b, b1));
+            __m128i o2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(b, b2));
+            _mm_storeu_si128((__m128i *) (out +  0), o0);
+            _mm_storeu_si128((__m128i *) (out + 16), o1);
+            _mm_storeu_si128((__m128i *) (out + 32), o2);
+            out += 48;
+         }
+      }
+   }
+
+   stbi__YCbCr_to_RGB_row(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
@@ -3832,6 +4299,15 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    }
 #endif
 
+#ifdef STBI_AVX2
+   // the IDCT keeps its SSE2 kernel: it is called for one 8x8 block at a
+   // time, and a row of 8 shorts already fills an SSE register
+   if (stbi__avx2_available()) {
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
+#endif
+
 #ifdef STBI_NEON
    j->idct_block_kernel = stbi__idct_simd;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
@@ -3873,6 +4349,19 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // scaled decode: the component planes hold the image at the smaller
+   // size, so resample and convert from that. (the sizes in blocks, which
+   // the scans needed, are derived from the full size)
+   if (z->scale_shift) {
+      int sh = z->scale_shift;
+      z->s->img_x = (z->s->img_x + (1 << sh) - 1) >> sh;
+      z->s->img_y = (z->s->img_y + (1 << sh) - 1) >> sh;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x = (z->s->img_x * z->img_comp[n].h + z->img_h_max-1) / z->img_h_max;
+         z->img_comp[n].y = (z->s->img_y * z->img_comp[n].v + z->img_v_max-1) / z->img_v_max;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -4034,6 +4523,12 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   switch (stbi__jpeg_scale_denom) {
+      case 2: j->scale_shift = 1; j->idct_block_kernel = stbi__idct_block_4x4; break;
+      case 4: j->scale_shift = 2; j->idct_block_kernel = stbi__idct_block_2x2; break;
+      case 8: j->scale_shift = 3; j->idct_block_kernel = stbi__idct_block_1x1; break;
+      default: break;
+   }
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
    return result;
@@ -4201,6 +4696,23 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 
 static void stbi__fill_bits(stbi__zbuf *z)
 {
+   // with 4 input bytes at hand, add all whole bytes that fit with one load:
+   // the same bytes the loop below would add one at a time
+   if (z->num_bits <= 24 && z->zbuffer_end - z->zbuffer >= 4) {
+      int n = (32 - z->num_bits) >> 3;
+      stbi__uint32 v;
+      if (z->code_buffer >= (1U << z->num_bits)) {
+        z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
+        return;
+      }
+      v = (stbi__uint32) z->zbuffer[0] | ((stbi__uint32) z->zbuffer[1] << 8) |
+          ((stbi__uint32) z->zbuffer[2] << 16) | ((stbi__uint32) z->zbuffer[3] << 24);
+      if (n < 4) v &= (1U << (n * 8)) - 1;
+      z->code_buffer |= v << z->num_bits;
+      z->num_bits += n * 8;
+      z->zbuffer += n;
+      return;
+   }
    do {
       if (z->code_buffer >= (1U << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
@@ -4347,9 +4859,13 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
          } else {
+            if (dist >= 8) {
+               for (; len >= 8; len -= 8, zout += 8, p += 8)
+                  memcpy(zout, p, 8);
+            }
             if (len) { do *zout++ = *p++; while (--len); }
          }
       }
@@ -4667,6 +5183,102 @@ static int stbi__paeth(int a, int b, int c)
    return t1;
 }
 
+#ifdef STBI_SSE2
+// SSE2 unfiltering for 8-bit RGB and RGBA scanlines (filter_bytes 3 or 4).
+// Sub, avg and paeth depend on the previous pixel, so pixels are still
+// processed one after another, but all channels of a pixel at once;
+// up has no such dependency and runs 16 bytes at a time.
+// Returns 0 if the case is not handled here.
+
+// pixel <-> 16-bit lanes; fixed-size copies, a memcpy of n bytes would be a
+// library call per pixel
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+   int v;
+   if (n == 4)
+      memcpy(&v, p, 4);
+   else
+      v = p[0] | (p[1] << 8) | (p[2] << 16);
+   return _mm_unpacklo_epi8(_mm_cvtsi32_si128(v), _mm_setzero_si128());
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n)
+{
+   int w = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+   if (n == 4)
+      memcpy(p, &w, 4);
+   else
+      memcpy(p, &w, 3);
+}
+
+static int stbi__unfilter_row_simd(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk, int n)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i mask = _mm_set1_epi16(255);
+   __m128i a, b, c, x;
+   int k;
+
+   if (filter == STBI__F_up) {
+      for (k = 0; k + 16 <= nk; k += 16) {
+         __m128i r = _mm_loadu_si128((const __m128i *) (raw + k));
+         __m128i q = _mm_loadu_si128((const __m128i *) (prior + k));
+         _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(r, q));
+      }
+      for (; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      return 1;
+   }
+   if (n != 3 && n != 4) return 0;
+
+   // a - previous pixel of the row, b - pixel above, c - pixel above a;
+   // all in 16-bit lanes, results are wrapped to a byte with mask
+   a = zero;
+   c = zero;
+   switch (filter) {
+   case STBI__F_sub:
+      for (k = 0; k < nk; k += n) {
+         x = _mm_and_si128(_mm_add_epi16(stbi__png_load_pixel(raw + k, n), a), mask);
+         stbi__png_store_pixel(cur + k, x, n);
+         a = x;
+      }
+      return 1;
+   case STBI__F_avg:
+   case STBI__F_avg_first:
+      for (k = 0; k < nk; k += n) {
+         b = filter == STBI__F_avg ? stbi__png_load_pixel(prior + k, n) : zero;
+         x = _mm_srli_epi16(_mm_add_epi16(a, b), 1);
+         x = _mm_and_si128(_mm_add_epi16(stbi__png_load_pixel(raw + k, n), x), mask);
+         stbi__png_store_pixel(cur + k, x, n);
+         a = x;
+      }
+      return 1;
+   case STBI__F_paeth:
+      for (k = 0; k < nk; k += n) {
+         __m128i pa, pb, pc, t, use_a, use_b;
+         b = stbi__png_load_pixel(prior + k, n);
+         // reference predictor from the PNG spec: p = a + b - c, pick the
+         // nearest of a, b, c with ties resolved in that order
+         pa = _mm_sub_epi16(b, c);
+         pb = _mm_sub_epi16(a, c);
+         pc = _mm_add_epi16(pa, pb);
+         pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+         pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+         pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+         use_a = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+         use_b = _mm_andnot_si128(_mm_cmpgt_epi16(pb, pc), _mm_set1_epi16(-1));
+         t = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+         t = _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, t));
+         x = _mm_and_si128(_mm_add_epi16(stbi__png_load_pixel(raw + k, n), t), mask);
+         stbi__png_store_pixel(cur + k, x, n);
+         a = x;
+         c = b;
+      }
+      return 1;
+   }
+   return 0;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // adds an extra all-255 alpha channel
@@ -4751,6 +5363,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
+#ifdef STBI_SSE2
+      if (filter != STBI__F_none && stbi__unfilter_row_simd(filter, cur, raw, prior, nk, filter_bytes))
+         filter = -1; // done, matches no case below
+#endif
+
       // perform actual filtering
       switch (filter) {
       case STBI__F_none: